@@ -0,0 +1,426 @@
+﻿#pragma hdrstop
+
+#include "src/SearchBitmap.h"
+
+#include <algorithm>
+#include <iterator>
+
+#pragma package(smart_init)
+
+namespace searcher {
+
+namespace {
+
+unsigned PopCount(std::uint64_t word) noexcept
+{
+  word = word - ((word >> 1) & 0x5555555555555555ull);
+  word = (word & 0x3333333333333333ull) + ((word >> 2) & 0x3333333333333333ull);
+  word = (word + (word >> 4)) & 0x0F0F0F0F0F0F0F0Full;
+
+  return static_cast<unsigned>((word * 0x0101010101010101ull) >> 56);
+}
+
+std::uint32_t CountBits(const std::vector<std::uint64_t>& bits) noexcept
+{
+  std::uint32_t count = 0;
+
+  for (const auto word : bits)
+    count += PopCount(word);
+
+  return count;
+}
+
+bool HasBit(const std::vector<std::uint64_t>& bits, const std::uint16_t low) noexcept
+{
+  return (bits[low >> 6] >> (low & 63)) & 1;
+}
+
+} // namespace
+
+void RowBitmap::Clear() noexcept
+{
+  containers_.clear();
+}
+
+bool RowBitmap::Empty() const noexcept
+{
+  return containers_.empty();
+}
+
+void RowBitmap::Add(const std::uint32_t row)
+{
+  const std::uint16_t key = static_cast<std::uint16_t>(row >> 16);
+  const std::uint16_t low = static_cast<std::uint16_t>(row);
+
+  auto it = containers_.end();
+
+  if (containers_.empty() || containers_.back().key < key)
+  {
+    containers_.emplace_back();
+    containers_.back().key = key;
+
+    it = std::prev(containers_.end());
+  }
+  else if (containers_.back().key == key)
+  {
+    it = std::prev(containers_.end());
+  }
+  else
+  {
+    it = std::lower_bound(containers_.begin(), containers_.end(), key, [](const Container& container, const std::uint16_t k)
+    {
+      return container.key < k;
+    });
+
+    if (it->key != key)
+    {
+      it = containers_.emplace(it);
+      it->key = key;
+    }
+  }
+
+  Container& container = *it;
+
+  if (container.IsBitmap())
+  {
+    if (HasBit(container.bits, low))
+      return;
+
+    container.bits[low >> 6] |= (1ull << (low & 63));
+    container.cardinality++;
+    return;
+  }
+
+  if (container.array.empty() || container.array.back() < low)
+  {
+    container.array.push_back(low);
+  }
+  else
+  {
+    const auto pos = std::lower_bound(container.array.begin(), container.array.end(), low);
+
+    if (*pos == low)
+      return;
+
+    container.array.insert(pos, low);
+  }
+
+  if (++container.cardinality > MAX_ARRAY)
+    ToBitmap(container);
+}
+
+bool RowBitmap::Contains(const std::uint32_t row) const noexcept
+{
+  const Container* container = Find(static_cast<std::uint16_t>(row >> 16));
+
+  if (!container)
+    return false;
+
+  const std::uint16_t low = static_cast<std::uint16_t>(row);
+
+  return container->IsBitmap() ? HasBit(container->bits, low) :
+                                 std::binary_search(container->array.begin(), container->array.end(), low);
+}
+
+std::size_t RowBitmap::Cardinality() const noexcept
+{
+  std::size_t cardinality = 0;
+
+  for (const auto& container : containers_)
+    cardinality += container.cardinality;
+
+  return cardinality;
+}
+
+RowBitmap& RowBitmap::operator&=(const RowBitmap& other)
+{
+  std::size_t count = 0;
+
+  auto it = other.containers_.begin();
+
+  for (auto& container : containers_)
+  {
+    while (it != other.containers_.end() && it->key < container.key)
+      ++it;
+
+    if (it == other.containers_.end())
+      break;
+
+    if (it->key != container.key)
+      continue;
+
+    And(container, *it);
+
+    if (container.cardinality > 0)
+      Keep(container, count);
+  }
+
+  containers_.erase(containers_.begin() + count, containers_.end());
+  return *this;
+}
+
+void RowBitmap::Keep(Container& container, std::size_t& count)
+{
+  if (&containers_[count] != &container)
+    containers_[count] = std::move(container);
+
+  count++;
+}
+
+RowBitmap& RowBitmap::operator|=(const RowBitmap& other)
+{
+  std::vector<Container> containers;
+  containers.reserve(containers_.size() + other.containers_.size());
+
+  auto lhs = containers_.begin();
+  auto rhs = other.containers_.begin();
+
+  while (lhs != containers_.end() || rhs != other.containers_.end())
+  {
+    if (rhs == other.containers_.end() || (lhs != containers_.end() && lhs->key < rhs->key))
+    {
+      containers.push_back(std::move(*lhs++));
+    }
+    else if (lhs == containers_.end() || rhs->key < lhs->key)
+    {
+      containers.push_back(*rhs++);
+    }
+    else
+    {
+      Or(*lhs, *rhs++);
+      containers.push_back(std::move(*lhs++));
+    }
+  }
+
+  containers_ = std::move(containers);
+  return *this;
+}
+
+RowBitmap& RowBitmap::operator-=(const RowBitmap& other)
+{
+  std::size_t count = 0;
+
+  auto it = other.containers_.begin();
+
+  for (auto& container : containers_)
+  {
+    while (it != other.containers_.end() && it->key < container.key)
+      ++it;
+
+    if (it != other.containers_.end() && it->key == container.key)
+      AndNot(container, *it);
+
+    if (container.cardinality > 0)
+      Keep(container, count);
+  }
+
+  containers_.erase(containers_.begin() + count, containers_.end());
+  return *this;
+}
+
+RowBitmap operator&(RowBitmap lhs, const RowBitmap& rhs)
+{
+  return lhs &= rhs;
+}
+
+RowBitmap operator|(RowBitmap lhs, const RowBitmap& rhs)
+{
+  return lhs |= rhs;
+}
+
+RowBitmap operator-(RowBitmap lhs, const RowBitmap& rhs)
+{
+  return lhs -= rhs;
+}
+
+bool operator==(const RowBitmap& lhs, const RowBitmap& rhs) noexcept
+{
+  // The representation of a chunk depends only on the amount of its rows
+  return std::equal(lhs.containers_.begin(), lhs.containers_.end(), rhs.containers_.begin(), rhs.containers_.end(),
+                    [](const RowBitmap::Container& a, const RowBitmap::Container& b)
+  {
+    return (a.key == b.key) && (a.cardinality == b.cardinality) && (a.array == b.array) && (a.bits == b.bits);
+  });
+}
+
+bool operator!=(const RowBitmap& lhs, const RowBitmap& rhs) noexcept
+{
+  return !(lhs == rhs);
+}
+
+std::size_t RowBitmap::MemoryUsage() const noexcept
+{
+  std::size_t usage = containers_.capacity() * sizeof(Container);
+
+  for (const auto& container : containers_)
+    usage += container.array.capacity() * sizeof(std::uint16_t) + container.bits.capacity() * sizeof(std::uint64_t);
+
+  return usage;
+}
+
+const RowBitmap::Container* RowBitmap::Find(const std::uint16_t key) const noexcept
+{
+  const auto it = std::lower_bound(containers_.begin(), containers_.end(), key, [](const Container& container, const std::uint16_t k)
+  {
+    return container.key < k;
+  });
+
+  return (it != containers_.end() && it->key == key) ? &*it : nullptr;
+}
+
+void RowBitmap::ToBitmap(Container& container)
+{
+  container.bits.assign(BITMAP_WORDS, 0);
+
+  for (const auto low : container.array)
+    container.bits[low >> 6] |= (1ull << (low & 63));
+
+  std::vector<std::uint16_t>().swap(container.array);
+}
+
+void RowBitmap::ToArray(Container& container)
+{
+  std::vector<std::uint16_t> array;
+  array.reserve(container.cardinality);
+
+  for (std::size_t i = 0; i < container.bits.size(); i++)
+  {
+    for (std::uint64_t word = container.bits[i]; word != 0; word &= word - 1)
+      array.push_back(static_cast<std::uint16_t>(i * 64 + LowestBit(word)));
+  }
+
+  container.array = std::move(array);
+  std::vector<std::uint64_t>().swap(container.bits);
+}
+
+void RowBitmap::Normalize(Container& container)
+{
+  if (container.IsBitmap() && container.cardinality <= MAX_ARRAY)
+    ToArray(container);
+  else if (!container.IsBitmap() && container.cardinality > MAX_ARRAY)
+    ToBitmap(container);
+}
+
+void RowBitmap::And(Container& lhs, const Container& rhs)
+{
+  if (!lhs.IsBitmap() && !rhs.IsBitmap())
+  {
+    std::vector<std::uint16_t> array;
+    array.reserve(std::min(lhs.array.size(), rhs.array.size()));
+
+    std::set_intersection(lhs.array.begin(), lhs.array.end(), rhs.array.begin(), rhs.array.end(), std::back_inserter(array));
+
+    lhs.array = std::move(array);
+    lhs.cardinality = static_cast<std::uint32_t>(lhs.array.size());
+  }
+  else if (!lhs.IsBitmap())
+  {
+    lhs.array.erase(std::remove_if(lhs.array.begin(), lhs.array.end(), [&rhs](const std::uint16_t low)
+    {
+      return !HasBit(rhs.bits, low);
+    }), lhs.array.end());
+
+    lhs.cardinality = static_cast<std::uint32_t>(lhs.array.size());
+  }
+  else if (!rhs.IsBitmap())
+  {
+    std::vector<std::uint16_t> array;
+    array.reserve(rhs.array.size());
+
+    for (const auto low : rhs.array)
+    {
+      if (HasBit(lhs.bits, low))
+        array.push_back(low);
+    }
+
+    lhs.array = std::move(array);
+    lhs.cardinality = static_cast<std::uint32_t>(lhs.array.size());
+
+    std::vector<std::uint64_t>().swap(lhs.bits);
+  }
+  else
+  {
+    for (std::size_t i = 0; i < BITMAP_WORDS; i++)
+      lhs.bits[i] &= rhs.bits[i];
+
+    lhs.cardinality = CountBits(lhs.bits);
+  }
+
+  Normalize(lhs);
+}
+
+void RowBitmap::Or(Container& lhs, const Container& rhs)
+{
+  if (!lhs.IsBitmap() && !rhs.IsBitmap())
+  {
+    std::vector<std::uint16_t> array;
+    array.reserve(lhs.array.size() + rhs.array.size());
+
+    std::set_union(lhs.array.begin(), lhs.array.end(), rhs.array.begin(), rhs.array.end(), std::back_inserter(array));
+
+    lhs.array = std::move(array);
+    lhs.cardinality = static_cast<std::uint32_t>(lhs.array.size());
+  }
+  else
+  {
+    if (!lhs.IsBitmap())
+      ToBitmap(lhs);
+
+    if (rhs.IsBitmap())
+    {
+      for (std::size_t i = 0; i < BITMAP_WORDS; i++)
+        lhs.bits[i] |= rhs.bits[i];
+    }
+    else
+    {
+      for (const auto low : rhs.array)
+        lhs.bits[low >> 6] |= (1ull << (low & 63));
+    }
+
+    lhs.cardinality = CountBits(lhs.bits);
+  }
+
+  Normalize(lhs);
+}
+
+void RowBitmap::AndNot(Container& lhs, const Container& rhs)
+{
+  if (!lhs.IsBitmap() && !rhs.IsBitmap())
+  {
+    std::vector<std::uint16_t> array;
+    array.reserve(lhs.array.size());
+
+    std::set_difference(lhs.array.begin(), lhs.array.end(), rhs.array.begin(), rhs.array.end(), std::back_inserter(array));
+
+    lhs.array = std::move(array);
+    lhs.cardinality = static_cast<std::uint32_t>(lhs.array.size());
+  }
+  else if (!lhs.IsBitmap())
+  {
+    lhs.array.erase(std::remove_if(lhs.array.begin(), lhs.array.end(), [&rhs](const std::uint16_t low)
+    {
+      return HasBit(rhs.bits, low);
+    }), lhs.array.end());
+
+    lhs.cardinality = static_cast<std::uint32_t>(lhs.array.size());
+  }
+  else
+  {
+    if (rhs.IsBitmap())
+    {
+      for (std::size_t i = 0; i < BITMAP_WORDS; i++)
+        lhs.bits[i] &= ~rhs.bits[i];
+    }
+    else
+    {
+      for (const auto low : rhs.array)
+        lhs.bits[low >> 6] &= ~(1ull << (low & 63));
+    }
+
+    lhs.cardinality = CountBits(lhs.bits);
+  }
+
+  Normalize(lhs);
+}
+
+} // namespace searcher
@@ -0,0 +1,134 @@
+﻿#ifndef SearchBitmapH
+#define SearchBitmapH
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace searcher
+{
+  // Set of rows compressed as a Roaring bitmap: the rows are split into chunks of 65536 by their
+  // high 16 bits, a chunk with few rows keeps the sorted low bits of the rows, a dense one keeps
+  // the bitmap of the whole chunk. Set operations are made chunk by chunk on their representations,
+  // so a result with a few thousand rows out of a million takes a few kilobytes
+
+  class RowBitmap
+  {
+   public:
+
+    void Clear() noexcept;
+    bool Empty() const noexcept;
+
+    /// Method of adding the row (rows added in ascending order are appended)
+    void Add(const std::uint32_t row);
+
+    bool Contains(const std::uint32_t row) const noexcept;
+
+    /// Amount of rows in the set
+    std::size_t Cardinality() const noexcept;
+
+    RowBitmap& operator&=(const RowBitmap& other); // AND
+    RowBitmap& operator|=(const RowBitmap& other); // OR
+    RowBitmap& operator-=(const RowBitmap& other); // AND NOT
+
+    friend RowBitmap operator&(RowBitmap lhs, const RowBitmap& rhs);
+    friend RowBitmap operator|(RowBitmap lhs, const RowBitmap& rhs);
+    friend RowBitmap operator-(RowBitmap lhs, const RowBitmap& rhs);
+
+    friend bool operator==(const RowBitmap& lhs, const RowBitmap& rhs) noexcept;
+    friend bool operator!=(const RowBitmap& lhs, const RowBitmap& rhs) noexcept;
+
+    /// Method of calling the function for every row in ascending order
+    ///
+    /// @param[in] function - void(std::uint32_t row)
+
+    template <typename Function>
+    void ForEach(Function&& function) const;
+
+    /// Memory used by the set (bytes)
+    std::size_t MemoryUsage() const noexcept;
+
+   private:
+
+    static constexpr std::uint32_t MAX_ARRAY    = 4096;      // A chunk with more rows is a bitmap (of the same 8 KB)
+    static constexpr std::size_t   BITMAP_WORDS = 65536 / 64;
+
+    struct Container
+    {
+      std::uint16_t key         { 0 }; // High bits of the rows
+      std::uint32_t cardinality { 0 };
+
+      std::vector<std::uint16_t> array; // Sparse chunk: sorted low bits of the rows
+      std::vector<std::uint64_t> bits;  // Dense chunk: bitmap of the rows (the array is empty)
+
+      bool IsBitmap() const noexcept
+      {
+        return !bits.empty();
+      }
+    };
+
+    /// Container of the chunk (nullptr if the chunk is empty)
+    const Container* Find(const std::uint16_t key) const noexcept;
+
+    /// Method of moving the non-empty chunk to the position (chunks are compacted after an operation)
+    void Keep(Container& container, std::size_t& count);
+
+    /// Methods of switching the representation of the chunk
+    static void ToBitmap(Container& container);
+    static void ToArray(Container& container);
+
+    /// Method of choosing the representation by the amount of rows (after an operation)
+    static void Normalize(Container& container);
+
+    /// Operations on chunks with the same key (the result is in lhs, it may become empty)
+    static void And(Container& lhs, const Container& rhs);
+    static void Or(Container& lhs, const Container& rhs);
+    static void AndNot(Container& lhs, const Container& rhs);
+
+    /// Index of the lowest set bit of the word (the word isn't 0)
+    static unsigned LowestBit(const std::uint64_t word) noexcept;
+
+   private:
+
+    std::vector<Container> containers_; // Non-empty chunks ordered by the key
+  };
+
+  inline unsigned RowBitmap::LowestBit(const std::uint64_t word) noexcept
+  {
+    // De Bruijn multiplication: the bits up to the lowest set one give a unique top 6 bits
+    static const unsigned char index[64] = {
+       0, 47,  1, 56, 48, 27,  2, 60, 57, 49, 41, 37, 28, 16,  3, 61,
+      54, 58, 35, 52, 50, 42, 21, 44, 38, 32, 29, 23, 17, 11,  4, 62,
+      46, 55, 26, 59, 40, 36, 15, 53, 34, 51, 20, 43, 31, 22, 10, 45,
+      25, 39, 14, 33, 19, 30,  9, 24, 13, 18,  8, 12,  7,  6,  5, 63
+    };
+
+    return index[((word ^ (word - 1)) * 0x03F79D71B4CB0A89ull) >> 58];
+  }
+
+  template <typename Function>
+  void RowBitmap::ForEach(Function&& function) const
+  {
+    for (const auto& container : containers_)
+    {
+      const std::uint32_t high = static_cast<std::uint32_t>(container.key) << 16;
+
+      if (!container.IsBitmap())
+      {
+        for (const auto low : container.array)
+          function(high | low);
+
+        continue;
+      }
+
+      for (std::size_t i = 0; i < container.bits.size(); i++)
+      {
+        for (std::uint64_t word = container.bits[i]; word != 0; word &= word - 1)
+          function(high | static_cast<std::uint32_t>(i * 64 + LowestBit(word)));
+      }
+    }
+  }
+
+} // namespace searcher
+
+#endif
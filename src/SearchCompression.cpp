@@ -0,0 +1,331 @@
+﻿#pragma hdrstop
+
+#include "src/SearchCompression.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <unordered_map>
+
+#pragma package(smart_init)
+
+namespace searcher {
+
+namespace {
+
+constexpr unsigned TRAINING_ROUNDS = 5;
+constexpr unsigned MAX_SYMBOLS     = SymbolTable::ESCAPE;
+
+} // namespace
+
+SymbolTable SymbolTable::Train(const std::vector<std::string_view>& sample)
+{
+  // Rounds of: compressing the sample with the current table, counting the symbols
+  // and the pairs of adjacent symbols, keeping the candidates that save the most bytes.
+  // Escaped characters are candidates as well, so frequent characters get codes too
+
+  SymbolTable table;
+
+  for (unsigned round = 0; round < TRAINING_ROUNDS; round++)
+  {
+    std::unordered_map<std::string, std::uint64_t> counts;
+
+    for (const auto text : sample)
+    {
+      std::string previous;
+
+      for (std::size_t pos = 0; pos < text.length(); )
+      {
+        const int code = table.Match(text.substr(pos));
+
+        std::string current = (code >= 0) ? table.symbols_[code] : std::string(1, text[pos]);
+        pos += current.length();
+
+        counts[current]++;
+
+        if (!previous.empty() && previous.length() + current.length() <= MAX_SYMBOL)
+          counts[previous + current]++;
+
+        previous = std::move(current);
+      }
+    }
+
+    std::vector<std::pair<std::uint64_t, std::string>> candidates;
+
+    for (auto& count : counts)
+    {
+      // Single characters save nothing until they are frequent (escape costs a byte)
+      const std::uint64_t gain = count.second * count.first.length();
+
+      if (count.second > 1)
+        candidates.emplace_back(gain, count.first);
+    }
+
+    const std::size_t kept = std::min<std::size_t>(candidates.size(), MAX_SYMBOLS);
+
+    std::partial_sort(candidates.begin(), candidates.begin() + kept, candidates.end(),
+      [](const auto& lhs, const auto& rhs)
+      {
+        return (lhs.first != rhs.first) ? (lhs.first > rhs.first) : (lhs.second < rhs.second);
+      });
+
+    table.symbols_.clear();
+
+    for (std::size_t i = 0; i < kept; i++)
+      table.symbols_.push_back(std::move(candidates[i].second));
+
+    table.BuildIndex();
+  }
+
+  return table;
+}
+
+SymbolTable SymbolTable::FromSymbols(std::vector<std::string> symbols)
+{
+  const bool isValid = (symbols.size() <= MAX_SYMBOLS) && std::all_of(symbols.begin(), symbols.end(), [](const std::string& symbol)
+  {
+    return !symbol.empty() && symbol.length() <= MAX_SYMBOL;
+  });
+
+  if (!isValid)
+    throw std::invalid_argument("Invalid symbols of the table");
+
+  SymbolTable table;
+
+  table.symbols_ = std::move(symbols);
+  table.BuildIndex();
+
+  return table;
+}
+
+void SymbolTable::BuildIndex()
+{
+  byFirst_.clear();
+
+  std::vector<std::vector<unsigned char>> buckets(256);
+
+  for (std::size_t code = 0; code < symbols_.size(); code++)
+    buckets[static_cast<unsigned char>(symbols_[code][0])].push_back(static_cast<unsigned char>(code));
+
+  for (unsigned c = 0; c < 256; c++)
+  {
+    auto& bucket = buckets[c];
+
+    std::stable_sort(bucket.begin(), bucket.end(), [this](const unsigned char lhs, const unsigned char rhs)
+    {
+      return symbols_[lhs].length() > symbols_[rhs].length();
+    });
+
+    firstStart_[c] = static_cast<std::uint16_t>(byFirst_.size());
+    byFirst_.insert(byFirst_.end(), bucket.begin(), bucket.end());
+  }
+
+  firstStart_[256] = static_cast<std::uint16_t>(byFirst_.size());
+}
+
+int SymbolTable::Match(const std::string_view text) const noexcept
+{
+  if (text.empty())
+    return -1;
+
+  const unsigned char first = static_cast<unsigned char>(text[0]);
+
+  for (unsigned i = firstStart_[first]; i < firstStart_[first + 1]; i++)
+  {
+    const std::string& symbol = symbols_[byFirst_[i]];
+
+    if (symbol.length() <= text.length() && std::memcmp(symbol.data(), text.data(), symbol.length()) == 0)
+      return byFirst_[i];
+  }
+
+  return -1;
+}
+
+void SymbolTable::Encode(const std::string_view text, std::string& codes) const
+{
+  for (std::size_t pos = 0; pos < text.length(); )
+  {
+    const int code = Match(text.substr(pos));
+
+    if (code >= 0)
+    {
+      codes += static_cast<char>(code);
+      pos   += symbols_[code].length();
+    }
+    else
+    {
+      codes += static_cast<char>(ESCAPE);
+      codes += text[pos++];
+    }
+  }
+}
+
+void SymbolTable::Decode(const std::string_view codes, std::string& text) const
+{
+  for (std::size_t i = 0; i < codes.length(); i++)
+  {
+    const unsigned char code = static_cast<unsigned char>(codes[i]);
+
+    if (code == ESCAPE)
+    {
+      if (++i < codes.length())
+        text += codes[i];
+    }
+    else
+    {
+      text += symbols_[code];
+    }
+  }
+}
+
+std::size_t SymbolTable::SymbolCount() const noexcept
+{
+  return symbols_.size();
+}
+
+const std::string& SymbolTable::Symbol(const unsigned char code) const noexcept
+{
+  return symbols_[code];
+}
+
+CodeMatcher::CodeMatcher(const std::string& pattern, const SymbolTable& table)
+    : table_(&table)
+{
+  const std::size_t length = pattern.length();
+
+  // KMP automaton over characters: states 0..length-1 (the amount of matched characters)
+
+  std::vector<std::size_t> failure(length + 1, 0);
+
+  for (std::size_t i = 1, k = 0; i < length; i++)
+  {
+    while (k > 0 && pattern[i] != pattern[k])
+      k = failure[k];
+
+    if (pattern[i] == pattern[k])
+      k++;
+
+    failure[i + 1] = k;
+  }
+
+  byteNext_.assign(length * 256, 0);
+
+  for (std::size_t state = 0; state < length; state++)
+  {
+    for (unsigned c = 0; c < 256; c++)
+    {
+      std::size_t next = state;
+
+      while (next > 0 && static_cast<unsigned char>(pattern[next]) != c)
+        next = failure[next];
+
+      if (static_cast<unsigned char>(pattern[next]) == c)
+        next++;
+
+      byteNext_[state * 256 + c] = (next == length) ? MATCH : static_cast<std::uint16_t>(next);
+    }
+  }
+
+  // Transitions by the symbols: the characters of a symbol are passed one by one
+
+  codeNext_.assign(length * 256, 0);
+
+  for (std::size_t state = 0; state < length; state++)
+  {
+    for (std::size_t code = 0; code < table.SymbolCount(); code++)
+    {
+      std::uint32_t next    = static_cast<std::uint32_t>(state),
+                    matches = 0;
+
+      for (const char c : table.Symbol(static_cast<unsigned char>(code)))
+      {
+        const std::uint16_t transition = byteNext_[next * 256 + static_cast<unsigned char>(c)];
+
+        if (transition & MATCH)
+        {
+          matches++;
+          next = 0;
+        }
+        else
+        {
+          next = transition;
+        }
+      }
+
+      codeNext_[state * 256 + code] = next | (matches << 16);
+    }
+  }
+
+  for (std::size_t code = 0; code < table.SymbolCount(); code++)
+    idle_[code] = (codeNext_[code] == 0);
+}
+
+template <bool STOP_AT_MATCH>
+unsigned CodeMatcher::Run(const std::string_view codes) const noexcept
+{
+  std::uint32_t state   = 0;
+  unsigned      matches = 0;
+
+  const std::size_t length = codes.length();
+
+  for (std::size_t i = 0; i < length; i++)
+  {
+    if (state == 0)
+    {
+      while (i < length && idle_[static_cast<unsigned char>(codes[i])])
+        i++;
+
+      if (i == length)
+        break;
+    }
+
+    const unsigned char code = static_cast<unsigned char>(codes[i]);
+
+    if (code == SymbolTable::ESCAPE)
+    {
+      if (++i >= length)
+        break;
+
+      const std::uint16_t transition = byteNext_[(state << 8) | static_cast<unsigned char>(codes[i])];
+
+      if (transition & MATCH)
+      {
+        matches++;
+        state = 0;
+      }
+      else
+      {
+        state = transition;
+      }
+    }
+    else
+    {
+      const std::uint32_t transition = codeNext_[(state << 8) | code];
+
+      matches += transition >> 16;
+      state    = transition & 0xFFFF;
+    }
+
+    if (STOP_AT_MATCH && matches)
+      break;
+  }
+
+  return matches;
+}
+
+bool CodeMatcher::Contains(const std::string_view codes) const noexcept
+{
+  return Run<true>(codes) > 0;
+}
+
+unsigned CodeMatcher::Count(const std::string_view codes) const noexcept
+{
+  return Run<false>(codes);
+}
+
+const SymbolTable* CodeMatcher::Table() const noexcept
+{
+  return table_;
+}
+
+} // namespace searcher
@@ -0,0 +1,112 @@
+﻿#ifndef SearchCompressionH
+#define SearchCompressionH
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace searcher
+{
+  // Static symbol table: up to 255 frequent substrings (1..8 characters) are replaced by
+  // one-byte codes, other characters are escaped. Every text is compressed separately,
+  // so any cell is decompressed (or searched) without touching the others
+
+  class SymbolTable final
+  {
+   public:
+
+    static constexpr unsigned char ESCAPE     = 255; // The next byte is a literal character
+    static constexpr std::size_t   MAX_SYMBOL = 8;
+
+    /// Method of building the table from a sample of texts
+    ///
+    /// @param[in] sample - texts
+    /// @return           - table
+
+    static SymbolTable Train(const std::vector<std::string_view>& sample);
+
+    /// Method of restoring the table from its symbols (in the order of their codes)
+    /// @throw std::invalid_argument - too many symbols or a symbol of invalid length
+    static SymbolTable FromSymbols(std::vector<std::string> symbols);
+
+    /// Method of compressing the text (the codes are appended)
+    void Encode(const std::string_view text, std::string& codes) const;
+
+    /// Method of decompressing the codes (the text is appended)
+    void Decode(const std::string_view codes, std::string& text) const;
+
+    std::size_t SymbolCount() const noexcept;
+    const std::string& Symbol(const unsigned char code) const noexcept;
+
+   private:
+
+    /// Method of finding the longest symbol at the start of the text
+    ///
+    /// @return - code of the symbol or -1
+
+    int Match(const std::string_view text) const noexcept;
+
+    void BuildIndex();
+
+   private:
+
+    std::vector<std::string> symbols_;
+
+    // Codes of the symbols by their first character (longest first)
+    std::vector<unsigned char> byFirst_;
+    std::uint16_t              firstStart_[257] {};
+  };
+
+  // Substring search over compressed text (KMP automaton lifted to the symbol codes):
+  // every code is one table lookup, the text isn't decompressed
+
+  class CodeMatcher final
+  {
+   public:
+
+    /// Patterns longer than that aren't compiled (too big tables)
+    static constexpr std::size_t MAX_LENGTH = 64;
+
+    /// @param[in] pattern - non-empty pattern (not longer than MAX_LENGTH)
+    /// @param[in] table   - table the texts are compressed with
+
+    explicit CodeMatcher(const std::string& pattern, const SymbolTable& table);
+
+    /// Method of checking whether the compressed text contains the pattern
+    bool Contains(const std::string_view codes) const noexcept;
+
+    /// Method of counting non-overlapping occurrences of the pattern in the compressed text
+    unsigned Count(const std::string_view codes) const noexcept;
+
+    /// Table the matcher is compiled for
+    const SymbolTable* Table() const noexcept;
+
+   private:
+
+    /// Method of passing the compressed text through the automaton
+    template <bool STOP_AT_MATCH>
+    unsigned Run(const std::string_view codes) const noexcept;
+
+   private:
+
+    // Transitions by a character: next state, MATCH is set when the pattern ends
+    // (the automaton is reset then, so occurrences don't overlap)
+    static constexpr std::uint16_t MATCH = 0x8000;
+
+    std::vector<std::uint16_t> byteNext_; // State * 256 + character
+
+    // Transitions by a code: next state | (amount of matches << 16)
+    std::vector<std::uint32_t> codeNext_; // State * 256 + code
+
+    // Codes that leave the initial state as is: they are skipped without
+    // a chain of dependent lookups (that's most of the text for a rare pattern)
+    bool idle_[256] {};
+
+    const SymbolTable* table_;
+  };
+
+} // namespace searcher
+
+#endif
@@ -0,0 +1,1926 @@
+﻿#pragma hdrstop
+
+#include "src/SearchCore.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <istream>
+#include <new>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+
+#pragma package(smart_init)
+
+namespace searcher {
+
+namespace {
+
+constexpr char     SNAPSHOT_MAGIC[4] = { 'V', 'S', 'T', 'D' };
+constexpr unsigned SNAPSHOT_VERSION  = 2; // 2 - types of the columns are saved
+
+constexpr char          SHARED_MAGIC[4] = { 'V', 'S', 'T', 'G' };
+constexpr char          IMAGE_MAGIC[4]  = { 'V', 'S', 'T', 'I' };
+constexpr std::uint32_t IMAGE_VERSION   = 2; // 2 - generations are reserved before the images are filled
+
+// Segment named as the published dataset: generation of its current image.
+// The image is complete before its generation is stored, and a new image never
+// overwrites the old one, so the attached processes don't need any locks.
+// Every publisher reserves its own generation first, so the images of concurrent
+// publishers have different names and an older one is never published over a newer one
+
+struct SharedDirectory
+{
+  char                       magic[4];
+  std::uint32_t              version;
+  std::atomic<std::uint32_t> generation; // Published
+  std::atomic<std::uint32_t> reserved;   // Last one taken by a publisher
+};
+
+// Image of a dataset (segment "<name>.<generation>"): the header and 8-byte aligned sections.
+// Offsets are relative to the start of the image
+
+struct ImageHeader
+{
+  char          magic[4];
+  std::uint32_t version;
+  std::uint32_t generation;
+  std::int32_t  mainColumn;
+  std::uint64_t size;
+
+  std::uint32_t rows;
+  std::uint32_t columns;
+  std::uint32_t roots;
+  std::uint32_t bitsLog;        // Summaries
+  std::uint64_t summaryRows;
+  std::uint64_t filterWords;
+
+  std::uint64_t parents;
+  std::uint64_t levels;
+  std::uint64_t subtreeEnds;
+  std::uint64_t rootRows;
+  std::uint64_t summaryIndex;
+  std::uint64_t summaryFilters;
+  std::uint64_t columnTable;    // ImageColumn of every column
+  std::uint64_t captions;       // Strings of the snapshot format
+  std::uint64_t captionsSize;
+  std::uint64_t symbols;        // Symbols of the table (no section - the text isn't compressed)
+  std::uint64_t symbolsSize;
+};
+
+struct ImageColumn
+{
+  std::uint64_t pool;
+  std::uint64_t poolSize;
+  std::uint64_t offsets;
+  std::uint64_t offsetsCount;
+  std::uint64_t ids;
+  std::uint64_t idsCount;
+};
+
+static_assert(sizeof(ImageHeader) % 8 == 0 && sizeof(ImageColumn) % 8 == 0, "Sections must stay aligned");
+
+// Row of the dataset for the query plan
+class DatasetRow final : public IRowText
+{
+ public:
+
+  explicit DatasetRow(const SearchDataset& dataset, const std::vector<int>& columns)
+      : dataset_(dataset)
+      , columns_(columns)
+      , symbols_(dataset.Symbols().get())
+  {}
+
+  void SetRow(const unsigned row) noexcept
+  {
+    row_ = row;
+  }
+
+  std::string_view Text(const int column) override
+  {
+    return dataset_.Text(row_, column);
+  }
+
+  bool Codes(const int column, std::string_view& codes, const SymbolTable*& table) override
+  {
+    if (!symbols_)
+      return false;
+
+    codes = dataset_.Codes(row_, column);
+    table = symbols_;
+
+    return true;
+  }
+
+  int ValueId(const int column) override
+  {
+    return dataset_.ValueId(row_, column);
+  }
+
+  ValueMemo* Memo() override
+  {
+    return &memo_;
+  }
+
+  const TypedValues* Values(const int column, std::size_t& index) override
+  {
+    index = row_;
+    return dataset_.Values(column);
+  }
+
+  const std::vector<int>& SearchColumns() const override
+  {
+    return columns_;
+  }
+
+ private:
+
+  const SearchDataset&    dataset_;
+  const std::vector<int>& columns_;
+  const SymbolTable*      symbols_;
+
+  ValueMemo memo_; // Results for values of interned columns (valid during one run of a plan)
+
+  unsigned row_ { 0 };
+};
+
+void WriteU32(std::ostream& stream, const std::uint32_t value)
+{
+  const unsigned char bytes[4] = {
+    static_cast<unsigned char>(value),       static_cast<unsigned char>(value >> 8),
+    static_cast<unsigned char>(value >> 16), static_cast<unsigned char>(value >> 24)
+  };
+
+  stream.write(reinterpret_cast<const char*>(bytes), sizeof(bytes));
+}
+
+std::uint32_t ReadU32(std::istream& stream)
+{
+  unsigned char bytes[4];
+
+  if (!stream.read(reinterpret_cast<char*>(bytes), sizeof(bytes)))
+    throw std::runtime_error("Unexpected end of the snapshot");
+
+  return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | (static_cast<std::uint32_t>(bytes[3]) << 24);
+}
+
+void WriteString(std::ostream& stream, const std::string& value)
+{
+  WriteU32(stream, static_cast<std::uint32_t>(value.length()));
+  stream.write(value.data(), value.length());
+}
+
+std::string ReadString(std::istream& stream)
+{
+  std::string value(ReadU32(stream), '\0');
+
+  if (!stream.read(&value[0], value.length()))
+    throw std::runtime_error("Unexpected end of the snapshot");
+
+  return value;
+}
+
+std::string ImageName(const std::string& name, const std::uint32_t generation)
+{
+  return name + "." + std::to_string(generation);
+}
+
+bool IsDirectory(const SharedMemory& memory) noexcept
+{
+  if (memory.Size() < sizeof(SharedDirectory))
+    return false;
+
+  const auto* header = static_cast<const SharedDirectory*>(memory.Data());
+
+  if (!std::equal(header->magic, header->magic + sizeof(header->magic), SHARED_MAGIC))
+    return false;
+
+  // The magic is written last (see NewSharedDirectory())
+  std::atomic_thread_fence(std::memory_order_acquire);
+
+  return header->version == IMAGE_VERSION;
+}
+
+/// Segment of the directory that isn't filled yet: it's being created by another publisher
+bool IsBlankDirectory(const SharedMemory& memory) noexcept
+{
+  if (memory.Size() < sizeof(SharedDirectory))
+    return false;
+
+  const auto* header = static_cast<const SharedDirectory*>(memory.Data());
+
+  return std::all_of(header->magic, header->magic + sizeof(header->magic), [](const char c) { return c == 0; });
+}
+
+/// Method of creating the segment of the directory with nothing published
+///
+/// @param[in] name    - name of the segment
+/// @param[in] replace - replace the segment with the same name
+/// @return            - nullptr if the segment exists and isn't replaced
+
+std::shared_ptr<SharedMemory> NewSharedDirectory(const std::string& name, const bool replace)
+{
+  auto directory = SharedMemory::Create(name, sizeof(SharedDirectory), replace);
+
+  if (!directory)
+    return nullptr;
+
+  auto* header = new (directory->Data()) SharedDirectory;
+
+  header->version = IMAGE_VERSION;
+  header->reserved.store(0, std::memory_order_relaxed);
+  header->generation.store(0, std::memory_order_relaxed);
+
+  // Other publishers use the directory as soon as they see the magic
+  std::atomic_thread_fence(std::memory_order_release);
+  std::memcpy(header->magic, SHARED_MAGIC, sizeof(SHARED_MAGIC));
+
+  return directory;
+}
+
+/// Generation stored in the segment of the published dataset (0 - nothing is published)
+std::uint32_t DirectoryGeneration(const SharedMemory& directory) noexcept
+{
+  if (!IsDirectory(directory))
+    return 0;
+
+  return static_cast<const SharedDirectory*>(directory.Data())->generation.load(std::memory_order_acquire);
+}
+
+/// Section of the image as an array
+/// @throw std::runtime_error - the section is out of the image
+
+template <typename T>
+ArrayView<T> ImageSection(const char* image, const ImageHeader& header, const std::uint64_t offset, const std::uint64_t count)
+{
+  if (offset % alignof(T) != 0 || offset > header.size || count > (header.size - offset) / sizeof(T))
+    throw std::runtime_error("Invalid image of the shared dataset");
+
+  return ArrayView<T>(reinterpret_cast<const T*>(image + offset), static_cast<std::size_t>(count));
+}
+
+/// Integer key of the row relevance: ascending order of keys is descending relevance
+inline std::uint64_t RankKey(const Matches& matches) noexcept
+{
+  return ~((static_cast<std::uint64_t>(matches.wordsMatches) << 32) | matches.totalMatches);
+}
+
+} // namespace
+
+void SearchDataset::Clear() noexcept
+{
+  captions_.clear();
+  columns_.clear();
+
+  symbols_.reset();
+  decoded_.clear();
+
+  mainColumn_ = 0;
+
+  parents_.clear();
+  levels_.clear();
+  subtreeEnds_.clear();
+  roots_.clear();
+
+  summaries_.Clear();
+
+  types_.clear();
+  values_.clear();
+
+  columnViews_.clear();
+  parentsView_     = ArrayView<std::int32_t>();
+  levelsView_      = ArrayView<std::uint32_t>();
+  subtreeEndsView_ = ArrayView<std::uint32_t>();
+  rootsView_       = ArrayView<std::uint32_t>();
+
+  image_.reset();
+  directory_.reset();
+  generation_ = 0;
+}
+
+void SearchDataset::SetColumns(std::vector<std::string> captions, const int mainColumn)
+{
+  Clear();
+
+  if (captions.empty())
+    captions.emplace_back();
+
+  captions_   = std::move(captions);
+  mainColumn_ = (mainColumn >= 0 && mainColumn < static_cast<int>(captions_.size())) ? mainColumn : 0;
+
+  columns_.resize(captions_.size());
+
+  for (auto& column : columns_)
+    column.offsets.push_back(0);
+}
+
+unsigned SearchDataset::AddRow(const int parent, const std::vector<std::string>& texts)
+{
+  const unsigned row = parents_.size();
+
+  if (parent >= static_cast<int>(row))
+    throw std::invalid_argument("Rows must be added in the tree order");
+
+  // Views of the finished dataset point at its storage
+  if (!columnViews_.empty())
+    throw std::logic_error("Rows can't be added to a finished dataset");
+
+  parents_.push_back(parent);
+  levels_.push_back((parent < 0) ? 0 : levels_[parent] + 1);
+
+  for (std::size_t i = 0; i < columns_.size(); i++)
+  {
+    ColumnText& column = columns_[i];
+
+    if (i < texts.size())
+      column.pool += texts[i];
+
+    column.offsets.push_back(static_cast<std::uint32_t>(column.pool.length()));
+  }
+
+  return row;
+}
+
+void SearchDataset::Finish()
+{
+  const std::size_t rows = parents_.size();
+
+  subtreeEnds_.resize(rows);
+  roots_.clear();
+
+  for (std::size_t row = 0; row < rows; row++)
+    subtreeEnds_[row] = row + 1;
+
+  // Children follow their parents, so the end of a subtree
+  // is spread from the last rows to the first ones
+
+  for (std::size_t row = rows; row-- > 0; )
+  {
+    if (parents_[row] >= 0)
+      subtreeEnds_[parents_[row]] = std::max(subtreeEnds_[parents_[row]], subtreeEnds_[row]);
+  }
+
+  for (std::size_t row = 0; row < rows; row++)
+  {
+    if (parents_[row] < 0)
+      roots_.push_back(row);
+  }
+
+  for (auto& column : columns_)
+    Intern(column, rows);
+
+  BindViews();
+  summaries_.Build(*this);
+}
+
+void SearchDataset::BindViews()
+{
+  parentsView_     = parents_;
+  levelsView_      = levels_;
+  subtreeEndsView_ = subtreeEnds_;
+  rootsView_       = roots_;
+
+  columnViews_.resize(columns_.size());
+
+  for (std::size_t i = 0; i < columns_.size(); i++)
+  {
+    const ColumnText& column = columns_[i];
+    columnViews_[i] = ColumnView { ArrayView<char>(column.pool.data(), column.pool.length()), column.offsets, column.ids };
+  }
+}
+
+void SearchDataset::Intern(ColumnText& column, const std::size_t rows)
+{
+  // Interning pays off when every value repeats several times on average
+  constexpr std::size_t MIN_ROWS    = 64;
+  constexpr std::size_t MIN_REPEATS = 4;
+
+  if (rows < MIN_ROWS || !column.ids.empty())
+    return;
+
+  const std::size_t maxValues = rows / MIN_REPEATS;
+
+  std::unordered_map<std::string_view, std::uint32_t> values;
+  std::vector<std::uint32_t> ids(rows);
+
+  for (std::size_t row = 0; row < rows; row++)
+  {
+    const std::string_view text(column.pool.data() + column.offsets[row], column.offsets[row + 1] - column.offsets[row]);
+    const auto value = values.emplace(text, static_cast<std::uint32_t>(values.size())).first;
+
+    if (values.size() > maxValues)
+      return;
+
+    ids[row] = value->second;
+  }
+
+  ColumnText interned;
+
+  std::vector<std::string_view> texts(values.size());
+
+  for (const auto& value : values)
+    texts[value.second] = value.first;
+
+  interned.offsets.push_back(0);
+
+  for (const auto text : texts)
+  {
+    interned.pool += text;
+    interned.offsets.push_back(static_cast<std::uint32_t>(interned.pool.length()));
+  }
+
+  interned.ids = std::move(ids);
+  column = std::move(interned);
+}
+
+int SearchDataset::ValueId(const unsigned row, const int column) const noexcept
+{
+  const int index = ColumnIndex(column);
+
+  if (index < 0 || columnViews_[index].ids.empty())
+    return -1;
+
+  return static_cast<int>(columnViews_[index].ids[row]);
+}
+
+std::size_t SearchDataset::ValueCount(const int column) const noexcept
+{
+  const int index = ColumnIndex(column);
+  return (index < 0 || columnViews_[index].offsets.empty()) ? 0 : columnViews_[index].offsets.size() - 1;
+}
+
+void SearchDataset::SetColumnTypes(const std::vector<ColumnType>& types)
+{
+  types_ = types;
+
+  values_.clear();
+  values_.resize(columnViews_.size());
+
+  for (std::size_t column = 0; column < columnViews_.size() && column < types.size(); column++)
+  {
+    if (types[column] == ColumnType::TEXT)
+      continue;
+
+    TypedValues values(types[column]);
+
+    for (unsigned row = 0; row < RowCount(); row++)
+      values.Add(Text(row, static_cast<int>(column)));
+
+    values_[column] = std::move(values);
+  }
+}
+
+const std::vector<ColumnType>& SearchDataset::ColumnTypes() const noexcept
+{
+  return types_;
+}
+
+const TypedValues* SearchDataset::Values(const int column) const noexcept
+{
+  const int index = ColumnIndex(column);
+
+  if (index < 0 || index >= static_cast<int>(values_.size()) || values_[index].Type() == ColumnType::TEXT)
+    return nullptr;
+
+  return &values_[index];
+}
+
+std::size_t SearchDataset::RowCount() const noexcept
+{
+  return parentsView_.size();
+}
+
+std::size_t SearchDataset::ColumnCount() const noexcept
+{
+  return captions_.size();
+}
+
+int SearchDataset::Parent(const unsigned row) const noexcept
+{
+  return parentsView_[row];
+}
+
+unsigned SearchDataset::Level(const unsigned row) const noexcept
+{
+  return levelsView_[row];
+}
+
+unsigned SearchDataset::SubtreeEnd(const unsigned row) const noexcept
+{
+  return subtreeEndsView_[row];
+}
+
+ArrayView<std::uint32_t> SearchDataset::Roots() const noexcept
+{
+  return rootsView_;
+}
+
+int SearchDataset::ColumnIndex(const int column) const noexcept
+{
+  const int index = (column < 0) ? mainColumn_ : column;
+  return (index < static_cast<int>(columnViews_.size())) ? index : -1;
+}
+
+std::string_view SearchDataset::Codes(const unsigned row, const int column) const noexcept
+{
+  const int index = ColumnIndex(column);
+
+  if (index < 0)
+    return std::string_view();
+
+  const ColumnView&    text  = columnViews_[index];
+  const std::uint32_t value = text.ids.empty() ? row : text.ids[row];
+
+  return std::string_view(text.pool.data() + text.offsets[value], text.offsets[value + 1] - text.offsets[value]);
+}
+
+std::string_view SearchDataset::Text(const unsigned row, const int column) const
+{
+  if (!symbols_)
+    return Codes(row, column);
+
+  const int index = ColumnIndex(column);
+
+  if (index < 0)
+    return std::string_view();
+
+  std::string& text = decoded_[index];
+
+  text.clear();
+  symbols_->Decode(Codes(row, column), text);
+
+  return text;
+}
+
+void SearchDataset::Compress()
+{
+  // The text of a shared dataset is read-only
+  if (symbols_ || image_ || RowCount() == 0)
+    return;
+
+  // The table is trained on rows evenly taken over the dataset
+  constexpr std::size_t SAMPLE_BYTES = 256 * 1024;
+
+  std::size_t total = 0;
+
+  for (const auto& column : columns_)
+    total += column.pool.length();
+
+  const std::size_t rows = parents_.size();
+  const std::size_t step = std::max<std::size_t>(1, total / SAMPLE_BYTES);
+
+  std::vector<std::string_view> sample;
+
+  for (std::size_t row = 0; row < rows; row += step)
+  {
+    for (std::size_t column = 0; column < columns_.size(); column++)
+      sample.push_back(Codes(row, column));
+  }
+
+  auto symbols = std::make_shared<SymbolTable>(SymbolTable::Train(sample));
+
+  for (auto& column : columns_)
+  {
+    ColumnText compressed;
+
+    compressed.offsets.reserve(column.offsets.size());
+    compressed.offsets.push_back(0);
+
+    for (std::size_t value = 0; value + 1 < column.offsets.size(); value++)
+    {
+      const std::string_view text(column.pool.data() + column.offsets[value], column.offsets[value + 1] - column.offsets[value]);
+
+      symbols->Encode(text, compressed.pool);
+      compressed.offsets.push_back(static_cast<std::uint32_t>(compressed.pool.length()));
+    }
+
+    compressed.pool.shrink_to_fit();
+    compressed.ids = std::move(column.ids);
+
+    column = std::move(compressed);
+  }
+
+  symbols_ = std::move(symbols);
+  decoded_.assign(columns_.size(), std::string());
+
+  BindViews();
+}
+
+bool SearchDataset::Compressed() const noexcept
+{
+  return static_cast<bool>(symbols_);
+}
+
+std::shared_ptr<const SymbolTable> SearchDataset::Symbols() const noexcept
+{
+  return symbols_;
+}
+
+std::size_t SearchDataset::TextMemoryUsage() const noexcept
+{
+  std::size_t usage = 0;
+
+  for (const auto& column : columnViews_)
+    usage += column.pool.size() + (column.offsets.size() + column.ids.size()) * sizeof(std::uint32_t);
+
+  return usage;
+}
+
+std::size_t SearchDataset::IndexMemoryUsage() const noexcept
+{
+  std::size_t usage = summaries_.MemoryUsage();
+
+  for (const auto& values : values_)
+    usage += values.MemoryUsage();
+
+  return usage;
+}
+
+std::size_t SearchDataset::MemoryUsage() const noexcept
+{
+  const std::size_t tree = parentsView_.size() * sizeof(std::int32_t) +
+                           (levelsView_.size() + subtreeEndsView_.size() + rootsView_.size()) * sizeof(std::uint32_t);
+
+  return TextMemoryUsage() + tree + IndexMemoryUsage();
+}
+
+void SearchDataset::DropIndexes() noexcept
+{
+  // The types are kept, so the values aren't parsed again until the types are changed
+  summaries_.Clear();
+  std::vector<TypedValues>().swap(values_);
+}
+
+const std::vector<std::string>& SearchDataset::Captions() const noexcept
+{
+  return captions_;
+}
+
+const SubtreeSummaries& SearchDataset::Summaries() const noexcept
+{
+  return summaries_;
+}
+
+bool SearchDataset::ResolveColumn(const std::string& name, int& column) const
+{
+  std::string lowerName = name;
+  ToLower(lowerName);
+
+  for (std::size_t i = 0; i < captions_.size(); i++)
+  {
+    std::string caption = captions_[i];
+    ToLower(caption);
+
+    if (!caption.empty() && caption == lowerName)
+    {
+      column = static_cast<int>(i);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void SearchDataset::Save(std::ostream& stream) const
+{
+  stream.write(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+  WriteU32(stream, SNAPSHOT_VERSION);
+
+  WriteU32(stream, static_cast<std::uint32_t>(captions_.size()));
+
+  for (const auto& caption : captions_)
+    WriteString(stream, caption);
+
+  WriteU32(stream, static_cast<std::uint32_t>(mainColumn_));
+
+  WriteU32(stream, static_cast<std::uint32_t>(types_.size()));
+
+  for (const auto type : types_)
+    WriteU32(stream, static_cast<std::uint32_t>(type));
+
+  WriteU32(stream, static_cast<std::uint32_t>(RowCount()));
+
+  for (const auto parent : parentsView_)
+    WriteU32(stream, static_cast<std::uint32_t>(parent));
+
+  for (std::size_t row = 0; row < RowCount(); row++)
+  {
+    for (std::size_t column = 0; column < ColumnCount(); column++)
+      WriteString(stream, std::string(Text(row, column)));
+  }
+
+  if (!stream)
+    throw std::runtime_error("Can't write the snapshot");
+}
+
+void SearchDataset::Load(std::istream& stream)
+{
+  char magic[sizeof(SNAPSHOT_MAGIC)];
+
+  if (!stream.read(magic, sizeof(magic)) || !std::equal(magic, magic + sizeof(magic), SNAPSHOT_MAGIC))
+    throw std::runtime_error("The file is not a dataset snapshot");
+
+  const std::uint32_t version = ReadU32(stream);
+
+  if (version == 0 || version > SNAPSHOT_VERSION)
+    throw std::runtime_error("Unsupported version of the snapshot");
+
+  std::vector<std::string> captions(ReadU32(stream));
+
+  for (auto& caption : captions)
+    caption = ReadString(stream);
+
+  const int mainColumn = static_cast<int>(ReadU32(stream));
+
+  SetColumns(std::move(captions), mainColumn);
+
+  // Snapshots of the first version have only text columns
+  std::vector<ColumnType> types(version > 1 ? ReadU32(stream) : 0);
+
+  for (auto& type : types)
+  {
+    const std::uint32_t value = ReadU32(stream);
+
+    if (value > static_cast<std::uint32_t>(ColumnType::DATE))
+      throw std::runtime_error("Invalid type of a column in the snapshot");
+
+    type = static_cast<ColumnType>(value);
+  }
+
+  std::vector<std::int32_t> parents(ReadU32(stream));
+
+  for (auto& parent : parents)
+    parent = static_cast<std::int32_t>(ReadU32(stream));
+
+  std::vector<std::string> texts(columns_.size());
+
+  for (const auto parent : parents)
+  {
+    for (auto& text : texts)
+      text = ReadString(stream);
+
+    AddRow(parent, texts);
+  }
+
+  Finish();
+
+  // Values of the typed columns are parsed from the loaded text
+  if (!types.empty())
+    SetColumnTypes(types);
+}
+
+std::uint32_t SearchDataset::Publish(const std::string& name)
+{
+  if (columnViews_.empty())
+    throw std::logic_error("Only a finished dataset can be published");
+
+  // Segment with the generation is created by the first publication. Publishers may start at once:
+  // the segment is created only if there is none, and the one another publisher is filling is waited for.
+  // A segment of another version or one that stays blank (its publisher failed) is replaced
+
+  constexpr unsigned WAIT_ATTEMPTS = 100; // 1 ms each
+
+  std::shared_ptr<SharedMemory> directory;
+
+  for (unsigned attempt = 0; !directory; attempt++)
+  {
+    std::shared_ptr<SharedMemory> existing;
+
+    try
+    {
+      existing = SharedMemory::Open(name, true);
+    }
+    catch (const std::runtime_error&)
+    {
+    }
+
+    if (existing && IsDirectory(*existing))
+    {
+      directory = std::move(existing);
+      break;
+    }
+
+    const bool isStale = (existing && !IsBlankDirectory(*existing)) || attempt >= WAIT_ATTEMPTS;
+
+    if (!existing || isStale)
+      directory = NewSharedDirectory(name, isStale);
+
+    if (!directory)
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  auto* shared = static_cast<SharedDirectory*>(directory->Data());
+
+  const std::uint32_t generation = shared->reserved.fetch_add(1, std::memory_order_acq_rel) + 1;
+
+  // Layout of the image
+
+  ImageHeader header {};
+
+  std::memcpy(header.magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC));
+  header.version    = IMAGE_VERSION;
+  header.generation = generation;
+  header.mainColumn = mainColumn_;
+
+  std::uint64_t size = sizeof(ImageHeader);
+
+  auto place = [&size](const std::uint64_t bytes)
+  {
+    const std::uint64_t offset = (size + 7) & ~std::uint64_t(7);
+
+    size = offset + bytes;
+    return offset;
+  };
+
+  std::ostringstream captions, symbols;
+
+  for (const auto& caption : captions_)
+    WriteString(captions, caption);
+
+  if (symbols_)
+  {
+    WriteU32(symbols, static_cast<std::uint32_t>(symbols_->SymbolCount()));
+
+    for (std::size_t code = 0; code < symbols_->SymbolCount(); code++)
+      WriteString(symbols, symbols_->Symbol(static_cast<unsigned char>(code)));
+  }
+
+  const std::string captionsText = captions.str(),
+                    symbolsText  = symbols.str();
+
+  const auto index   = summaries_.Index();
+  const auto filters = summaries_.Filters();
+
+  header.rows        = static_cast<std::uint32_t>(RowCount());
+  header.columns     = static_cast<std::uint32_t>(ColumnCount());
+  header.roots       = static_cast<std::uint32_t>(rootsView_.size());
+  header.bitsLog     = summaries_.BitsLog();
+  header.summaryRows = index.size();
+  header.filterWords = filters.size();
+
+  header.parents        = place(parentsView_.size() * sizeof(std::int32_t));
+  header.levels         = place(levelsView_.size() * sizeof(std::uint32_t));
+  header.subtreeEnds    = place(subtreeEndsView_.size() * sizeof(std::uint32_t));
+  header.rootRows       = place(rootsView_.size() * sizeof(std::uint32_t));
+  header.summaryIndex   = place(index.size() * sizeof(std::int32_t));
+  header.summaryFilters = place(filters.size() * sizeof(std::uint64_t));
+  header.columnTable    = place(columnViews_.size() * sizeof(ImageColumn));
+  header.captions       = place(captionsText.length());
+  header.captionsSize   = captionsText.length();
+  header.symbols        = place(symbolsText.length());
+  header.symbolsSize    = symbolsText.length();
+
+  std::vector<ImageColumn> columns(columnViews_.size());
+
+  for (std::size_t i = 0; i < columns.size(); i++)
+  {
+    const ColumnView& view = columnViews_[i];
+
+    columns[i].pool         = place(view.pool.size());
+    columns[i].poolSize     = view.pool.size();
+    columns[i].offsets      = place(view.offsets.size() * sizeof(std::uint32_t));
+    columns[i].offsetsCount = view.offsets.size();
+    columns[i].ids          = place(view.ids.size() * sizeof(std::uint32_t));
+    columns[i].idsCount     = view.ids.size();
+  }
+
+  header.size = size;
+
+  // The image is filled before its generation is published
+
+  auto image = SharedMemory::Create(ImageName(name, generation), static_cast<std::size_t>(size));
+  char* base = static_cast<char*>(image->Data());
+
+  auto copy = [base](const std::uint64_t offset, const void* data, const std::size_t bytes)
+  {
+    if (bytes > 0)
+      std::memcpy(base + offset, data, bytes);
+  };
+
+  copy(0, &header, sizeof(header));
+  copy(header.parents, parentsView_.data(), parentsView_.size() * sizeof(std::int32_t));
+  copy(header.levels, levelsView_.data(), levelsView_.size() * sizeof(std::uint32_t));
+  copy(header.subtreeEnds, subtreeEndsView_.data(), subtreeEndsView_.size() * sizeof(std::uint32_t));
+  copy(header.rootRows, rootsView_.data(), rootsView_.size() * sizeof(std::uint32_t));
+  copy(header.summaryIndex, index.data(), index.size() * sizeof(std::int32_t));
+  copy(header.summaryFilters, filters.data(), filters.size() * sizeof(std::uint64_t));
+  copy(header.columnTable, columns.data(), columns.size() * sizeof(ImageColumn));
+  copy(header.captions, captionsText.data(), captionsText.length());
+  copy(header.symbols, symbolsText.data(), symbolsText.length());
+
+  for (std::size_t i = 0; i < columns.size(); i++)
+  {
+    const ColumnView& view = columnViews_[i];
+
+    copy(columns[i].pool, view.pool.data(), view.pool.size());
+    copy(columns[i].offsets, view.offsets.data(), view.offsets.size() * sizeof(std::uint32_t));
+    copy(columns[i].ids, view.ids.data(), view.ids.size() * sizeof(std::uint32_t));
+  }
+
+  // The image replaces the published one unless a newer one is already published:
+  // then it's used only by this dataset
+
+  std::uint32_t previous = shared->generation.load(std::memory_order_acquire);
+
+  while (previous < generation &&
+         !shared->generation.compare_exchange_weak(previous, generation, std::memory_order_acq_rel))
+  {
+  }
+
+  // Processes attached to the replaced image keep it until they detach
+  if (previous != 0)
+    SharedMemory::Remove(ImageName(name, std::min(previous, generation)));
+
+  // The dataset switches to the shared copy and frees its own one
+  BindImage(std::move(image), generation);
+
+  directory_ = std::move(directory);
+
+  return generation;
+}
+
+std::uint32_t SearchDataset::Attach(const std::string& name)
+{
+  // A new generation may replace the image between reading its number and opening it
+  constexpr int MAX_ATTEMPTS = 3;
+
+  for (int attempt = 1; ; attempt++)
+  {
+    auto directory = SharedMemory::Open(name, false);
+    const std::uint32_t generation = DirectoryGeneration(*directory);
+
+    if (generation == 0)
+      throw std::runtime_error("Nothing is published as \"" + name + "\" by this version");
+
+    std::shared_ptr<SharedMemory> image;
+
+    try
+    {
+      image = SharedMemory::Open(ImageName(name, generation), false);
+    }
+    catch (const std::runtime_error&)
+    {
+      if (attempt < MAX_ATTEMPTS)
+        continue;
+
+      throw;
+    }
+
+    BindImage(std::move(image), generation);
+    directory_ = std::move(directory);
+
+    return generation;
+  }
+}
+
+void SearchDataset::BindImage(std::shared_ptr<SharedMemory> image, const std::uint32_t generation)
+{
+  const char*       base = static_cast<const char*>(image->Data());
+  const std::size_t size = image->Size();
+
+  ImageHeader header;
+
+  if (size < sizeof(header))
+    throw std::runtime_error("Invalid image of the shared dataset");
+
+  std::memcpy(&header, base, sizeof(header));
+
+  if (!std::equal(header.magic, header.magic + sizeof(header.magic), IMAGE_MAGIC) || header.version != IMAGE_VERSION)
+    throw std::runtime_error("Unsupported version of the shared dataset");
+
+  if (header.generation != generation || header.size > size || header.columns == 0)
+    throw std::runtime_error("Invalid image of the shared dataset");
+
+  const auto captions = ImageSection<char>(base, header, header.captions, header.captionsSize);
+  const auto symbols  = ImageSection<char>(base, header, header.symbols, header.symbolsSize);
+
+  std::istringstream captionsStream(std::string(captions.data(), captions.size()));
+  std::vector<std::string> captionTexts(header.columns);
+
+  for (auto& caption : captionTexts)
+    caption = ReadString(captionsStream);
+
+  std::shared_ptr<const SymbolTable> table;
+
+  if (!symbols.empty())
+  {
+    std::istringstream symbolsStream(std::string(symbols.data(), symbols.size()));
+    std::vector<std::string> symbolTexts(ReadU32(symbolsStream));
+
+    for (auto& symbol : symbolTexts)
+      symbol = ReadString(symbolsStream);
+
+    table = std::make_shared<SymbolTable>(SymbolTable::FromSymbols(std::move(symbolTexts)));
+  }
+
+  const auto columns = ImageSection<ImageColumn>(base, header, header.columnTable, header.columns);
+
+  std::vector<ColumnView> views(header.columns);
+
+  for (std::size_t i = 0; i < views.size(); i++)
+  {
+    const ImageColumn& column = columns[i];
+
+    views[i].pool    = ImageSection<char>(base, header, column.pool, column.poolSize);
+    views[i].offsets = ImageSection<std::uint32_t>(base, header, column.offsets, column.offsetsCount);
+    views[i].ids     = ImageSection<std::uint32_t>(base, header, column.ids, column.idsCount);
+
+    const std::size_t values = views[i].ids.empty() ? header.rows : views[i].offsets.size() - 1;
+
+    if (views[i].offsets.empty() || views[i].offsets.size() != values + 1 ||
+        (!views[i].ids.empty() && views[i].ids.size() != header.rows) || views[i].offsets[values] > views[i].pool.size())
+      throw std::runtime_error("Invalid image of the shared dataset");
+  }
+
+  const auto parents     = ImageSection<std::int32_t>(base, header, header.parents, header.rows);
+  const auto levels      = ImageSection<std::uint32_t>(base, header, header.levels, header.rows);
+  const auto subtreeEnds = ImageSection<std::uint32_t>(base, header, header.subtreeEnds, header.rows);
+  const auto roots       = ImageSection<std::uint32_t>(base, header, header.rootRows, header.roots);
+
+  const auto summaryIndex   = ImageSection<std::int32_t>(base, header, header.summaryIndex, header.summaryRows);
+  const auto summaryFilters = ImageSection<std::uint64_t>(base, header, header.summaryFilters, header.filterWords);
+
+  if ((!summaryIndex.empty() && summaryIndex.size() != header.rows) || header.bitsLog > 32)
+    throw std::runtime_error("Invalid image of the shared dataset");
+
+  // The dataset is replaced only by a valid image
+
+  Clear();
+
+  captions_   = std::move(captionTexts);
+  mainColumn_ = header.mainColumn;
+  symbols_    = std::move(table);
+
+  if (symbols_)
+    decoded_.assign(captions_.size(), std::string());
+
+  parentsView_     = parents;
+  levelsView_      = levels;
+  subtreeEndsView_ = subtreeEnds;
+  rootsView_       = roots;
+  columnViews_     = std::move(views);
+
+  summaries_.Bind(header.bitsLog, summaryIndex, summaryFilters);
+
+  image_      = std::move(image);
+  generation_ = generation;
+}
+
+std::uint32_t SearchDataset::Generation() const noexcept
+{
+  return generation_;
+}
+
+std::uint32_t SearchDataset::PublishedGeneration(const std::string& name) noexcept
+{
+  try
+  {
+    return DirectoryGeneration(*SharedMemory::Open(name, false));
+  }
+  catch (const std::exception&)
+  {
+    return 0;
+  }
+}
+
+std::vector<unsigned> RelevanceOrder(const std::vector<Matches>& matches)
+{
+  const std::size_t count = matches.size();
+
+  std::vector<std::uint64_t> keys(count), sortedKeys(count);
+  std::vector<unsigned>      order(count), sortedOrder(count);
+
+  for (std::size_t i = 0; i < count; i++)
+  {
+    keys[i]  = RankKey(matches[i]);
+    order[i] = static_cast<unsigned>(i);
+  }
+
+  // LSD radix sort by bytes of the keys. Every pass is stable, so rows
+  // with equal keys keep their positions. Passes where all keys have the same byte are skipped
+
+  for (unsigned shift = 0; shift < 64; shift += 8)
+  {
+    std::size_t counts[257] = {};
+
+    for (const auto key : keys)
+      counts[((key >> shift) & 0xFF) + 1]++;
+
+    if (std::any_of(counts + 1, counts + 257, [count](const std::size_t n) { return n == count; }))
+      continue;
+
+    for (unsigned i = 1; i < 257; i++)
+      counts[i] += counts[i - 1];
+
+    for (std::size_t i = 0; i < count; i++)
+    {
+      const std::size_t pos = counts[(keys[i] >> shift) & 0xFF]++;
+
+      sortedKeys[pos]  = keys[i];
+      sortedOrder[pos] = order[i];
+    }
+
+    keys.swap(sortedKeys);
+    order.swap(sortedOrder);
+  }
+
+  return order;
+}
+
+EvaluationMode EvaluationFor(const unsigned options) noexcept
+{
+  if (options & OptionBit(SearchOption::RELEVANT_SORT))
+    return EvaluationMode::COUNT;
+
+  return (options & OptionBit(SearchOption::AUTO_EXPAND_NODES)) ? EvaluationMode::ROWS : EvaluationMode::ROOTS;
+}
+
+void SearchResult::Reset(const std::size_t rowCount, const std::size_t rootCount, const EvaluationMode a_mode)
+{
+  const bool countMatches = (a_mode == EvaluationMode::COUNT);
+
+  mode = a_mode;
+
+  rows.Clear();
+  rowMatches.assign(countMatches ? rowCount : 0, Matches());
+
+  roots.Clear();
+  rootMatches.assign(countMatches ? rootCount : 0, Matches());
+}
+
+unsigned SearchResult::MatchedRows() const noexcept
+{
+  return static_cast<unsigned>(rows.Cardinality());
+}
+
+unsigned SearchResult::VisibleRoots() const noexcept
+{
+  return static_cast<unsigned>(roots.Cardinality());
+}
+
+std::size_t SearchResult::MemoryUsage() const noexcept
+{
+  return rows.MemoryUsage() + roots.MemoryUsage() +
+         (rowMatches.capacity() + rootMatches.capacity()) * sizeof(Matches);
+}
+
+ResultCache::ResultCache(const std::size_t maxResults)
+    : maxResults_(maxResults)
+{}
+
+void ResultCache::Clear() noexcept
+{
+  results_.clear();
+}
+
+const SearchResult* ResultCache::Find(const std::string& request, const std::string& context)
+{
+  auto it = std::find_if(results_.begin(), results_.end(), [&request, &context](const CachedResult& cached)
+  {
+    return cached.request == request && cached.context == context;
+  });
+
+  if (it == results_.end())
+    return nullptr;
+
+  results_.splice(results_.begin(), results_, it);
+  return &results_.front().result;
+}
+
+const SearchResult* ResultCache::FindRefined(const QueryPlan& plan, const std::string& context) const
+{
+  const SearchResult* refined = nullptr;
+
+  for (const auto& cached : results_)
+  {
+    if (cached.context != context || !plan.Refines(cached.plan))
+      continue;
+
+    if (!refined || cached.result.VisibleRoots() < refined->VisibleRoots())
+      refined = &cached.result;
+  }
+
+  return refined;
+}
+
+void ResultCache::Add(const std::string& request, const std::string& context, const QueryPlan& plan, const SearchResult& result)
+{
+  if (maxResults_ == 0)
+    return;
+
+  if (Find(request, context))
+  {
+    results_.front().plan   = plan;
+    results_.front().result = result;
+    return;
+  }
+
+  if (results_.size() >= maxResults_)
+    results_.pop_back();
+
+  results_.push_front(CachedResult { request, context, plan, result });
+}
+
+std::size_t ResultCache::MemoryUsage() const noexcept
+{
+  std::size_t usage = 0;
+
+  for (const auto& cached : results_)
+    usage += sizeof(cached) + cached.request.capacity() + cached.context.capacity() + cached.result.MemoryUsage();
+
+  return usage;
+}
+
+void ColumnParts::Clear() noexcept
+{
+  clauses.clear();
+  countMatches = false;
+  rows.Clear();
+  parts.clear();
+  narrowed.clear();
+}
+
+std::size_t ColumnParts::MemoryUsage() const noexcept
+{
+  std::size_t usage = rows.MemoryUsage() + parts.capacity() * sizeof(ColumnPart);
+
+  for (const auto& part : parts)
+  {
+    usage += part.countedRows.MemoryUsage() + part.matches.capacity() * sizeof(Matches);
+
+    for (const auto& clauseRows : part.clauseRows)
+      usage += clauseRows.MemoryUsage();
+  }
+
+  usage += narrowed.capacity() * sizeof(NarrowedColumn);
+
+  for (const auto& column : narrowed)
+    usage += column.rows.MemoryUsage();
+
+  return usage;
+}
+
+SearchCore::SearchCore(const SearchDataset& dataset)
+    : dataset_(dataset)
+{}
+
+void SearchCore::Optimize(QueryPlan& plan, const std::vector<int>& columns) const
+{
+  // Selectivity of the terms is measured on a sample of rows evenly taken
+  // over the dataset. It's not worth it for small datasets: heuristics is enough there
+
+  constexpr std::size_t SAMPLE_SIZE = 64;
+
+  const std::size_t rows = dataset_.RowCount();
+
+  // Terms are matched over the compressed text without decompressing it
+  plan.SetSymbols(dataset_.Symbols());
+
+  if (rows < SAMPLE_SIZE * 16 || plan.Clauses().size() < 2)
+  {
+    plan.Optimize(QueryPlan::EstimateSelectivity, columns.size());
+    return;
+  }
+
+  const std::size_t step = rows / SAMPLE_SIZE;
+
+  plan.Optimize([&](const QueryTerm& term)
+  {
+    DatasetRow view(dataset_, columns);
+
+    unsigned hits    = 0,
+             samples = 0;
+
+    for (std::size_t row = 0; row < rows; row += step, samples++)
+    {
+      view.SetRow(row);
+
+      if (QueryPlan::Contains(term, view))
+        hits++;
+    }
+
+    return (hits + 1.0) / (samples + 2.0);
+  }, columns.size());
+}
+
+namespace {
+
+/// Method of selecting the rows that pass the filter clauses (MUST/MUST_NOT) made of conditions
+/// on typed columns. A condition is checked over the whole array of the column in one pass
+///
+/// @param[in] dataset - dataset
+/// @param[in] plan    - query plan
+/// @return            - every row: whether it passes the clauses (empty - there are no such clauses)
+
+std::vector<std::uint8_t> SelectByValues(const SearchDataset& dataset, const QueryPlan& plan)
+{
+  std::vector<std::uint8_t> selected;
+  std::vector<std::uint8_t> clauseRows;
+
+  for (const auto& clause : plan.Clauses())
+  {
+    if (clause.occur == TermOccur::SHOULD)
+      continue;
+
+    const bool isValues = std::all_of(clause.terms.begin(), clause.terms.end(), [&dataset](const QueryTerm& term)
+    {
+      const TypedValues* values = term.condition ? dataset.Values(term.column) : nullptr;
+      return values && values->Type() == term.condition->Type();
+    });
+
+    if (!isValues)
+      continue;
+
+    // Alternatives of the clause: rows that satisfy any of them
+    clauseRows.assign(dataset.RowCount(), 0);
+
+    for (const auto& term : clause.terms)
+      term.condition->Select(*dataset.Values(term.column), clauseRows.data());
+
+    if (selected.empty())
+      selected.assign(dataset.RowCount(), 1);
+
+    const std::uint8_t isExcluded = (clause.occur == TermOccur::MUST_NOT);
+
+    for (std::size_t row = 0; row < selected.size(); row++)
+      selected[row] &= (clauseRows[row] ^ isExcluded);
+  }
+
+  return selected;
+}
+
+/// Method of selecting the rows the plan has to be evaluated on: the rows of the subtrees
+/// that may contain the request and that pass the conditions on values (as in SearchCore::Run())
+///
+/// @param[in] dataset - dataset
+/// @param[in] plan    - query plan
+/// @return            - rows
+
+RowBitmap EvaluatedRows(const SearchDataset& dataset, const QueryPlan& plan)
+{
+  const SubtreeSummaries& summaries = dataset.Summaries();
+  const SummaryProbe      probe(plan, summaries);
+
+  const std::vector<std::uint8_t> selected = SelectByValues(dataset, plan);
+
+  const unsigned rowCount = static_cast<unsigned>(dataset.RowCount());
+
+  RowBitmap rows;
+
+  for (unsigned row = 0; row < rowCount; row++)
+  {
+    while (!probe.Empty() && row < rowCount && !summaries.MayMatch(row, probe))
+      row = dataset.SubtreeEnd(row);
+
+    if (row >= rowCount)
+      break;
+
+    if (selected.empty() || selected[row])
+      rows.Add(row);
+  }
+
+  return rows;
+}
+
+/// Method of matching the clauses of the plan with the clauses the parts are evaluated for
+/// (the optimizer may order the same clauses differently)
+///
+/// @param[in]  clauses - clauses of the plan
+/// @param[in]  parts   - clauses of the parts
+/// @param[out] order   - every clause of the plan: index of the same clause in the parts
+/// @return             - false if the clauses aren't the same
+
+bool MatchClauses(const std::vector<QueryClause>& clauses, const std::vector<QueryClause>& parts, std::vector<std::size_t>& order)
+{
+  if (clauses.size() != parts.size())
+    return false;
+
+  std::vector<char> used(parts.size(), 0);
+
+  order.assign(clauses.size(), 0);
+
+  for (std::size_t i = 0; i < clauses.size(); i++)
+  {
+    std::size_t j = 0;
+
+    while (j < parts.size() && (used[j] || parts[j].occur != clauses[i].occur || parts[j].terms != clauses[i].terms))
+      j++;
+
+    if (j == parts.size())
+      return false;
+
+    used[j]  = 1;
+    order[i] = j;
+  }
+
+  return true;
+}
+
+} // namespace
+
+void SearchCore::Run(const QueryPlan& plan, const std::vector<int>& columns, SearchResult& result,
+                     const EvaluationMode mode, const SearchResult* const candidates) const
+{
+  const auto& roots = dataset_.Roots();
+
+  const bool countMatches = (mode == EvaluationMode::COUNT);
+
+  result.Reset(dataset_.RowCount(), roots.size(), mode);
+
+  // Rows of the refined request: the first matched row of a subtree isn't enough
+  const RowBitmap* candidateRows = (candidates && candidates->mode != EvaluationMode::ROOTS) ? &candidates->rows : nullptr;
+
+  DatasetRow view(dataset_, columns);
+
+  const SubtreeSummaries& summaries = dataset_.Summaries();
+  const SummaryProbe      probe(plan, summaries);
+
+  const std::vector<std::uint8_t> selected = SelectByValues(dataset_, plan);
+
+  for (std::size_t i = 0; i < roots.size(); i++)
+  {
+    // Subtrees hidden by the refined request stay hidden
+    if (candidates && !candidates->roots.Contains(static_cast<std::uint32_t>(i)))
+      continue;
+
+    bool rootMatched = false;
+
+    for (unsigned row = roots[i]; row < dataset_.SubtreeEnd(roots[i]); row++)
+    {
+      // Rows of a pruned subtree stay unmatched
+      while (!probe.Empty() && row < dataset_.SubtreeEnd(roots[i]) && !summaries.MayMatch(row, probe))
+        row = dataset_.SubtreeEnd(row);
+
+      if (row >= dataset_.SubtreeEnd(roots[i]))
+        break;
+
+      // Rows that fail the conditions on values or the refined request
+      if ((!selected.empty() && !selected[row]) || (candidateRows && !candidateRows->Contains(row)))
+        continue;
+
+      view.SetRow(row);
+
+      if (!countMatches)
+      {
+        const bool isMatched = plan.Satisfies(view);
+
+        if (isMatched)
+          result.rows.Add(row);
+
+        rootMatched |= isMatched;
+
+        // Visibility of the top-level row is decided by its first matched row
+        if (isMatched && mode == EvaluationMode::ROOTS)
+          break;
+
+        continue;
+      }
+
+      Matches& m = result.rowMatches[row];
+      const bool isMatched = plan.Evaluate(view, m);
+
+      if (isMatched)
+        result.rows.Add(row);
+
+      rootMatched |= isMatched;
+
+      // Matches of the subtree: the sum of all matches
+      // and the max. amount of the matched words in a row
+
+      Matches& rootMatches = result.rootMatches[i];
+
+      rootMatches.totalMatches += m.totalMatches;
+
+      if (m.wordsMatches > rootMatches.wordsMatches)
+        rootMatches.wordsMatches = m.wordsMatches;
+    }
+
+    if (rootMatched)
+      result.roots.Add(static_cast<std::uint32_t>(i));
+  }
+}
+
+struct SearchCursor::State
+{
+  State(const SearchDataset& a_dataset, QueryPlan&& a_plan, std::vector<int>&& a_columns)
+      : dataset(a_dataset)
+      , plan(std::move(a_plan))
+      , columns(std::move(a_columns))
+      , view(dataset, columns)
+      , probe(plan, dataset.Summaries())
+  {}
+
+  const SearchDataset& dataset;
+
+  QueryPlan        plan;
+  std::vector<int> columns;
+  DatasetRow       view;
+  SummaryProbe     probe;
+
+  unsigned row { 0 }; // Next row to evaluate
+};
+
+SearchCursor SearchCore::Find(QueryPlan plan, std::vector<int> columns) const
+{
+  return SearchCursor(std::make_unique<SearchCursor::State>(dataset_, std::move(plan), std::move(columns)));
+}
+
+void SearchCore::RunByColumns(const QueryPlan& plan, const std::vector<int>& columns, ColumnParts& parts,
+                              SearchResult& result, const EvaluationMode mode) const
+{
+  const auto& roots   = dataset_.Roots();
+  const auto& clauses = plan.Clauses();
+
+  const bool countMatches = (mode == EvaluationMode::COUNT);
+
+  result.Reset(dataset_.RowCount(), roots.size(), mode);
+
+  if (clauses.empty())
+    return;
+
+  std::vector<std::size_t> order;
+
+  // Parts of another request or parts without matches when they're needed
+  if (!MatchClauses(clauses, parts.clauses, order) || (countMatches && !parts.countMatches))
+  {
+    ColumnParts previous;
+
+    // The request refines the one of the parts (e.g. the next character is typed)
+    if (plan.TermsWithin(parts.clauses))
+      previous = std::move(parts);
+
+    parts.Clear();
+
+    parts.clauses      = clauses;
+    parts.countMatches = countMatches;
+    parts.rows         = EvaluatedRows(dataset_, plan);
+
+    MatchClauses(clauses, parts.clauses, order);
+
+    // In a column the terms can be found only where the terms of the previous request are found
+    // and in the rows the previous request wasn't evaluated on
+
+    const RowBitmap unknownRows = parts.rows - previous.rows;
+
+    for (const auto& part : previous.parts)
+    {
+      NarrowedColumn column;
+
+      column.column         = part.column;
+      column.isSearchColumn = part.isSearchColumn;
+      column.rows           = unknownRows;
+
+      for (const auto& clauseRows : part.clauseRows)
+        column.rows |= clauseRows;
+
+      column.rows &= parts.rows;
+
+      parts.narrowed.push_back(std::move(column));
+    }
+
+    // Columns the previous request has narrowed are narrowed further
+    for (auto& column : previous.narrowed)
+    {
+      const bool hasPart = std::any_of(previous.parts.begin(), previous.parts.end(), [&column](const ColumnPart& part)
+      {
+        return part.column == column.column && part.isSearchColumn == column.isSearchColumn;
+      });
+
+      if (hasPart)
+        continue;
+
+      column.rows |= unknownRows;
+      column.rows &= parts.rows;
+
+      parts.narrowed.push_back(std::move(column));
+    }
+  }
+
+  // Parts combined for the columns: the search columns and the columns
+  // of the scoped terms that aren't searched by unscoped ones
+
+  std::vector<int> scopedColumns;
+
+  for (const auto& clause : clauses)
+  {
+    for (const auto& term : clause.terms)
+    {
+      if (term.scoped && std::find(columns.begin(), columns.end(), term.column) == columns.end() &&
+          std::find(scopedColumns.begin(), scopedColumns.end(), term.column) == scopedColumns.end())
+        scopedColumns.push_back(term.column);
+    }
+  }
+
+  auto isUsed = [&columns, &scopedColumns](const ColumnPart& part)
+  {
+    const auto& partColumns = part.isSearchColumn ? columns : scopedColumns;
+    return std::find(partColumns.begin(), partColumns.end(), part.column) != partColumns.end();
+  };
+
+  // Only the columns without parts are evaluated
+
+  auto addPart = [this, &plan, &order, &parts](const int column, const bool isSearchColumn)
+  {
+    const bool exists = std::any_of(parts.parts.begin(), parts.parts.end(), [column, isSearchColumn](const ColumnPart& part)
+    {
+      return part.column == column && part.isSearchColumn == isSearchColumn;
+    });
+
+    if (exists)
+      return;
+
+    ColumnPart part;
+
+    part.column         = column;
+    part.isSearchColumn = isSearchColumn;
+
+    const auto narrowed = std::find_if(parts.narrowed.begin(), parts.narrowed.end(), [column, isSearchColumn](const NarrowedColumn& other)
+    {
+      return other.column == column && other.isSearchColumn == isSearchColumn;
+    });
+
+    if (narrowed != parts.narrowed.end())
+    {
+      RunColumn(plan, order, parts, narrowed->rows, part);
+      parts.narrowed.erase(narrowed);
+    }
+    else
+    {
+      RunColumn(plan, order, parts, parts.rows, part);
+    }
+
+    parts.parts.push_back(std::move(part));
+  };
+
+  for (const auto column : columns)
+    addPart(column, true);
+
+  for (const auto column : scopedColumns)
+    addPart(column, false);
+
+  std::vector<const ColumnPart*> used;
+
+  for (const auto& part : parts.parts)
+  {
+    if (isUsed(part))
+      used.push_back(&part);
+  }
+
+  // A clause is found in a row if it's found in one of the columns
+
+  RowBitmap satisfied, should, excluded;
+  bool      hasMust = false, hasShould = false;
+
+  for (std::size_t i = 0; i < clauses.size(); i++)
+  {
+    RowBitmap hits;
+
+    for (const auto part : used)
+      hits |= part->clauseRows[order[i]];
+
+    switch (clauses[i].occur)
+    {
+      case TermOccur::MUST:
+        satisfied = hasMust ? (satisfied & hits) : std::move(hits);
+        hasMust   = true;
+        break;
+
+      case TermOccur::SHOULD:
+        should   |= hits;
+        hasShould = true;
+        break;
+
+      case TermOccur::MUST_NOT:
+        excluded |= hits;
+        break;
+    }
+  }
+
+  // Without MUST clauses a row must contain at least one of SHOULD clauses
+  if (!hasMust)
+    satisfied = hasShould ? std::move(should) : parts.rows;
+
+  satisfied -= excluded;
+
+  // Matches of a row: the sum of the matches in the columns
+
+  if (countMatches)
+  {
+    for (const auto part : used)
+    {
+      std::size_t i = 0;
+
+      part->countedRows.ForEach([&result, part, &i](const std::uint32_t row)
+      {
+        result.rowMatches[row] += part->matches[i++];
+      });
+
+      // Rows that don't satisfy the request have no matches
+      (part->countedRows - satisfied).ForEach([&result](const std::uint32_t row)
+      {
+        result.rowMatches[row] = Matches();
+      });
+    }
+  }
+
+  std::size_t root     = 0;
+  std::size_t lastRoot = roots.size();
+
+  satisfied.ForEach([&](const std::uint32_t row)
+  {
+    while (dataset_.SubtreeEnd(roots[root]) <= row)
+      root++;
+
+    const bool isFirst = (root != lastRoot);
+
+    lastRoot = root;
+
+    // Visibility of the top-level row is decided by its first matched row
+    if (isFirst || mode != EvaluationMode::ROOTS)
+      result.rows.Add(row);
+
+    if (isFirst)
+      result.roots.Add(static_cast<std::uint32_t>(root));
+
+    if (!countMatches)
+      return;
+
+    // Matches of the subtree: the sum of all matches
+    // and the max. amount of the matched words in a row
+
+    const Matches& m           = result.rowMatches[row];
+    Matches&       rootMatches = result.rootMatches[root];
+
+    rootMatches.totalMatches += m.totalMatches;
+
+    if (m.wordsMatches > rootMatches.wordsMatches)
+      rootMatches.wordsMatches = m.wordsMatches;
+  });
+}
+
+void SearchCore::RunColumn(const QueryPlan& plan, const std::vector<std::size_t>& order, const ColumnParts& parts,
+                           const RowBitmap& rows, ColumnPart& part) const
+{
+  const std::vector<int> columns { part.column };
+
+  DatasetRow view(dataset_, columns);
+
+  part.clauseRows.assign(parts.clauses.size(), RowBitmap());
+
+  std::vector<char> clauses;
+  Matches           matches;
+
+  rows.ForEach([&](const std::uint32_t row)
+  {
+    view.SetRow(row);
+
+    plan.EvaluateColumn(view, part.column, part.isSearchColumn, clauses, parts.countMatches ? &matches : nullptr);
+
+    for (std::size_t i = 0; i < clauses.size(); i++)
+    {
+      if (clauses[i])
+        part.clauseRows[order[i]].Add(row);
+    }
+
+    if (parts.countMatches && (matches.totalMatches > 0 || matches.wordsMatches > 0))
+    {
+      part.countedRows.Add(row);
+      part.matches.push_back(matches);
+    }
+  });
+}
+
+SearchCursor::SearchCursor() noexcept = default;
+
+SearchCursor::SearchCursor(std::unique_ptr<State> state) noexcept
+    : state_(std::move(state))
+{}
+
+SearchCursor::SearchCursor(SearchCursor&& other) noexcept = default;
+
+SearchCursor& SearchCursor::operator=(SearchCursor&& other) noexcept = default;
+
+SearchCursor::~SearchCursor() = default;
+
+bool SearchCursor::Next(SearchMatch& match)
+{
+  return Advance(&match);
+}
+
+bool SearchCursor::Advance(SearchMatch* const match)
+{
+  if (!state_)
+    return false;
+
+  State& state = *state_;
+
+  const std::size_t       rows      = state.dataset.RowCount();
+  const SubtreeSummaries& summaries = state.dataset.Summaries();
+
+  while (state.row < rows)
+  {
+    // Rows of a pruned subtree can't match
+    if (!state.probe.Empty() && !summaries.MayMatch(state.row, state.probe))
+    {
+      state.row = state.dataset.SubtreeEnd(state.row);
+      continue;
+    }
+
+    const unsigned row = state.row++;
+
+    state.view.SetRow(row);
+
+    if (!match)
+    {
+      if (state.plan.Satisfies(state.view))
+        return true;
+
+      continue;
+    }
+
+    Matches matches;
+
+    if (state.plan.Evaluate(state.view, matches))
+    {
+      match->row     = row;
+      match->matches = matches;
+
+      return true;
+    }
+  }
+
+  state_.reset();
+
+  return false;
+}
+
+std::vector<SearchMatch> SearchCursor::Take(const std::size_t count)
+{
+  std::vector<SearchMatch> matches;
+  SearchMatch match;
+
+  while (matches.size() < count && Next(match))
+    matches.push_back(match);
+
+  return matches;
+}
+
+std::size_t SearchCursor::Count()
+{
+  std::size_t count = 0;
+
+  while (Advance(nullptr))
+    count++;
+
+  return count;
+}
+
+SearchCursor::Iterator SearchCursor::begin()
+{
+  return Iterator(this);
+}
+
+SearchCursor::Iterator SearchCursor::end() noexcept
+{
+  return Iterator();
+}
+
+SearchCursor::Iterator::Iterator(SearchCursor* cursor)
+    : cursor_(cursor)
+{
+  ++*this;
+}
+
+SearchCursor::Iterator::reference SearchCursor::Iterator::operator*() const noexcept
+{
+  return cursor_->current_;
+}
+
+SearchCursor::Iterator::pointer SearchCursor::Iterator::operator->() const noexcept
+{
+  return &cursor_->current_;
+}
+
+SearchCursor::Iterator& SearchCursor::Iterator::operator++()
+{
+  if (cursor_ && !cursor_->Next(cursor_->current_))
+    cursor_ = nullptr;
+
+  return *this;
+}
+
+bool SearchCursor::Iterator::operator==(const Iterator& other) const noexcept
+{
+  return cursor_ == other.cursor_;
+}
+
+bool SearchCursor::Iterator::operator!=(const Iterator& other) const noexcept
+{
+  return !(*this == other);
+}
+
+} // namespace searcher
@@ -0,0 +1,544 @@
+﻿#ifndef SearchCoreH
+#define SearchCoreH
+
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "src/SearchQuery.h"
+#include "src/SearchBitmap.h"
+#include "src/SearchSummary.h"
+#include "src/SearchCompression.h"
+#include "src/SearchShared.h"
+#include "src/SearchValues.h"
+
+namespace searcher
+{
+  // Search options
+  enum class SearchOption
+  {
+    AUTO_EXPAND_NODES,  		         // Automatic expanding nodes where matches are found
+    RELEVANT_SORT,     		           // Apply to the entire list sort by relevance
+    START_SEARCH_AFTER_BUTTON_CLICK, // Start the search after pressing the corresponding button
+    REGEX_SEARCH,                    // The search request is a regular expression
+    LAYOUT_VARIANTS,                 // Also search the words as if they were typed in the other keyboard layout (EN <-> RU)
+    COMPRESSED_CACHE                 // Keep the cached text of the tree compressed (less memory, the search is a bit slower)
+  };
+
+  /// Bit of the option in a mask of options (used in traces)
+  constexpr unsigned OptionBit(const SearchOption option) noexcept
+  {
+    return 1u << static_cast<unsigned>(option);
+  }
+
+  // Searchable text of a tree: text of every column of every node (in lower case).
+  // Rows are stored in the tree order (pre-order), so a subtree is a range of rows.
+  // A finished dataset is read-only, so it can be published to shared memory and used
+  // by other processes that show the same tree (see Publish() and Attach())
+
+  class SearchDataset
+  {
+   public:
+
+    SearchDataset() = default;
+
+    SearchDataset(const SearchDataset&) = delete;
+    SearchDataset& operator=(const SearchDataset&) = delete;
+
+    void Clear() noexcept;
+
+    /// Method of setting columns of the dataset (must be called before adding rows)
+    ///
+    /// @param[in] captions   - captions of the columns
+    /// @param[in] mainColumn - column that is searched when no search columns are specified (-1)
+
+    void SetColumns(std::vector<std::string> captions, const int mainColumn);
+
+    /// Method of adding a row
+    ///
+    /// @param[in] parent - index of the parent row (-1 for top-level rows)
+    /// @param[in] texts  - text of every column in lower case
+    /// @return           - index of the row
+
+    unsigned AddRow(const int parent, const std::vector<std::string>& texts);
+
+    /// Method of completing the dataset after all rows are added (rows can't be added after that).
+    /// Columns with few distinct values are interned: every value is stored once
+    /// and the query is evaluated once per distinct value (see IRowText::ValueId())
+
+    void Finish();
+
+    std::size_t RowCount() const noexcept;
+    std::size_t ColumnCount() const noexcept;
+
+    int      Parent(const unsigned row) const noexcept;
+    unsigned Level(const unsigned row) const noexcept;
+
+    /// Index of the row that follows the last row of the subtree
+    unsigned SubtreeEnd(const unsigned row) const noexcept;
+
+    /// Top-level rows
+    ArrayView<std::uint32_t> Roots() const noexcept;
+
+    /// Text of the row in the column (-1 - main column).
+    /// A compressed text is decompressed into a buffer of the column,
+    /// so the result is valid until the next call for the same column
+
+    std::string_view Text(const unsigned row, const int column) const;
+
+    /// Method of compressing the text of all columns with a symbol table trained on the dataset.
+    /// Rows can't be added after that (until the dataset is cleared)
+    void Compress();
+
+    bool Compressed() const noexcept;
+
+    /// Table the text is compressed with (nullptr if it isn't compressed)
+    std::shared_ptr<const SymbolTable> Symbols() const noexcept;
+
+    /// Stored (compressed or not) text of the row in the column
+    std::string_view Codes(const unsigned row, const int column) const noexcept;
+
+    /// Memory used by the text of all columns (bytes)
+    std::size_t TextMemoryUsage() const noexcept;
+
+    /// Memory used by the indexes: subtree summaries and parsed values of typed columns (bytes)
+    std::size_t IndexMemoryUsage() const noexcept;
+
+    /// Memory used by the whole dataset: text, structure of the tree and indexes (bytes)
+    std::size_t MemoryUsage() const noexcept;
+
+    /// Method of freeing the indexes to save memory. The search gives the same results without them,
+    /// only slower; the indexes are built again with the dataset (or when the column types are changed)
+    void DropIndexes() noexcept;
+
+    /// Index of the row value among distinct values of the column
+    /// (-1 if the column values aren't interned, see Finish())
+    int ValueId(const unsigned row, const int column) const noexcept;
+
+    /// Amount of stored values of the column (distinct ones if the column is interned)
+    std::size_t ValueCount(const int column) const noexcept;
+
+    /// Method of setting types of the columns (after Finish() or Attach()): the text of every typed
+    /// column is parsed into the native array of its type (see TypedValues). The values are kept
+    /// in the memory of the process even if the dataset is shared
+    ///
+    /// @param[in] types - every column: its type (missing columns are text)
+
+    void SetColumnTypes(const std::vector<ColumnType>& types);
+
+    const std::vector<ColumnType>& ColumnTypes() const noexcept;
+
+    /// Parsed values of the typed column (nullptr - the column is text)
+    const TypedValues* Values(const int column) const noexcept;
+
+    const std::vector<std::string>& Captions() const noexcept;
+
+    /// Trigram summaries of the subtrees (built by Finish())
+    const SubtreeSummaries& Summaries() const noexcept;
+
+    /// Method of getting the column index by its caption (case insensitive)
+    bool ResolveColumn(const std::string& name, int& column) const;
+
+    /// Methods of saving/loading the dataset (snapshot) to/from the stream,
+    /// with the types of the columns (values are parsed again on loading)
+    /// @throw std::runtime_error - invalid snapshot
+
+    void Save(std::ostream& stream) const;
+    void Load(std::istream& stream);
+
+    /// Method of publishing the finished dataset to a named shared memory segment, so other
+    /// processes attach to it instead of building their own copy. Every publication gets the next
+    /// generation number; the previous one is freed when the processes attached to it detach
+    /// (of concurrent publications the newest one stays published).
+    /// The dataset itself switches to the shared copy (its own memory is freed)
+    ///
+    /// @param[in] name - name of the segment
+    /// @return         - generation of the published dataset
+    /// @throw std::runtime_error - the segment can't be created
+
+    std::uint32_t Publish(const std::string& name);
+
+    /// Method of attaching to the current generation of the dataset published by another process (read-only)
+    ///
+    /// @param[in] name - name of the segment
+    /// @return         - generation of the dataset
+    /// @throw std::runtime_error - nothing is published or it's published by an incompatible version
+
+    std::uint32_t Attach(const std::string& name);
+
+    /// Generation of the shared dataset (0 - the dataset isn't shared)
+    std::uint32_t Generation() const noexcept;
+
+    /// Current generation of the dataset published under the name (0 - nothing is published)
+    static std::uint32_t PublishedGeneration(const std::string& name) noexcept;
+
+   private:
+
+    struct ColumnText
+    {
+      std::string                pool;    // Text of all values
+      std::vector<std::uint32_t> offsets; // Start of every value (+ the end of the last one)
+      std::vector<std::uint32_t> ids;     // Every row: index of its value (empty - every row has its own value)
+    };
+
+    // Stored text of a column in use: the text of ColumnText or a section of the shared image
+    struct ColumnView
+    {
+      ArrayView<char>          pool;
+      ArrayView<std::uint32_t> offsets;
+      ArrayView<std::uint32_t> ids;
+    };
+
+    /// Index of the stored column (-1 - main column)
+    int ColumnIndex(const int column) const noexcept;
+
+    /// Method of pointing the views at the own storage of the dataset
+    void BindViews();
+
+    /// Method of using the image of the dataset in the shared memory segment
+    /// @throw std::runtime_error - invalid image
+
+    void BindImage(std::shared_ptr<SharedMemory> image, const std::uint32_t generation);
+
+    /// Method of storing every distinct value of the column once (if there are few of them)
+    static void Intern(ColumnText& column, const std::size_t rows);
+
+   private:
+
+    std::vector<std::string> captions_;
+    std::vector<ColumnText>  columns_;
+
+    std::shared_ptr<const SymbolTable> symbols_;
+    mutable std::vector<std::string>   decoded_; // Every column: the last decompressed text
+
+    int mainColumn_ { 0 };
+
+    std::vector<std::int32_t>  parents_;
+    std::vector<std::uint32_t> levels_;
+    std::vector<std::uint32_t> subtreeEnds_;
+    std::vector<std::uint32_t> roots_;
+
+    SubtreeSummaries summaries_;
+
+    std::vector<ColumnType>  types_;
+    std::vector<TypedValues> values_; // Every column: parsed values (none for text columns)
+
+    // Data in use (after Finish()): the own storage above or the shared image
+
+    std::vector<ColumnView>  columnViews_;
+    ArrayView<std::int32_t>  parentsView_;
+    ArrayView<std::uint32_t> levelsView_;
+    ArrayView<std::uint32_t> subtreeEndsView_;
+    ArrayView<std::uint32_t> rootsView_;
+
+    std::shared_ptr<SharedMemory> directory_; // Segment with the current generation
+    std::shared_ptr<SharedMemory> image_;     // Segment with the dataset
+    std::uint32_t                 generation_ { 0 };
+  };
+
+  // What the search over a dataset finds out
+  enum class EvaluationMode
+  {
+    COUNT, // Matches of every row and of every subtree (for the relevance sort)
+    ROWS,  // Only whether every row satisfies the request
+    ROOTS  // Only whether the subtree of every top-level row has a row that satisfies the request
+  };
+
+  /// Mode the searchers evaluate requests in with the options (see OptionBit()):
+  /// matches are counted only for the relevance sort, rows are checked one by one
+  /// only for expanding nodes, otherwise the first matched row of a subtree is enough
+  EvaluationMode EvaluationFor(const unsigned options) noexcept;
+
+  // Result of the search over a dataset. Matched rows are kept as compressed bitmaps,
+  // so results are combined and counted without visiting the rows
+
+  struct SearchResult
+  {
+    EvaluationMode mode { EvaluationMode::COUNT };
+
+    RowBitmap            rows;       // Rows that satisfy the request (ROOTS: only the first such row of a subtree)
+    std::vector<Matches> rowMatches; // Every row: matches in the row (COUNT only, otherwise empty)
+
+    RowBitmap            roots;       // Top-level rows (indexes in Roots()) whose subtree has a row that satisfies the request
+    std::vector<Matches> rootMatches; // Every top-level row: matches of the subtree (COUNT only, otherwise empty)
+
+    void Reset(const std::size_t rowCount, const std::size_t rootCount, const EvaluationMode a_mode = EvaluationMode::COUNT);
+
+    /// Amount of the matched rows (ROOTS: the ones found before the subtrees are decided)
+    unsigned MatchedRows() const noexcept;
+
+    /// Amount of the top-level rows that are shown
+    unsigned VisibleRoots() const noexcept;
+
+    /// Memory used by the result (bytes)
+    std::size_t MemoryUsage() const noexcept;
+  };
+
+  // Results of the recent requests over a dataset, so a repeated request (e.g. after the last
+  // typed character is erased) isn't evaluated again, and a request that refines a recent one
+  // (e.g. the next typed character) is evaluated only on its rows. The least recently used
+  // results are dropped. The cache must be cleared when the dataset is changed
+
+  class ResultCache
+  {
+   public:
+
+    static constexpr std::size_t DEFAULT_MAX_RESULTS = 8;
+
+    explicit ResultCache(const std::size_t maxResults = DEFAULT_MAX_RESULTS);
+
+    void Clear() noexcept;
+
+    /// Method of finding the result of the request
+    ///
+    /// @param[in] request - search request
+    /// @param[in] context - everything else the result depends on (options, columns)
+    /// @return            - nullptr if the result isn't cached
+
+    const SearchResult* Find(const std::string& request, const std::string& context);
+
+    /// Method of finding the result with the fewest rows among the requests the plan refines
+    /// (see QueryPlan::Refines()): only its rows may satisfy the plan
+    ///
+    /// @param[in] plan    - query plan
+    /// @param[in] context - everything else the result depends on (options, columns)
+    /// @return            - nullptr if there is no such result
+
+    const SearchResult* FindRefined(const QueryPlan& plan, const std::string& context) const;
+
+    void Add(const std::string& request, const std::string& context, const QueryPlan& plan, const SearchResult& result);
+
+    /// Memory used by the cached results (bytes)
+    std::size_t MemoryUsage() const noexcept;
+
+   private:
+
+    struct CachedResult
+    {
+      std::string  request;
+      std::string  context;
+      QueryPlan    plan;
+      SearchResult result;
+    };
+
+    std::size_t maxResults_;
+
+    std::list<CachedResult> results_; // The most recently used first
+  };
+
+  // Part of the result of a request found in one column (see SearchCore::RunByColumns())
+  struct ColumnPart
+  {
+    int  column         { -1 };
+    bool isSearchColumn { true }; // Unscoped terms are searched in the column (otherwise only the terms scoped to it)
+
+    std::vector<RowBitmap> clauseRows;  // Every clause of the parts: rows where it's found in the column
+    RowBitmap              countedRows; // Rows with matches of the positive terms in the column (if they're counted)
+    std::vector<Matches>   matches;     // Matches of these rows in the order of the rows
+  };
+
+  // Column of a request that refines the previous one (see QueryPlan::TermsWithin()), which isn't
+  // evaluated yet: the terms can be found in it only where the previous request is found in it
+
+  struct NarrowedColumn
+  {
+    int       column         { -1 };
+    bool      isSearchColumn { true };
+    RowBitmap rows; // The only rows the column is evaluated on
+  };
+
+  // Parts of the result of a request by column. The result for any set of search columns
+  // is combined from them, so after the search columns are changed only the added columns
+  // are evaluated. The parts of a request that refines the previous one (e.g. the next typed
+  // character) are evaluated only on the rows where the parts of the previous request are found.
+  // The parts must be cleared when the dataset is changed
+
+  struct ColumnParts
+  {
+    std::vector<QueryClause>    clauses;              // Clauses of the request the parts are evaluated for
+    bool                        countMatches { false };
+    RowBitmap                   rows;                 // Rows the request is evaluated on (not pruned by summaries and conditions)
+    std::vector<ColumnPart>     parts;
+    std::vector<NarrowedColumn> narrowed;             // Columns without parts narrowed by the previous request
+
+    void Clear() noexcept;
+
+    /// Memory used by the parts (bytes)
+    std::size_t MemoryUsage() const noexcept;
+  };
+
+  /// Method of ordering rows by relevance: by the amount of matched words, then by the amount
+  /// of matches (descending). The sort is stable, so equal rows keep their order
+  ///
+  /// @param[in] matches - matches of every row
+  /// @return            - indices of the rows in the order
+
+  std::vector<unsigned> RelevanceOrder(const std::vector<Matches>& matches);
+
+  // Row that satisfies the request
+  struct SearchMatch
+  {
+    unsigned row { 0 };
+    Matches  matches;
+  };
+
+  // Lazy search over a dataset: rows that satisfy the request are found in the tree order
+  // as the cursor is advanced, so a consumer that stops early ("any match?", "first N")
+  // pays only for the rows evaluated so far. The cursor owns its plan but reads the rows, the summaries
+  // and the typed values of the dataset: it's valid while the dataset exists and isn't changed
+  // (cleared, loaded, attached, published, its indexes dropped or its types set)
+
+  class SearchCursor
+  {
+   public:
+
+    // Input iterator over the remaining matches (for range-based for)
+    class Iterator
+    {
+     public:
+
+      using iterator_category = std::input_iterator_tag;
+      using value_type        = SearchMatch;
+      using difference_type   = std::ptrdiff_t;
+      using pointer           = const SearchMatch*;
+      using reference         = const SearchMatch&;
+
+      Iterator() = default;
+      explicit Iterator(SearchCursor* cursor);
+
+      reference operator*() const noexcept;
+      pointer   operator->() const noexcept;
+
+      Iterator& operator++();
+
+      bool operator==(const Iterator& other) const noexcept;
+      bool operator!=(const Iterator& other) const noexcept;
+
+     private:
+
+      SearchCursor* cursor_ { nullptr }; // nullptr - the end
+    };
+
+    SearchCursor() noexcept;
+    SearchCursor(SearchCursor&& other) noexcept;
+    SearchCursor& operator=(SearchCursor&& other) noexcept;
+    ~SearchCursor();
+
+    /// Method of finding the next row that satisfies the request
+    ///
+    /// @param[out] match - the row and its matches
+    /// @return           - false if there are no more such rows
+
+    bool Next(SearchMatch& match);
+
+    /// Method of taking the next matches
+    ///
+    /// @param[in] count - max. amount of matches
+    /// @return          - matches (fewer than the count if there are no more of them)
+
+    std::vector<SearchMatch> Take(const std::size_t count);
+
+    /// Amount of the remaining matches (the cursor is exhausted; matches aren't counted)
+    std::size_t Count();
+
+    Iterator begin();
+    Iterator end() noexcept;
+
+   private:
+
+    friend class SearchCore;
+
+    struct State;
+
+    explicit SearchCursor(std::unique_ptr<State> state) noexcept;
+
+    /// Method of finding the next row that satisfies the request
+    /// @param[out] match - the row and its matches (nullptr - matches aren't counted)
+
+    bool Advance(SearchMatch* const match);
+
+   private:
+
+    std::unique_ptr<State> state_; // nullptr - there are no matches
+    SearchMatch            current_;
+  };
+
+  // Search engine that evaluates query plans over a dataset. Doesn't depend on VCL,
+  // so it's used both by the searchers and by headless tools (see tools/SearchReplay.cpp)
+
+  class SearchCore
+  {
+   public:
+
+    explicit SearchCore(const SearchDataset& dataset);
+
+    /// Method of ordering the plan clauses by selectivity measured on a sample of rows
+    ///
+    /// @param[in] plan    - query plan
+    /// @param[in] columns - columns searched by unscoped terms
+
+    void Optimize(QueryPlan& plan, const std::vector<int>& columns) const;
+
+    /// Method of evaluating the plan on every row of the dataset.
+    /// Subtrees whose summaries can't contain the query terms are skipped,
+    /// conditions of filter clauses on typed columns are checked over whole columns beforehand
+    ///
+    /// @param[in]  plan       - query plan
+    /// @param[in]  columns    - columns searched by unscoped terms
+    /// @param[out] result     - search result
+    /// @param[in]  mode       - what has to be found out (without counting every term stops at its first hit)
+    /// @param[in]  candidates - result of a request the plan refines (see QueryPlan::Refines()):
+    ///                          only its rows are evaluated (nullptr - all rows)
+
+    void Run(const QueryPlan& plan, const std::vector<int>& columns, SearchResult& result,
+             const EvaluationMode mode = EvaluationMode::COUNT, const SearchResult* const candidates = nullptr) const;
+
+    /// Method of starting the lazy search (rows are evaluated as the cursor is advanced)
+    ///
+    /// @param[in] plan    - query plan (the cursor keeps its copy)
+    /// @param[in] columns - columns searched by unscoped terms
+    /// @return            - cursor at the first row of the dataset
+
+    SearchCursor Find(QueryPlan plan, std::vector<int> columns) const;
+
+    /// Method of evaluating the plan as Run() does, keeping the parts of the result by column:
+    /// columns that already have their parts aren't evaluated again, so after the search columns
+    /// are changed only the added ones are scanned (a removed column just isn't combined).
+    /// If the plan refines the request of the parts, the columns are evaluated only on its rows
+    ///
+    /// @param[in]     plan    - query plan
+    /// @param[in]     columns - columns searched by unscoped terms
+    /// @param[in,out] parts   - parts of the result (started over if they're for another request)
+    /// @param[out]    result  - search result
+    /// @param[in]     mode    - what has to be found out
+
+    void RunByColumns(const QueryPlan& plan, const std::vector<int>& columns, ColumnParts& parts,
+                      SearchResult& result, const EvaluationMode mode = EvaluationMode::COUNT) const;
+
+   private:
+
+    /// Method of evaluating the plan on one column of the rows
+    ///
+    /// @param[in]     plan  - query plan
+    /// @param[in]     order - every clause of the plan: its index in the parts
+    /// @param[in]     parts - parts of the result
+    /// @param[in]     rows  - rows of the parts the column is evaluated on
+    /// @param[in,out] part  - part of the column
+
+    void RunColumn(const QueryPlan& plan, const std::vector<std::size_t>& order, const ColumnParts& parts,
+                   const RowBitmap& rows, ColumnPart& part) const;
+
+   private:
+
+    const SearchDataset& dataset_;
+  };
+
+} // namespace searcher
+
+#endif
@@ -0,0 +1,122 @@
+﻿#pragma hdrstop
+
+#include "src/SearchHighlight.h"
+
+#include <functional>
+
+#pragma package(smart_init)
+
+namespace searcher {
+
+bool HighlightLayouts::CellKey::operator==(const CellKey& other) const noexcept
+{
+  return cell == other.cell && column == other.column && font == other.font;
+}
+
+std::size_t HighlightLayouts::CellKeyHash::operator()(const CellKey& key) const noexcept
+{
+  std::size_t hash = std::hash<const void*>()(key.cell);
+
+  hash = hash * 31 + static_cast<std::size_t>(key.column);
+  hash = hash * 31 + std::hash<std::uint64_t>()(key.font);
+
+  return hash;
+}
+
+HighlightLayouts::HighlightLayouts(const std::size_t maxCells)
+    : maxCells_(maxCells)
+{}
+
+void HighlightLayouts::Clear() noexcept
+{
+  cells_.clear();
+}
+
+const std::array<int, 256>& HighlightLayouts::Widths(ITextMeasurer& measurer)
+{
+  const std::uint64_t font = measurer.FontKey();
+
+  auto widths = widths_.find(font);
+
+  if (widths == widths_.end())
+  {
+    widths = widths_.emplace(font, std::array<int, 256>()).first;
+    measurer.MeasureChars(widths->second);
+  }
+
+  return widths->second;
+}
+
+const std::vector<HighlightRange>& HighlightLayouts::Ranges(const void* cell, const int column, const std::string_view text,
+                                                            const QueryPlan& plan, const bool isSearchColumn, ITextMeasurer& measurer)
+{
+  const CellKey key { cell, column, measurer.FontKey() };
+
+  auto layout = cells_.find(key);
+
+  if (layout != cells_.end() && layout->second.text == text)
+    return layout->second.ranges;
+
+  // Cells are laid out while they're painted, so the cache holds about a screen of them:
+  // it's simply dropped when it grows over the limit
+
+  if (layout == cells_.end() && cells_.size() >= maxCells_)
+  {
+    cells_.clear();
+    layout = cells_.end();
+  }
+
+  if (layout == cells_.end())
+    layout = cells_.emplace(key, CellLayout()).first;
+
+  CellLayout& result = layout->second;
+
+  result.text.assign(text.data(), text.length());
+  result.ranges.clear();
+
+  std::string lowerText = result.text;
+  ToLower(lowerText);
+
+  // Matches are found the same way as when counting them (words or regular expression)
+  const std::vector<MatchSpan> spans = plan.Spans(lowerText, column, isSearchColumn);
+
+  if (spans.empty())
+    return result.ranges;
+
+  // Position of a character is the sum of the widths of the previous ones;
+  // the sums are accumulated up to the end of the last match only
+
+  const std::array<int, 256>& widths = Widths(measurer);
+
+  std::size_t pos  = 0;
+  int         left = 0;
+
+  for (const auto& span : spans)
+  {
+    for (; pos < span.pos; pos++)
+      left += widths[static_cast<unsigned char>(text[pos])];
+
+    int right = left;
+
+    for (; pos < span.pos + span.length; pos++)
+      right += widths[static_cast<unsigned char>(text[pos])];
+
+    result.ranges.push_back(HighlightRange { span.pos, span.length, left, right });
+
+    left = right;
+  }
+
+  return result.ranges;
+}
+
+std::size_t HighlightLayouts::MemoryUsage() const noexcept
+{
+  std::size_t usage = widths_.size() * sizeof(std::array<int, 256>);
+
+  for (const auto& cell : cells_)
+    usage += sizeof(cell) + cell.second.text.capacity() + cell.second.ranges.capacity() * sizeof(HighlightRange);
+
+  return usage;
+}
+
+} // namespace searcher
@@ -0,0 +1,112 @@
+﻿#ifndef SearchHighlightH
+#define SearchHighlightH
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "src/SearchQuery.h"
+
+namespace searcher
+{
+  // Measurement of text in the font it's drawn with. The searchers use GDI,
+  // tests may use a fake with fixed widths
+
+  class ITextMeasurer
+  {
+   public:
+
+    virtual ~ITextMeasurer() = default;
+
+    /// Key of the current font: text in fonts with different keys (name, size, style)
+    /// is measured separately, the same key means the same widths
+    virtual std::uint64_t FontKey() const = 0;
+
+    /// Method of measuring advance widths of all single-byte characters in the current font
+    ///
+    /// @param[out] widths - width of every character (in pixels)
+
+    virtual void MeasureChars(std::array<int, 256>& widths) = 0;
+  };
+
+  // Highlighted part of a cell: the match and its horizontal position in the text
+  struct HighlightRange
+  {
+    std::size_t pos    { 0 }; // Match in the text
+    std::size_t length { 0 };
+
+    int left  { 0 }; // Pixels from the start of the text
+    int right { 0 };
+  };
+
+  // Highlight layout of cells for the current request. Widths of characters are measured
+  // once per font, the positions of matches in a cell are taken from the prefix sums
+  // of the widths, so a cell is laid out once and later paints are lookups.
+  // The layouts must be cleared when the request changes
+
+  class HighlightLayouts
+  {
+   public:
+
+    static constexpr std::size_t DEFAULT_MAX_CELLS = 4096;
+
+    explicit HighlightLayouts(const std::size_t maxCells = DEFAULT_MAX_CELLS);
+
+    void Clear() noexcept;
+
+    /// Method of getting highlighted parts of the cell
+    ///
+    /// @param[in] cell           - identity of the cell (e.g. the node)
+    /// @param[in] column         - column of the cell
+    /// @param[in] text           - text of the cell as it's drawn
+    /// @param[in] plan           - request
+    /// @param[in] isSearchColumn - the column is searched by unscoped terms
+    /// @param[in] measurer       - measurer of the text in the font of the cell
+    /// @return                   - highlighted parts (valid until the next call)
+
+    const std::vector<HighlightRange>& Ranges(const void* cell, const int column, const std::string_view text,
+                                              const QueryPlan& plan, const bool isSearchColumn, ITextMeasurer& measurer);
+
+    /// Memory used by the layouts (bytes)
+    std::size_t MemoryUsage() const noexcept;
+
+   private:
+
+    struct CellKey
+    {
+      const void*   cell;
+      int           column;
+      std::uint64_t font;
+
+      bool operator==(const CellKey& other) const noexcept;
+    };
+
+    struct CellKeyHash
+    {
+      std::size_t operator()(const CellKey& key) const noexcept;
+    };
+
+    struct CellLayout
+    {
+      std::string                 text;   // The layout is valid for this text only
+      std::vector<HighlightRange> ranges;
+    };
+
+    /// Widths of characters of the font (measured on the first use)
+    const std::array<int, 256>& Widths(ITextMeasurer& measurer);
+
+   private:
+
+    std::size_t maxCells_;
+
+    std::unordered_map<std::uint64_t, std::array<int, 256>> widths_; // Every font: widths of characters
+    std::unordered_map<CellKey, CellLayout, CellKeyHash>     cells_;
+  };
+
+} // namespace searcher
+
+#endif
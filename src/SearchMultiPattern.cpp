@@ -0,0 +1,139 @@
+﻿#pragma hdrstop
+
+#include "src/SearchMultiPattern.h"
+
+#include <deque>
+
+#pragma package(smart_init)
+
+namespace searcher {
+
+void MultiPatternMatcher::Clear() noexcept
+{
+  patterns_.clear();
+
+  next_.clear();
+  outputStart_.clear();
+  outputs_.clear();
+}
+
+unsigned MultiPatternMatcher::Add(const std::string& pattern)
+{
+  patterns_.push_back(pattern);
+  return static_cast<unsigned>(patterns_.size()) - 1;
+}
+
+bool MultiPatternMatcher::Empty() const noexcept
+{
+  return patterns_.empty();
+}
+
+std::size_t MultiPatternMatcher::PatternCount() const noexcept
+{
+  return patterns_.size();
+}
+
+const std::string& MultiPatternMatcher::Pattern(const unsigned id) const noexcept
+{
+  return patterns_[id];
+}
+
+void MultiPatternMatcher::Build()
+{
+  constexpr std::uint32_t NONE = ~std::uint32_t(0);
+
+  next_.clear();
+  outputStart_.clear();
+  outputs_.clear();
+
+  if (patterns_.empty())
+    return;
+
+  // 1) Trie of the patterns
+  std::vector<std::uint32_t> trie(256, NONE);
+  std::vector<std::vector<std::uint32_t>> outputs(1);
+
+  for (unsigned id = 0; id < patterns_.size(); id++)
+  {
+    std::uint32_t state = 0;
+
+    for (const char c : patterns_[id])
+    {
+      std::uint32_t& target = trie[(state << 8) | static_cast<unsigned char>(c)];
+
+      if (target == NONE)
+      {
+        target = static_cast<std::uint32_t>(outputs.size());
+
+        outputs.emplace_back();
+        trie.resize(trie.size() + 256, NONE);
+      }
+
+      state = trie[(state << 8) | static_cast<unsigned char>(c)];
+    }
+
+    if (!patterns_[id].empty())
+      outputs[state].push_back(id);
+  }
+
+  // 2) Failure links (breadth-first), missing transitions are replaced
+  //    by the transitions of the failure state, so the trie becomes a DFA
+
+  const std::size_t states = outputs.size();
+
+  std::vector<std::uint32_t> fail(states, 0);
+  std::deque<std::uint32_t>  queue;
+
+  for (unsigned c = 0; c < 256; c++)
+  {
+    std::uint32_t& target = trie[c];
+
+    if (target == NONE)
+    {
+      target = 0;
+    }
+    else
+    {
+      fail[target] = 0;
+      queue.push_back(target);
+    }
+  }
+
+  while (!queue.empty())
+  {
+    const std::uint32_t state = queue.front();
+    queue.pop_front();
+
+    const std::vector<std::uint32_t>& inherited = outputs[fail[state]];
+    outputs[state].insert(outputs[state].end(), inherited.begin(), inherited.end());
+
+    for (unsigned c = 0; c < 256; c++)
+    {
+      std::uint32_t& target = trie[(state << 8) | c];
+
+      if (target == NONE)
+      {
+        target = trie[(fail[state] << 8) | c];
+      }
+      else
+      {
+        fail[target] = trie[(fail[state] << 8) | c];
+        queue.push_back(target);
+      }
+    }
+  }
+
+  next_ = std::move(trie);
+
+  outputStart_.reserve(states + 1);
+
+  for (const auto& output : outputs)
+  {
+    outputStart_.push_back(static_cast<std::uint32_t>(outputs_.size()));
+    outputs_.insert(outputs_.end(), output.begin(), output.end());
+  }
+
+  outputStart_.push_back(static_cast<std::uint32_t>(outputs_.size()));
+}
+
+} // namespace searcher
@@ -0,0 +1,68 @@
+﻿#ifndef SearchMultiPatternH
+#define SearchMultiPatternH
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace searcher
+{
+  // Aho-Corasick automaton: finds occurrences of all patterns in one pass over the text.
+  // Transitions are stored as a dense table, so every character costs one lookup
+
+  class MultiPatternMatcher final
+  {
+   public:
+
+    void Clear() noexcept;
+
+    /// Method of adding a pattern (Build() must be called after all patterns are added)
+    ///
+    /// @param[in] pattern - non-empty pattern
+    /// @return            - pattern id
+
+    unsigned Add(const std::string& pattern);
+
+    /// Method of building the automaton
+    void Build();
+
+    bool Empty() const noexcept;
+    std::size_t PatternCount() const noexcept;
+
+    const std::string& Pattern(const unsigned id) const noexcept;
+
+    /// Method of finding all occurrences (including overlapping ones) of all patterns
+    ///
+    /// @param[in] text    - text
+    /// @param[in] onMatch - called as onMatch(patternId, endPos) for every occurrence
+
+    template <typename OnMatch>
+    void Scan(const std::string_view text, OnMatch&& onMatch) const
+    {
+      if (next_.empty())
+        return;
+
+      std::uint32_t state = 0;
+
+      for (std::size_t i = 0; i < text.length(); i++)
+      {
+        state = next_[(state << 8) | static_cast<unsigned char>(text[i])];
+
+        for (std::uint32_t k = outputStart_[state]; k < outputStart_[state + 1]; k++)
+          onMatch(outputs_[k], i + 1);
+      }
+    }
+
+   private:
+
+    std::vector<std::string> patterns_;
+
+    std::vector<std::uint32_t> next_;        // State * 256 + character -> state
+    std::vector<std::uint32_t> outputStart_; // Patterns that end in the state: outputs_[outputStart_[s], outputStart_[s + 1])
+    std::vector<std::uint32_t> outputs_;
+  };
+
+} // namespace searcher
+
+#endif
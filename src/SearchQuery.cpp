@@ -0,0 +1,1149 @@
+﻿#pragma hdrstop
+
+#include "src/SearchQuery.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <tuple>
+
+#pragma package(smart_init)
+
+namespace searcher {
+
+// Rows are ordered by the amount of matched words, then by the amount of matches
+
+bool operator>(const Matches& lhs, const Matches& rhs)
+{
+  return std::tie(lhs.wordsMatches, lhs.totalMatches) > std::tie(rhs.wordsMatches, rhs.totalMatches);
+}
+
+bool operator<(const Matches& lhs, const Matches& rhs)
+{
+  return std::tie(lhs.wordsMatches, lhs.totalMatches) < std::tie(rhs.wordsMatches, rhs.totalMatches);
+}
+
+Matches& Matches::operator+=(const Matches& rhs)
+{
+  if (rhs.totalMatches > 0)
+    totalMatches += rhs.totalMatches;
+
+  if (rhs.wordsMatches > 0)
+    wordsMatches += rhs.wordsMatches;
+
+  return *this;
+}
+
+void ValueMemo::Clear() noexcept
+{
+  columns_.clear();
+}
+
+ValueMemo::Column& ValueMemo::GetColumn(const int column)
+{
+  const std::size_t index = static_cast<std::size_t>(std::max(column, -1) + 1);
+
+  if (index >= columns_.size())
+    columns_.resize(index + 1);
+
+  return columns_[index];
+}
+
+std::int8_t& ValueMemo::Exists(const int column, const std::size_t term, const unsigned value)
+{
+  auto& exists = GetColumn(column).exists;
+
+  if (term >= exists.size())
+    exists.resize(term + 1);
+
+  if (value >= exists[term].size())
+    exists[term].resize(value + 1, -1);
+
+  return exists[term][value];
+}
+
+ValueMemo::Counted& ValueMemo::Count(const int column, const bool isSearchColumn, const unsigned value)
+{
+  auto& counts = GetColumn(column).counts[isSearchColumn];
+
+  if (value >= counts.size())
+    counts.resize(value + 1);
+
+  return counts[value];
+}
+
+bool operator==(const QueryTerm& lhs, const QueryTerm& rhs)
+{
+  return (lhs.text == rhs.text) && (lhs.scoped == rhs.scoped) &&
+         (lhs.phrase == rhs.phrase) && (!lhs.scoped || lhs.column == rhs.column) &&
+         (!lhs.regex == !rhs.regex) && (!lhs.condition == !rhs.condition);
+}
+
+void ToLower(std::string& text) noexcept
+{
+  for (auto& c : text)
+    c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+}
+
+static bool IsSpace(const char c) noexcept
+{
+  return (c == ' ' || c == '\t' || c == '\r' || c == '\n');
+}
+
+// Keys of the QWERTY layout and characters of the JCUKEN layout on the same keys (Windows-1251)
+static const char layoutEn[] = "qwertyuiop[]asdfghjkl;'zxcvbnm,.`";
+static const char layoutRu[] = "\xE9\xF6\xF3\xEA\xE5\xED\xE3\xF8\xF9\xE7\xF5\xFA"
+                               "\xF4\xFB\xE2\xE0\xEF\xF0\xEE\xEB\xE4\xE6\xFD"
+                               "\xFF\xF7\xF1\xEC\xE8\xF2\xFC\xE1\xFE\xB8";
+
+static_assert(sizeof(layoutEn) == sizeof(layoutRu), "Layouts must have the same keys");
+
+std::vector<std::string> LayoutVariants(const std::string& word)
+{
+  std::vector<std::string> variants;
+
+  auto transpose = [&word, &variants](const char* from, const char* to)
+  {
+    std::string variant = word;
+
+    for (auto& c : variant)
+    {
+      if (const char* key = std::strchr(from, c); key && c != '\0')
+        c = to[key - from];
+    }
+
+    if (variant != word && std::find(variants.begin(), variants.end(), variant) == variants.end())
+      variants.push_back(std::move(variant));
+  };
+
+  transpose(layoutEn, layoutRu);
+  transpose(layoutRu, layoutEn);
+
+  return variants;
+}
+
+void QueryPlan::Parse(const std::string& request, const ColumnResolver& resolver, const ColumnTypeResolver& types)
+{
+  Clear();
+
+  // Delimiters of words inside of a token (as it was before the query language)
+  static const char* delim = "./;,";
+
+  const std::size_t len = request.length();
+
+  std::size_t pos  = 0;
+  bool joinNext    = false; // The previous token was 'OR'
+
+  while (pos < len)
+  {
+    while (pos < len && IsSpace(request[pos]))
+      pos++;
+
+    if (pos >= len)
+      break;
+
+    TermOccur occur = TermOccur::SHOULD;
+
+    if ((request[pos] == '+' || request[pos] == '-') && (pos + 1 < len) && !IsSpace(request[pos + 1]))
+    {
+      occur = (request[pos] == '+') ? TermOccur::MUST : TermOccur::MUST_NOT;
+      pos++;
+    }
+
+    // 'OR' operator (only in upper case, so the word 'or' is still searchable)
+    if (occur == TermOccur::SHOULD && !clauses_.empty() &&
+        request.compare(pos, 2, "OR") == 0 && (pos + 2 >= len || IsSpace(request[pos + 2])))
+    {
+      joinNext = true;
+      pos += 2;
+      continue;
+    }
+
+    QueryTerm term;
+
+    // Column scope (col:term). If there is no such column the token is a usual word
+    std::size_t nameEnd = pos;
+
+    while (nameEnd < len && !IsSpace(request[nameEnd]) && request[nameEnd] != ':' && request[nameEnd] != '"')
+      nameEnd++;
+
+    if (resolver && nameEnd > pos && nameEnd + 1 < len &&
+        request[nameEnd] == ':' && !IsSpace(request[nameEnd + 1]))
+    {
+      int column = -1;
+
+      if (resolver(request.substr(pos, nameEnd - pos), column))
+      {
+        term.column = column;
+        term.scoped = true;
+        pos = nameEnd + 1;
+      }
+    }
+
+    std::vector<QueryTerm> terms;
+
+    // A term scoped to a typed column is a condition on its values (the whole token).
+    // If the token isn't a condition, it's searched as text
+
+    if (term.scoped && types && request[pos] != '"')
+    {
+      const ColumnType type = types(term.column);
+
+      std::size_t end = pos;
+
+      while (end < len && !IsSpace(request[end]))
+        end++;
+
+      std::string token = request.substr(pos, end - pos);
+      ToLower(token);
+
+      if (type != ColumnType::TEXT && (term.condition = ValueCondition::Parse(type, token)))
+      {
+        term.text = std::move(token);
+        terms.push_back(term);
+
+        pos = end;
+      }
+    }
+
+    if (!terms.empty())
+    {
+      // The condition is parsed
+    }
+    else if (request[pos] == '"')
+    {
+      std::size_t end = request.find('"', pos + 1);
+
+      if (end == std::string::npos)
+        end = len;
+
+      term.text   = request.substr(pos + 1, end - pos - 1);
+      term.phrase = true;
+
+      if (!term.text.empty())
+        terms.push_back(term);
+
+      pos = (end < len) ? end + 1 : len;
+    }
+    else
+    {
+      std::size_t end = pos;
+
+      while (end < len && !IsSpace(request[end]))
+        end++;
+
+      const std::string token = request.substr(pos, end - pos);
+      pos = end;
+
+      std::string::size_type start = 0,
+                             wordEnd = 0;
+
+      while ((start = token.find_first_not_of(delim, wordEnd)) != std::string::npos)
+      {
+        wordEnd = token.find_first_of(delim, start);
+
+        term.text = token.substr(start, wordEnd - start);
+        terms.push_back(term);
+      }
+    }
+
+    for (auto& t : terms)
+      ToLower(t.text);
+
+    if (terms.empty())
+      continue;
+
+    if (joinNext)
+    {
+      auto& alternatives = clauses_.back().terms;
+
+      for (auto& t : terms)
+      {
+        if (std::find(alternatives.begin(), alternatives.end(), t) == alternatives.end())
+          alternatives.push_back(std::move(t));
+      }
+
+      joinNext = false;
+      continue;
+    }
+
+    for (auto& t : terms)
+    {
+      QueryClause clause;
+
+      clause.occur = occur;
+      clause.terms.push_back(std::move(t));
+
+      // Skip duplicates
+      const bool isDuplicate = std::any_of(clauses_.begin(), clauses_.end(), [&clause](const QueryClause& c)
+      {
+        return (c.occur == clause.occur) && (c.terms == clause.terms);
+      });
+
+      if (!isDuplicate)
+        clauses_.push_back(std::move(clause));
+    }
+  }
+
+  for (const auto& clause : clauses_)
+  {
+    hasMust_   |= (clause.occur == TermOccur::MUST);
+    hasShould_ |= (clause.occur == TermOccur::SHOULD);
+  }
+
+  Compile();
+}
+
+void QueryPlan::ParseRegex(const std::string& pattern)
+{
+  Clear();
+
+  QueryTerm term;
+
+  term.text  = pattern;
+  term.regex = std::make_shared<Regex>(pattern);
+
+  QueryClause clause;
+
+  clause.occur = TermOccur::MUST;
+  clause.terms.push_back(std::move(term));
+
+  clauses_.push_back(std::move(clause));
+  hasMust_ = true;
+
+  Compile();
+}
+
+void QueryPlan::Optimize(const SelectivityEstimator& estimator, const std::size_t columnsCount)
+{
+  auto termCost = [columnsCount](const QueryTerm& term)
+  {
+    return static_cast<double>(term.scoped ? 1 : std::max<std::size_t>(columnsCount, 1));
+  };
+
+  for (auto& clause : clauses_)
+  {
+    std::vector<double> selectivity;
+
+    for (const auto& term : clause.terms)
+      selectivity.push_back(std::clamp(estimator ? estimator(term) : EstimateSelectivity(term), 0.0, 1.0));
+
+    // Alternatives: the most probable and cheap ones are checked first,
+    // so the check of the clause stops as soon as possible
+
+    std::vector<std::size_t> order(clause.terms.size());
+
+    for (std::size_t i = 0; i < order.size(); i++)
+      order[i] = i;
+
+    std::stable_sort(order.begin(), order.end(), [&](const std::size_t lhs, const std::size_t rhs)
+    {
+      return (selectivity[lhs] / termCost(clause.terms[lhs])) > (selectivity[rhs] / termCost(clause.terms[rhs]));
+    });
+
+    std::vector<QueryTerm> terms;
+    double missProbability = 1.0;
+
+    clause.cost = 0.0;
+
+    for (const auto i : order)
+    {
+      terms.push_back(std::move(clause.terms[i]));
+
+      missProbability *= (1.0 - selectivity[i]);
+      clause.cost     += termCost(terms.back());
+    }
+
+    clause.terms       = std::move(terms);
+    clause.selectivity = 1.0 - missProbability;
+  }
+
+  // Probability that a row passes the clause check
+  auto passProbability = [](const QueryClause& clause)
+  {
+    return (clause.occur == TermOccur::MUST_NOT) ? (1.0 - clause.selectivity) : clause.selectivity;
+  };
+
+  // Filters (MUST/MUST_NOT) go first ordered by cost / (1 - pass probability),
+  // that minimizes the expected cost of rejecting a row.
+  // SHOULD clauses go after them, the most probable ones first
+
+  std::stable_sort(clauses_.begin(), clauses_.end(), [&](const QueryClause& lhs, const QueryClause& rhs)
+  {
+    const bool lhsFilter = (lhs.occur != TermOccur::SHOULD);
+    const bool rhsFilter = (rhs.occur != TermOccur::SHOULD);
+
+    if (lhsFilter != rhsFilter)
+      return lhsFilter;
+
+    if (lhsFilter)
+    {
+      const double lhsRank = lhs.cost / std::max(1.0 - passProbability(lhs), 1e-6);
+      const double rhsRank = rhs.cost / std::max(1.0 - passProbability(rhs), 1e-6);
+
+      return lhsRank < rhsRank;
+    }
+
+    return (lhs.selectivity / lhs.cost) > (rhs.selectivity / rhs.cost);
+  });
+
+  Compile();
+}
+
+void QueryPlan::AddLayoutVariants()
+{
+  for (auto& clause : clauses_)
+  {
+    for (auto& term : clause.terms)
+    {
+      if (!term.regex && !term.condition)
+      {
+        term.variants = LayoutVariants(term.text);
+        term.codeMatchers.clear();
+      }
+    }
+  }
+
+  Compile();
+}
+
+void QueryPlan::SetSymbols(std::shared_ptr<const SymbolTable> symbols)
+{
+  if (symbols == symbols_)
+    return;
+
+  symbols_ = std::move(symbols);
+
+  for (auto& clause : clauses_)
+  {
+    for (auto& term : clause.terms)
+      term.codeMatchers.clear();
+  }
+
+  Compile();
+}
+
+void QueryPlan::Compile()
+{
+  terms_.clear();
+  patterns_.clear();
+  scopedColumns_.clear();
+  matcher_.Clear();
+  packed_.clear();
+
+  hasRegex_      = false;
+  hasConditions_ = false;
+  hasUnscoped_   = false;
+
+  // Matchers over compressed text (a term with too long text or variants isn't compiled)
+  if (symbols_)
+  {
+    for (auto& clause : clauses_)
+    {
+      for (auto& term : clause.terms)
+      {
+        if (term.regex || term.condition || !term.codeMatchers.empty() || term.text.length() > CodeMatcher::MAX_LENGTH)
+          continue;
+
+        term.codeMatchers.push_back(std::make_shared<CodeMatcher>(term.text, *symbols_));
+
+        for (const auto& variant : term.variants)
+          term.codeMatchers.push_back(std::make_shared<CodeMatcher>(variant, *symbols_));
+      }
+    }
+  }
+
+  std::size_t index = 0;
+
+  for (auto& clause : clauses_)
+  {
+    for (auto& term : clause.terms)
+      term.index = index++;
+  }
+
+  bool packed = static_cast<bool>(symbols_);
+
+  for (const auto& clause : clauses_)
+  {
+    if (clause.occur == TermOccur::MUST_NOT)
+      continue;
+
+    for (const auto& term : clause.terms)
+    {
+      ScoredTerm scored;
+
+      scored.column = term.column;
+      scored.scoped = term.scoped;
+      scored.should = (clause.occur == TermOccur::SHOULD);
+      scored.regex  = term.regex;
+
+      scored.condition = term.condition;
+
+      terms_.push_back(std::move(scored));
+
+      if (term.scoped && std::find(scopedColumns_.begin(), scopedColumns_.end(), term.column) == scopedColumns_.end())
+        scopedColumns_.push_back(term.column);
+
+      hasUnscoped_ |= !term.scoped;
+
+      // Conditions are checked on the values, they aren't searched in the text
+      if (term.condition)
+      {
+        hasConditions_ = true;
+        continue;
+      }
+
+      if (term.regex)
+      {
+        hasRegex_ = true;
+        continue;
+      }
+
+      packed &= !term.codeMatchers.empty();
+
+      auto addPattern = [this](const std::string& text, const bool variant)
+      {
+        matcher_.Add(text);
+
+        PatternRef pattern;
+
+        pattern.term    = terms_.size() - 1;
+        pattern.length  = text.length();
+        pattern.variant = variant;
+
+        patterns_.push_back(pattern);
+      };
+
+      addPattern(term.text, false);
+
+      for (const auto& variant : term.variants)
+        addPattern(variant, true);
+
+      // The matchers follow the patterns of the term
+      packed_.insert(packed_.end(), term.codeMatchers.begin(), term.codeMatchers.end());
+    }
+  }
+
+  if (!packed)
+    packed_.clear();
+
+  // A single pattern is found faster by std::string_view::find
+  if (patterns_.size() > 1)
+    matcher_.Build();
+
+  hits_.assign(terms_.size(), TermHits());
+  lastEnd_.assign(patterns_.size(), 0);
+}
+
+void QueryPlan::Clear() noexcept
+{
+  clauses_.clear();
+
+  symbols_.reset();
+  packed_.clear();
+  hasRegex_      = false;
+  hasConditions_ = false;
+  hasUnscoped_   = false;
+
+  terms_.clear();
+  patterns_.clear();
+  scopedColumns_.clear();
+  matcher_.Clear();
+
+  hasMust_   = false;
+  hasShould_ = false;
+}
+
+bool QueryPlan::Empty() const noexcept
+{
+  return clauses_.empty();
+}
+
+const std::vector<QueryClause>& QueryPlan::Clauses() const noexcept
+{
+  return clauses_;
+}
+
+double QueryPlan::EstimateSelectivity(const QueryTerm& term) noexcept
+{
+  // A condition can't be estimated without the values
+  if (term.condition)
+    return 0.5;
+
+  // Every next character makes the term a few times rarer.
+  // A regular expression is estimated by the literal its matches contain
+
+  const std::size_t len = term.regex ? term.regex->RequiredLiteral().length() + 1 : term.text.length();
+  const double selectivity = std::pow(0.3, static_cast<double>(len) - 1.0);
+
+  return std::clamp(selectivity, 0.001, 1.0);
+}
+
+bool QueryPlan::TermInText(const QueryTerm& term, const std::string_view text)
+{
+  if (term.regex)
+    return term.regex->IsMatch(text);
+
+  if (text.find(term.text) != std::string_view::npos)
+    return true;
+
+  for (const auto& variant : term.variants)
+  {
+    if (text.find(variant) != std::string_view::npos)
+      return true;
+  }
+
+  return false;
+}
+
+bool QueryPlan::TermInColumn(const QueryTerm& term, IRowText& row, const int column)
+{
+  if (term.condition)
+    return ValueInColumn(*term.condition, row, column);
+
+  const int  value = row.ValueId(column);
+  ValueMemo* memo  = (value >= 0) ? row.Memo() : nullptr;
+
+  if (!memo)
+    return TermInStoredText(term, row, column);
+
+  std::int8_t& exists = memo->Exists(column, term.index, value);
+
+  if (exists < 0)
+    exists = TermInStoredText(term, row, column);
+
+  return exists;
+}
+
+bool QueryPlan::ValueInColumn(const ValueCondition& condition, IRowText& row, const int column)
+{
+  std::size_t index = 0;
+
+  // The values parsed beforehand are compared as is, otherwise the text is parsed
+  if (const TypedValues* values = row.Values(column, index); values && values->Type() == condition.Type())
+    return condition.Matches(*values, index);
+
+  return condition.Matches(row.Text(column));
+}
+
+bool QueryPlan::TermInStoredText(const QueryTerm& term, IRowText& row, const int column)
+{
+  std::string_view   codes;
+  const SymbolTable* table = nullptr;
+
+  if (!term.codeMatchers.empty() && row.Codes(column, codes, table) && table == term.codeMatchers.front()->Table())
+  {
+    return std::any_of(term.codeMatchers.begin(), term.codeMatchers.end(), [codes](const auto& matcher)
+    {
+      return matcher->Contains(codes);
+    });
+  }
+
+  return TermInText(term, row.Text(column));
+}
+
+bool QueryPlan::Contains(const QueryTerm& term, IRowText& row)
+{
+  if (term.scoped)
+    return TermInColumn(term, row, term.column);
+
+  for (const auto column : row.SearchColumns())
+  {
+    if (TermInColumn(term, row, column))
+      return true;
+  }
+
+  return false;
+}
+
+bool QueryPlan::ClauseHits(const QueryClause& clause, IRowText& row)
+{
+  for (const auto& term : clause.terms)
+  {
+    if (Contains(term, row))
+      return true;
+  }
+
+  return false;
+}
+
+bool QueryPlan::Evaluate(IRowText& row, Matches& matches) const
+{
+  matches = Matches();
+
+  if (clauses_.empty())
+    return false;
+
+  for (const auto& clause : clauses_)
+  {
+    switch (clause.occur)
+    {
+      case TermOccur::MUST:
+        if (!ClauseHits(clause, row))
+          return false;
+        break;
+
+      case TermOccur::MUST_NOT:
+        if (ClauseHits(clause, row))
+          return false;
+        break;
+
+      case TermOccur::SHOULD:
+        // Checked by the counting of matches below
+        break;
+    }
+  }
+
+  bool anyShould = false;
+
+  const auto& columns = row.SearchColumns();
+
+  if (hasUnscoped_)
+  {
+    for (const auto column : columns)
+      matches += CountInRow(row, column, true, anyShould);
+  }
+
+  // Terms restricted to columns that aren't counted above
+  for (const auto column : scopedColumns_)
+  {
+    const bool isSearchColumn = (std::find(columns.begin(), columns.end(), column) != columns.end());
+
+    if (!hasUnscoped_ || !isSearchColumn)
+      matches += CountInRow(row, column, isSearchColumn, anyShould);
+  }
+
+  // Without MUST clauses a row must contain at least one of SHOULD clauses
+  if (!hasMust_ && hasShould_ && !anyShould)
+  {
+    matches = Matches();
+    return false;
+  }
+
+  return true;
+}
+
+bool QueryPlan::Satisfies(IRowText& row) const
+{
+  if (clauses_.empty())
+    return false;
+
+  for (const auto& clause : clauses_)
+  {
+    if (clause.occur == TermOccur::MUST && !ClauseHits(clause, row))
+      return false;
+
+    if (clause.occur == TermOccur::MUST_NOT && ClauseHits(clause, row))
+      return false;
+  }
+
+  // Without MUST clauses a row must contain at least one of SHOULD clauses
+  if (hasMust_ || !hasShould_)
+    return true;
+
+  return std::any_of(clauses_.begin(), clauses_.end(), [&row](const QueryClause& clause)
+  {
+    return clause.occur == TermOccur::SHOULD && ClauseHits(clause, row);
+  });
+}
+
+void QueryPlan::EvaluateColumn(IRowText& row, const int column, const bool isSearchColumn,
+                               std::vector<char>& clauses, Matches* const matches) const
+{
+  clauses.assign(clauses_.size(), 0);
+
+  for (std::size_t i = 0; i < clauses_.size(); i++)
+  {
+    for (const auto& term : clauses_[i].terms)
+    {
+      if ((term.scoped ? (term.column == column) : isSearchColumn) && TermInColumn(term, row, column))
+      {
+        clauses[i] = 1;
+        break;
+      }
+    }
+  }
+
+  if (matches)
+  {
+    bool anyShould = false;
+    *matches = CountInRow(row, column, isSearchColumn, anyShould);
+  }
+}
+
+bool QueryPlan::TermRefines(const QueryTerm& term, const QueryTerm& other)
+{
+  // Conditions are parsed objects, they aren't compared
+  if (term.condition || other.condition || term.scoped != other.scoped || (term.scoped && term.column != other.column))
+    return false;
+
+  if (term.regex || other.regex)
+    return term.regex && other.regex && (term.text == other.text);
+
+  // The term is found by its text or by one of its variants:
+  // each of them must contain the text or a variant of the other term
+
+  auto containsOther = [&other](const std::string& text)
+  {
+    if (text.find(other.text) != std::string::npos)
+      return true;
+
+    return std::any_of(other.variants.begin(), other.variants.end(), [&text](const std::string& variant)
+    {
+      return text.find(variant) != std::string::npos;
+    });
+  };
+
+  return containsOther(term.text) && std::all_of(term.variants.begin(), term.variants.end(), containsOther);
+}
+
+bool QueryPlan::TermsWithin(const std::vector<QueryClause>& clauses) const
+{
+  if (clauses_.empty())
+    return false;
+
+  return std::all_of(clauses_.begin(), clauses_.end(), [&clauses](const QueryClause& clause)
+  {
+    return std::all_of(clause.terms.begin(), clause.terms.end(), [&clauses](const QueryTerm& term)
+    {
+      return std::any_of(clauses.begin(), clauses.end(), [&term](const QueryClause& other)
+      {
+        return std::any_of(other.terms.begin(), other.terms.end(), [&term](const QueryTerm& otherTerm)
+        {
+          return TermRefines(term, otherTerm);
+        });
+      });
+    });
+  });
+}
+
+bool QueryPlan::Refines(const QueryPlan& other) const
+{
+  if (clauses_.empty() || other.clauses_.empty())
+    return false;
+
+  // Rows of every alternative of the clause contain an alternative of one of the outer clauses
+  auto within = [](const QueryClause& clause, const std::vector<const QueryClause*>& outer)
+  {
+    return std::all_of(clause.terms.begin(), clause.terms.end(), [&outer](const QueryTerm& term)
+    {
+      return std::any_of(outer.begin(), outer.end(), [&term](const QueryClause* outerClause)
+      {
+        return std::any_of(outerClause->terms.begin(), outerClause->terms.end(), [&term](const QueryTerm& outerTerm)
+        {
+          return TermRefines(term, outerTerm);
+        });
+      });
+    });
+  };
+
+  std::vector<const QueryClause*> should;
+
+  for (const auto& required : other.clauses_)
+  {
+    if (required.occur == TermOccur::SHOULD)
+    {
+      should.push_back(&required);
+      continue;
+    }
+
+    // MUST: a MUST clause of the plan is within it, MUST_NOT: it's within an excluded clause of the plan
+    const bool isRefined = std::any_of(clauses_.begin(), clauses_.end(), [&required, &within](const QueryClause& clause)
+    {
+      return (clause.occur == required.occur) &&
+             ((clause.occur == TermOccur::MUST) ? within(clause, { &required }) : within(required, { &clause }));
+    });
+
+    if (!isRefined)
+      return false;
+  }
+
+  // Without MUST clauses a row of the other plan contains one of its SHOULD clauses:
+  // so does a row that contains a MUST clause within them or one of the SHOULD clauses within them
+
+  if (other.hasMust_ || !other.hasShould_)
+    return true;
+
+  const bool isMustWithin = std::any_of(clauses_.begin(), clauses_.end(), [&should, &within](const QueryClause& clause)
+  {
+    return (clause.occur == TermOccur::MUST) && within(clause, should);
+  });
+
+  if (isMustWithin)
+    return true;
+
+  return !hasMust_ && hasShould_ && std::all_of(clauses_.begin(), clauses_.end(), [&should, &within](const QueryClause& clause)
+  {
+    return (clause.occur != TermOccur::SHOULD) || within(clause, should);
+  });
+}
+
+Matches QueryPlan::Count(const std::string_view text, const int column) const
+{
+  bool anyShould = false;
+
+  Matches matches = CountValues(text, column, true, anyShould);
+  matches += CountInColumn(text, column, true, anyShould);
+
+  return matches;
+}
+
+bool QueryPlan::Applies(const ScoredTerm& term, const int column, const bool isSearchColumn) const noexcept
+{
+  return term.scoped ? (term.column == column) : isSearchColumn;
+}
+
+Matches QueryPlan::CountInColumn(const std::string_view text, const int column, const bool isSearchColumn, bool& anyShould) const
+{
+  CountPatterns(text, column, isSearchColumn);
+  CountRegexes(text, column, isSearchColumn);
+
+  return TakeHits(anyShould);
+}
+
+Matches QueryPlan::CountInRow(IRowText& row, const int column, const bool isSearchColumn, bool& anyShould) const
+{
+  Matches matches = CountValues(row, column, isSearchColumn, anyShould);
+
+  const int  value = row.ValueId(column);
+  ValueMemo* memo  = (value >= 0) ? row.Memo() : nullptr;
+
+  if (!memo)
+  {
+    matches += CountInStoredText(row, column, isSearchColumn, anyShould);
+    return matches;
+  }
+
+  ValueMemo::Counted& counted = memo->Count(column, isSearchColumn, value);
+
+  if (counted.state < 0)
+  {
+    bool valueShould = false;
+
+    counted.matches = CountInStoredText(row, column, isSearchColumn, valueShould);
+    counted.state   = valueShould;
+  }
+
+  anyShould |= (counted.state > 0);
+
+  matches += counted.matches;
+  return matches;
+}
+
+Matches QueryPlan::CountValues(const std::string_view text, const int column, const bool isSearchColumn, bool& anyShould) const
+{
+  Matches matches;
+
+  if (!hasConditions_)
+    return matches;
+
+  // A value that satisfies the condition is one match of the term
+  for (const auto& term : terms_)
+  {
+    if (term.condition && Applies(term, column, isSearchColumn) && term.condition->Matches(text))
+    {
+      matches   += Matches(1, 1);
+      anyShould |= term.should;
+    }
+  }
+
+  return matches;
+}
+
+Matches QueryPlan::CountValues(IRowText& row, const int column, const bool isSearchColumn, bool& anyShould) const
+{
+  Matches matches;
+
+  if (!hasConditions_)
+    return matches;
+
+  for (const auto& term : terms_)
+  {
+    if (term.condition && Applies(term, column, isSearchColumn) && ValueInColumn(*term.condition, row, column))
+    {
+      matches   += Matches(1, 1);
+      anyShould |= term.should;
+    }
+  }
+
+  return matches;
+}
+
+Matches QueryPlan::CountInStoredText(IRowText& row, const int column, const bool isSearchColumn, bool& anyShould) const
+{
+  std::string_view   codes;
+  const SymbolTable* table = nullptr;
+
+  if (packed_.empty() || !row.Codes(column, codes, table) || table != symbols_.get())
+    return CountInColumn(row.Text(column), column, isSearchColumn, anyShould);
+
+  // Literal terms are counted over the compressed text,
+  // it's decompressed only for regular expressions
+
+  for (std::size_t id = 0; id < patterns_.size(); id++)
+  {
+    const PatternRef& pattern = patterns_[id];
+
+    if (!Applies(terms_[pattern.term], column, isSearchColumn))
+      continue;
+
+    TermHits& hits = hits_[pattern.term];
+    (pattern.variant ? hits.variantLength : hits.length) += packed_[id]->Count(codes) * pattern.length;
+  }
+
+  if (hasRegex_)
+    CountRegexes(row.Text(column), column, isSearchColumn);
+
+  return TakeHits(anyShould);
+}
+
+void QueryPlan::CountPatterns(const std::string_view text, const int column, const bool isSearchColumn) const
+{
+  // Literal terms and their layout variants.
+  // Overlapping occurrences of the same pattern aren't counted
+
+  if (patterns_.size() == 1)
+  {
+    const PatternRef& pattern = patterns_.front();
+
+    if (!Applies(terms_[pattern.term], column, isSearchColumn))
+      return;
+
+    const std::string& patternText = matcher_.Pattern(0);
+
+    std::string_view::size_type startSearchFrom = 0,
+                                wordStartPos = 0;
+
+    while ((wordStartPos = text.find(patternText, startSearchFrom)) != std::string_view::npos)
+    {
+      hits_[pattern.term].length += pattern.length;
+      startSearchFrom = wordStartPos + pattern.length;
+    }
+  }
+  else if (!patterns_.empty())
+  {
+    std::fill(lastEnd_.begin(), lastEnd_.end(), 0);
+
+    matcher_.Scan(text, [&](const unsigned id, const std::size_t end)
+    {
+      const PatternRef& pattern = patterns_[id];
+
+      if (end - pattern.length < lastEnd_[id] || !Applies(terms_[pattern.term], column, isSearchColumn))
+        return;
+
+      lastEnd_[id] = end;
+
+      TermHits& hits = hits_[pattern.term];
+      (pattern.variant ? hits.variantLength : hits.length) += pattern.length;
+    });
+  }
+}
+
+void QueryPlan::CountRegexes(const std::string_view text, const int column, const bool isSearchColumn) const
+{
+  for (std::size_t i = 0; i < terms_.size(); i++)
+  {
+    if (!terms_[i].regex || !Applies(terms_[i], column, isSearchColumn))
+      continue;
+
+    for (const auto& span : terms_[i].regex->FindAll(text))
+      hits_[i].length += span.length;
+  }
+}
+
+Matches QueryPlan::TakeHits(bool& anyShould) const
+{
+  Matches matches;
+
+  for (std::size_t i = 0; i < terms_.size(); i++)
+  {
+    TermHits& hits = hits_[i];
+
+    if (hits.length == 0 && hits.variantLength == 0)
+      continue;
+
+    // Matches typed in the wrong layout are less relevant
+    matches += Matches(hits.length + (hits.variantLength + 1) / 2, 1);
+    anyShould |= terms_[i].should;
+
+    hits = TermHits();
+  }
+
+  return matches;
+}
+
+std::vector<MatchSpan> QueryPlan::Spans(const std::string_view text, const int column, const bool isSearchColumn) const
+{
+  std::vector<MatchSpan> spans;
+
+  for (const auto& clause : clauses_)
+  {
+    if (clause.occur == TermOccur::MUST_NOT)
+      continue;
+
+    for (const auto& term : clause.terms)
+    {
+      if (term.scoped ? (term.column != column) : !isSearchColumn)
+        continue;
+
+      // The whole value satisfies the condition
+      if (term.condition)
+      {
+        if (!text.empty() && term.condition->Matches(text))
+          spans.emplace_back(0, text.length());
+
+        continue;
+      }
+
+      if (term.regex)
+      {
+        const std::vector<MatchSpan> termSpans = term.regex->FindAll(text);
+        spans.insert(spans.end(), termSpans.begin(), termSpans.end());
+        continue;
+      }
+
+      auto addSpans = [&spans, text](const std::string& pattern)
+      {
+        std::string_view::size_type startSearchFrom = 0,
+                                    wordStartPos = 0;
+
+        while ((wordStartPos = text.find(pattern, startSearchFrom)) != std::string_view::npos)
+        {
+          spans.emplace_back(wordStartPos, pattern.length());
+          startSearchFrom = wordStartPos + pattern.length();
+        }
+      };
+
+      addSpans(term.text);
+
+      for (const auto& variant : term.variants)
+        addSpans(variant);
+    }
+  }
+
+  std::sort(spans.begin(), spans.end(), [](const MatchSpan& lhs, const MatchSpan& rhs)
+  {
+    return lhs.pos < rhs.pos;
+  });
+
+  // Merge overlapping matches of different terms
+  std::vector<MatchSpan> merged;
+
+  for (const auto& span : spans)
+  {
+    if (!merged.empty() && span.pos <= merged.back().pos + merged.back().length)
+    {
+      MatchSpan& last = merged.back();
+      last.length = std::max(last.length, span.pos + span.length - last.pos);
+    }
+    else
+    {
+      merged.push_back(span);
+    }
+  }
+
+  return merged;
+}
+
+} // namespace searcher
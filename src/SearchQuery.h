@@ -0,0 +1,401 @@
+﻿#ifndef SearchQueryH
+#define SearchQueryH
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <functional>
+#include <memory>
+
+#include "src/SearchRegex.h"
+#include "src/SearchMultiPattern.h"
+#include "src/SearchCompression.h"
+#include "src/SearchValues.h"
+
+namespace searcher
+{
+  struct Matches
+  {
+    unsigned totalMatches { 0 }; // Number of all matches in a row
+    unsigned wordsMatches { 0 }; // Number of matches in the line for the entered words
+
+    Matches() = default;
+
+    explicit Matches(const unsigned a_totalMatches, const unsigned a_wordsMatches)
+        : totalMatches(a_totalMatches)
+        , wordsMatches(a_wordsMatches)
+    {}
+
+    friend bool operator>(const Matches& lhs, const Matches& rhs);
+    friend bool operator<(const Matches& lhs, const Matches& rhs);
+
+    Matches& operator+=(const Matches& rhs);
+  };
+
+  // Occurrence of a query clause in a row
+  enum class TermOccur
+  {
+    SHOULD,   // word      - adds relevance; a row must contain at least one of such clauses if there are no MUST ones
+    MUST,     // +word     - a row must contain the clause
+    MUST_NOT  // -word     - a row mustn't contain the clause
+  };
+
+  struct QueryTerm
+  {
+    std::string text;             // Term text (in lower case)
+    int         column { -1 };    // Column the term is restricted to (if scoped)
+    bool        scoped { false }; // The term is searched only in the column (col:term)
+    bool        phrase { false }; // The term is an exact phrase ("exact phrase")
+
+    std::shared_ptr<Regex> regex; // Regular expression (the text is its pattern)
+
+    std::shared_ptr<const ValueCondition> condition; // Condition on the values of a typed column (amount:>1000)
+
+    std::vector<std::string> variants; // The text typed in another keyboard layout (see LayoutVariants())
+
+    // Matchers of the text and of the variants over compressed text (see QueryPlan::SetSymbols()).
+    // Empty if the term is searched in decompressed text
+    std::vector<std::shared_ptr<const CodeMatcher>> codeMatchers;
+
+    std::size_t index { 0 }; // Index of the term in the plan (see ValueMemo)
+
+    friend bool operator==(const QueryTerm& lhs, const QueryTerm& rhs);
+  };
+
+  struct QueryClause
+  {
+    TermOccur              occur { TermOccur::SHOULD };
+    std::vector<QueryTerm> terms;               // Alternatives of the clause (a OR b)
+
+    double selectivity { 1.0 }; // Estimated share of rows that contain the clause
+    double cost        { 1.0 }; // Estimated cost of checking the clause in a row
+  };
+
+  // Results of evaluating parts of a plan on distinct values of interned columns,
+  // so a value shared by many rows is searched once
+
+  class ValueMemo
+  {
+   public:
+
+    // Matches of the positive terms in a value
+    struct Counted
+    {
+      std::int8_t state { -1 }; // -1 - not counted yet, otherwise whether a SHOULD term is found
+      Matches     matches;
+    };
+
+    void Clear() noexcept;
+
+    /// Whether the term is found in the value: -1 - not checked yet, 0 / 1
+    std::int8_t& Exists(const int column, const std::size_t term, const unsigned value);
+
+    Counted& Count(const int column, const bool isSearchColumn, const unsigned value);
+
+   private:
+
+    struct Column
+    {
+      std::vector<std::vector<std::int8_t>> exists; // By term, by value
+      std::vector<Counted>                  counts[2];
+    };
+
+    Column& GetColumn(const int column);
+
+   private:
+
+    std::vector<Column> columns_; // By column + 1 (-1 - main column)
+  };
+
+  // Text of a row the query plan is evaluated on
+  class IRowText
+  {
+   public:
+
+    virtual ~IRowText() = default;
+
+    /// Method of getting the text of the row in the column
+    ///
+    /// @param[in] column - column index
+    /// @return           - text in lower case
+
+    virtual std::string_view Text(const int column) = 0;
+
+    /// Columns in which the terms that aren't restricted to a column are searched
+    virtual const std::vector<int>& SearchColumns() const = 0;
+
+    /// Method of getting the compressed text of the row in the column
+    ///
+    /// @param[in]  column - column index
+    /// @param[out] codes  - compressed text
+    /// @param[out] table  - table the text is compressed with
+    /// @return            - false if the text isn't compressed
+
+    virtual bool Codes(const int /*column*/, std::string_view& /*codes*/, const SymbolTable*& /*table*/)
+    {
+      return false;
+    }
+
+    /// Index of the row value among distinct values of the column (-1 - values aren't interned).
+    /// Results for such values are kept in Memo()
+
+    virtual int ValueId(const int /*column*/)
+    {
+      return -1;
+    }
+
+    virtual ValueMemo* Memo()
+    {
+      return nullptr;
+    }
+
+    /// Method of getting the parsed values of a typed column
+    ///
+    /// @param[in]  column - column index
+    /// @param[out] index  - index of the row in the values
+    /// @return            - nullptr if the values aren't stored (the text is parsed)
+
+    virtual const TypedValues* Values(const int /*column*/, std::size_t& /*index*/)
+    {
+      return nullptr;
+    }
+  };
+
+  // Compiled search request.
+  //
+  // Grammar:
+  //   word          - the row should contain the word (all such words are OR-ed as before)
+  //   +word         - the row must contain the word
+  //   -word         - the row mustn't contain the word
+  //   "some phrase" - exact phrase (may be prefixed with + or -)
+  //   col:word      - the word is searched only in the column with caption 'col'
+  //   col:>1000     - condition on the values of a typed column (see ValueCondition)
+  //   a OR b        - the row contains a or b (the prefix of 'a' applies to the whole clause)
+
+  class QueryPlan
+  {
+   public:
+
+    using ColumnResolver       = std::function<bool(const std::string& name, int& column)>;
+    using ColumnTypeResolver   = std::function<ColumnType(const int column)>;
+    using SelectivityEstimator = std::function<double(const QueryTerm& term)>;
+
+    /// Method of parsing the search request
+    ///
+    /// @param[in] request  - search request
+    /// @param[in] resolver - returns index of the column by its name (col:term)
+    /// @param[in] types    - returns type of the column (a term scoped to a typed column is a condition)
+
+    void Parse(const std::string& request, const ColumnResolver& resolver = nullptr, const ColumnTypeResolver& types = nullptr);
+
+    /// Method of compiling the whole search request as a regular expression
+    ///
+    /// @param[in] pattern - regular expression
+    /// @throw std::invalid_argument - invalid pattern
+
+    void ParseRegex(const std::string& pattern);
+
+    /// Method of ordering clauses by the estimated selectivity and cost,
+    /// so the most restrictive and cheap checks are made first
+    ///
+    /// @param[in] estimator    - returns the share of rows that contain the term
+    /// @param[in] columnsCount - amount of columns searched by unscoped terms
+
+    void Optimize(const SelectivityEstimator& estimator, const std::size_t columnsCount);
+
+    /// Method of adding keyboard layout variants to the literal terms.
+    /// A variant is found in the same pass as the term, but its matches weigh half as much
+
+    void AddLayoutVariants();
+
+    /// Method of setting the table the searched text is compressed with.
+    /// Literal terms are matched over such text without decompressing it
+    ///
+    /// @param[in] symbols - symbol table (nullptr - the text isn't compressed)
+
+    void SetSymbols(std::shared_ptr<const SymbolTable> symbols);
+
+    void Clear() noexcept;
+    bool Empty() const noexcept;
+
+    /// Clauses in order of evaluation
+    const std::vector<QueryClause>& Clauses() const noexcept;
+
+    /// Method of evaluating the plan on a row.
+    /// Evaluation stops at the first failed MUST/MUST_NOT clause
+    ///
+    /// @param[in]  row     - row text
+    /// @param[out] matches - relevance of the row (if it's matched)
+    /// @return             - whether the row satisfies the request
+
+    bool Evaluate(IRowText& row, Matches& matches) const;
+
+    /// Method of checking whether the row satisfies the request without counting matches:
+    /// every clause stops at the first hit of its terms (used when the relevance isn't needed)
+    ///
+    /// @param[in] row - row text
+    /// @return        - whether the row satisfies the request (as Evaluate())
+
+    bool Satisfies(IRowText& row) const;
+
+    /// Method of evaluating the plan on one column of the row: which clauses are found in the column
+    /// and the matches of the positive terms in it. The result of the row for any set of search
+    /// columns is combined from such parts (see SearchCore::RunByColumns())
+    ///
+    /// @param[in]  row            - row text
+    /// @param[in]  column         - column index
+    /// @param[in]  isSearchColumn - unscoped terms are searched in the column (otherwise only the terms scoped to it)
+    /// @param[out] clauses        - every clause: whether one of its terms is found in the column
+    /// @param[out] matches        - matches of the positive terms in the column (nullptr - they aren't counted)
+
+    void EvaluateColumn(IRowText& row, const int column, const bool isSearchColumn,
+                        std::vector<char>& clauses, Matches* const matches) const;
+
+    /// Method of checking whether every row that satisfies the plan satisfies the other one
+    /// (e.g. the word is typed further: "inv" -> "invoice", or a +word is added).
+    /// Terms are compared by their text, so the check may miss a refinement but never reports a wrong one
+    ///
+    /// @param[in] other - plan of the previous request
+    /// @return          - true if the rows of the plan are a subset of the rows of the other plan
+
+    bool Refines(const QueryPlan& other) const;
+
+    /// Method of checking whether every text that contains a term of the plan contains a term
+    /// of the clauses (e.g. "invoice" and "inv"), so in a column the plan can be found only where
+    /// the clauses are found. Terms are compared as in Refines()
+    ///
+    /// @param[in] clauses - clauses of the previous request
+
+    bool TermsWithin(const std::vector<QueryClause>& clauses) const;
+
+    /// Method of counting matches of the positive terms in the text of one column
+    ///
+    /// @param[in] text   - text in lower case
+    /// @param[in] column - column index
+    /// @return           - amount of matches
+
+    Matches Count(const std::string_view text, const int column) const;
+
+    /// Method of finding matches of the positive terms (not excluded ones) in the text.
+    /// Used for highlighting
+    ///
+    /// @param[in] text           - text in lower case
+    /// @param[in] column         - column index
+    /// @param[in] isSearchColumn - the column is searched by unscoped terms
+    /// @return                   - sorted non-overlapping matches
+
+    std::vector<MatchSpan> Spans(const std::string_view text, const int column, const bool isSearchColumn) const;
+
+    /// Method of checking whether the row contains the term
+    static bool Contains(const QueryTerm& term, IRowText& row);
+
+    /// Heuristic estimation of the term selectivity (by its length)
+    static double EstimateSelectivity(const QueryTerm& term) noexcept;
+
+   private:
+
+    // Positive (not excluded) term, the relevance is counted for
+    struct ScoredTerm
+    {
+      int  column { -1 };
+      bool scoped { false };
+      bool should { false };
+
+      std::shared_ptr<Regex> regex;
+
+      std::shared_ptr<const ValueCondition> condition;
+    };
+
+    // Pattern of the multi-pattern matcher
+    struct PatternRef
+    {
+      std::size_t term { 0 };       // Index in terms_
+      unsigned    length { 0 };
+      bool        variant { false }; // Keyboard layout variant of the term
+    };
+
+    // Total length of matches of a term in the current column
+    struct TermHits
+    {
+      unsigned length { 0 };
+      unsigned variantLength { 0 };
+    };
+
+    static bool TermInText(const QueryTerm& term, const std::string_view text);
+    static bool TermInColumn(const QueryTerm& term, IRowText& row, const int column);
+    static bool ValueInColumn(const ValueCondition& condition, IRowText& row, const int column);
+    static bool TermInStoredText(const QueryTerm& term, IRowText& row, const int column);
+    static bool ClauseHits(const QueryClause& clause, IRowText& row);
+
+    /// Method of checking whether every text that contains the term contains the other one
+    static bool TermRefines(const QueryTerm& term, const QueryTerm& other);
+
+    /// Method of preparing the positive terms and their variants for counting matches in one pass
+    void Compile();
+
+    /// Method of counting matches of all positive terms in the text of one column
+    ///
+    /// @param[in]  text           - text in lower case
+    /// @param[in]  column         - column index
+    /// @param[in]  isSearchColumn - the column is searched by unscoped terms
+    /// @param[out] anyShould      - set if a SHOULD term is found
+    /// @return                    - amount of matches
+
+    Matches CountInColumn(const std::string_view text, const int column, const bool isSearchColumn, bool& anyShould) const;
+
+    /// The same over the row text, compressed text is searched without decompressing if possible
+    Matches CountInRow(IRowText& row, const int column, const bool isSearchColumn, bool& anyShould) const;
+    Matches CountInStoredText(IRowText& row, const int column, const bool isSearchColumn, bool& anyShould) const;
+
+    /// Methods of counting the values of typed columns that satisfy the conditions
+    Matches CountValues(const std::string_view text, const int column, const bool isSearchColumn, bool& anyShould) const;
+    Matches CountValues(IRowText& row, const int column, const bool isSearchColumn, bool& anyShould) const;
+
+    /// Methods of counting matches into hits_
+    void CountPatterns(const std::string_view text, const int column, const bool isSearchColumn) const;
+    void CountRegexes(const std::string_view text, const int column, const bool isSearchColumn) const;
+
+    /// Method of converting hits_ to matches (hits_ are reset)
+    Matches TakeHits(bool& anyShould) const;
+
+    bool Applies(const ScoredTerm& term, const int column, const bool isSearchColumn) const noexcept;
+
+   private:
+
+    std::vector<QueryClause> clauses_;
+
+    bool hasMust_   { false };
+    bool hasShould_ { false };
+
+    std::vector<ScoredTerm> terms_;
+    std::vector<PatternRef> patterns_;      // By pattern id of matcher_
+    std::vector<int>        scopedColumns_; // Columns of the scoped positive terms
+
+    MultiPatternMatcher matcher_;
+
+    std::shared_ptr<const SymbolTable>              symbols_;
+    std::vector<std::shared_ptr<const CodeMatcher>> packed_;   // By pattern id (empty if some pattern isn't compiled)
+    bool                                            hasRegex_ { false };
+    bool                                            hasConditions_ { false };
+
+    bool hasUnscoped_ { false }; // Some positive term is searched in all search columns
+
+    mutable std::vector<TermHits>    hits_;    // Scratch space of CountInColumn()
+    mutable std::vector<std::size_t> lastEnd_;
+  };
+
+  /// Method of transposing the word typed in a wrong keyboard layout (QWERTY <-> JCUKEN, Windows-1251):
+  /// "ghbdtn" -> "привет", "руддщ" -> "hello"
+  ///
+  /// @param[in] word - word in lower case
+  /// @return         - variants that differ from the word
+
+  std::vector<std::string> LayoutVariants(const std::string& word);
+
+  /// Method of converting the string to lower case (according to the current locale)
+  void ToLower(std::string& text) noexcept;
+
+} // namespace searcher
+
+#endif
@@ -0,0 +1,1134 @@
+﻿#pragma hdrstop
+
+#include "src/SearchRegex.h"
+
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <cctype>
+#include <cstdint>
+#include <map>
+#include <stdexcept>
+#include <unordered_map>
+
+#pragma package(smart_init)
+
+namespace searcher {
+
+using CharSet = std::bitset<256>;
+
+namespace {
+
+constexpr int MAX_REPEAT     = 1000;  // Max. value of {n,m}
+constexpr int MAX_NFA_STATES = 20000;
+
+constexpr std::size_t MAX_DFA_STATES = 1024; // The cache is flushed when it's full
+
+// Node of the pattern syntax tree
+struct AstNode
+{
+  enum Kind { CHARS, EMPTY, CONCAT, ALTERNATE, REPEAT };
+
+  Kind kind { EMPTY };
+
+  CharSet          chars;
+  std::vector<int> children;
+
+  int min { 0 };
+  int max { 0 }; // -1 - unlimited
+};
+
+// A character matches the set if any of its cases is in the set
+CharSet CaseClosed(const CharSet& set)
+{
+  CharSet result = set;
+
+  for (int c = 0; c < 256; c++)
+  {
+    if (!set.test(c))
+      continue;
+
+    result.set(static_cast<unsigned char>(std::tolower(c)));
+    result.set(static_cast<unsigned char>(std::toupper(c)));
+  }
+
+  return result;
+}
+
+class Parser
+{
+ public:
+
+  explicit Parser(const std::string& pattern, std::vector<AstNode>& nodes)
+      : p_(pattern)
+      , nodes_(nodes)
+  {}
+
+  int Parse()
+  {
+    const int root = ParseAlternate();
+
+    if (pos_ < p_.length())
+      Error("Unmatched ')'");
+
+    return root;
+  }
+
+ private:
+
+  int Add(AstNode&& node)
+  {
+    nodes_.push_back(std::move(node));
+    return static_cast<int>(nodes_.size()) - 1;
+  }
+
+  int AddChars(const CharSet& set, const bool negate)
+  {
+    AstNode node;
+
+    node.kind  = AstNode::CHARS;
+    node.chars = CaseClosed(set);
+
+    if (negate)
+      node.chars.flip();
+
+    return Add(std::move(node));
+  }
+
+  [[noreturn]] void Error(const char* msg) const
+  {
+    throw std::invalid_argument(std::string(msg) + " (position " + std::to_string(pos_ + 1) + ")");
+  }
+
+  int ParseAlternate()
+  {
+    std::vector<int> alternatives { ParseConcat() };
+
+    while (pos_ < p_.length() && p_[pos_] == '|')
+    {
+      pos_++;
+      alternatives.push_back(ParseConcat());
+    }
+
+    if (alternatives.size() == 1)
+      return alternatives.front();
+
+    AstNode node;
+
+    node.kind     = AstNode::ALTERNATE;
+    node.children = std::move(alternatives);
+
+    return Add(std::move(node));
+  }
+
+  int ParseConcat()
+  {
+    std::vector<int> items;
+
+    while (pos_ < p_.length() && p_[pos_] != '|' && p_[pos_] != ')')
+      items.push_back(ParseRepeat());
+
+    if (items.size() == 1)
+      return items.front();
+
+    AstNode node;
+
+    node.kind     = items.empty() ? AstNode::EMPTY : AstNode::CONCAT;
+    node.children = std::move(items);
+
+    return Add(std::move(node));
+  }
+
+  int ParseRepeat()
+  {
+    int atom = ParseAtom();
+
+    while (pos_ < p_.length())
+    {
+      int min = 0,
+          max = 0;
+
+      const char c = p_[pos_];
+
+      if (c == '*')
+      {
+        min = 0; max = -1; pos_++;
+      }
+      else if (c == '+')
+      {
+        min = 1; max = -1; pos_++;
+      }
+      else if (c == '?')
+      {
+        min = 0; max = 1; pos_++;
+      }
+      else if (c != '{' || !ParseCount(min, max))
+      {
+        break;
+      }
+
+      // Lazy quantifiers make no difference for the leftmost-longest matching
+      if (pos_ < p_.length() && p_[pos_] == '?')
+        pos_++;
+
+      AstNode node;
+
+      node.kind     = AstNode::REPEAT;
+      node.children = { atom };
+      node.min      = min;
+      node.max      = max;
+
+      atom = Add(std::move(node));
+    }
+
+    return atom;
+  }
+
+  // {n}, {n,}, {n,m}. If the braces don't form a counter, '{' is a usual character
+  bool ParseCount(int& min, int& max)
+  {
+    std::size_t pos = pos_ + 1;
+
+    auto readNumber = [&](int& value)
+    {
+      const std::size_t start = pos;
+      value = 0;
+
+      while (pos < p_.length() && std::isdigit(static_cast<unsigned char>(p_[pos])))
+      {
+        value = std::min(value * 10 + (p_[pos] - '0'), MAX_REPEAT + 1);
+        pos++;
+      }
+
+      return (pos > start);
+    };
+
+    if (!readNumber(min))
+      return false;
+
+    max = min;
+
+    if (pos < p_.length() && p_[pos] == ',')
+    {
+      pos++;
+
+      if (!readNumber(max))
+        max = -1;
+    }
+
+    if (pos >= p_.length() || p_[pos] != '}')
+      return false;
+
+    if (min > MAX_REPEAT || max > MAX_REPEAT)
+      Error("Too big repetition count");
+
+    if (max != -1 && max < min)
+      Error("Invalid repetition range");
+
+    pos_ = pos + 1;
+    return true;
+  }
+
+  int ParseAtom()
+  {
+    const char c = p_[pos_++];
+
+    switch (c)
+    {
+      case '(':
+      {
+        if (p_.compare(pos_, 2, "?:") == 0)
+          pos_ += 2;
+
+        const int inner = ParseAlternate();
+
+        if (pos_ >= p_.length() || p_[pos_] != ')')
+          Error("Missing ')'");
+
+        pos_++;
+        return inner;
+      }
+
+      case '[':
+        return ParseClass();
+
+      case '.':
+      {
+        CharSet set;
+        set.set();
+        set.reset('\n');
+
+        return AddChars(set, false);
+      }
+
+      case '\\':
+      {
+        CharSet set;
+        const bool negate = ParseEscape(set);
+
+        return AddChars(set, negate);
+      }
+
+      case '*':
+      case '+':
+      case '?':
+        pos_--;
+        Error("Nothing to repeat");
+
+      case '^':
+      case '$':
+        pos_--;
+        Error("Anchors are supported only at the start and the end of the pattern");
+
+      default:
+      {
+        CharSet set;
+        set.set(static_cast<unsigned char>(c));
+
+        return AddChars(set, false);
+      }
+    }
+  }
+
+  // Escape sequence after '\'. Returns true if the set must be negated (\D, \W, \S)
+  bool ParseEscape(CharSet& set)
+  {
+    if (pos_ >= p_.length())
+      Error("Trailing '\\'");
+
+    const char c = p_[pos_++];
+
+    auto addIf = [&set](int (*predicate)(int))
+    {
+      for (int ch = 0; ch < 256; ch++)
+      {
+        if (predicate(ch))
+          set.set(ch);
+      }
+    };
+
+    switch (c)
+    {
+      case 'd': case 'D':
+        addIf([](int ch) { return std::isdigit(ch); });
+        return (c == 'D');
+
+      case 'w': case 'W':
+        addIf([](int ch) { return (std::isalnum(ch) || ch == '_') ? 1 : 0; });
+        return (c == 'W');
+
+      case 's': case 'S':
+        addIf([](int ch) { return std::isspace(ch); });
+        return (c == 'S');
+
+      case 't': set.set('\t'); return false;
+      case 'n': set.set('\n'); return false;
+      case 'r': set.set('\r'); return false;
+      case 'f': set.set('\f'); return false;
+      case 'v': set.set('\v'); return false;
+
+      case 'x':
+      {
+        int value = 0;
+
+        for (int i = 0; i < 2; i++, pos_++)
+        {
+          if (pos_ >= p_.length() || !std::isxdigit(static_cast<unsigned char>(p_[pos_])))
+            Error("Invalid '\\x' escape");
+
+          const char h = static_cast<char>(std::tolower(static_cast<unsigned char>(p_[pos_])));
+          value = value * 16 + (std::isdigit(static_cast<unsigned char>(h)) ? (h - '0') : (h - 'a' + 10));
+        }
+
+        set.set(value);
+        return false;
+      }
+
+      default:
+        if (std::isalnum(static_cast<unsigned char>(c)))
+        {
+          pos_--;
+          Error("Unsupported escape sequence");
+        }
+
+        set.set(static_cast<unsigned char>(c));
+        return false;
+    }
+  }
+
+  int ParseClass()
+  {
+    CharSet set;
+    bool negate = false;
+
+    if (pos_ < p_.length() && p_[pos_] == '^')
+    {
+      negate = true;
+      pos_++;
+    }
+
+    bool first = true;
+
+    while (true)
+    {
+      if (pos_ >= p_.length())
+        Error("Missing ']'");
+
+      if (p_[pos_] == ']' && !first)
+      {
+        pos_++;
+        break;
+      }
+
+      first = false;
+
+      // Single character (a possible start of a range) or a class escape
+      int from = static_cast<unsigned char>(p_[pos_++]);
+
+      if (from == '\\')
+      {
+        CharSet escaped;
+
+        // Negated class escapes inside of a class ([^\D]) are rare, so they're unsupported
+        if (ParseEscape(escaped))
+          Error("Negated class escapes inside of [] are unsupported");
+
+        if (escaped.count() != 1)
+        {
+          set |= escaped;
+          continue;
+        }
+
+        for (int ch = 0; ch < 256; ch++)
+        {
+          if (escaped.test(ch))
+            from = ch;
+        }
+      }
+
+      if (pos_ + 1 < p_.length() && p_[pos_] == '-' && p_[pos_ + 1] != ']')
+      {
+        pos_++;
+
+        int to = static_cast<unsigned char>(p_[pos_++]);
+
+        if (to == '\\')
+        {
+          CharSet escaped;
+
+          if (ParseEscape(escaped) || escaped.count() != 1)
+            Error("Invalid range in []");
+
+          for (int ch = 0; ch < 256; ch++)
+          {
+            if (escaped.test(ch))
+              to = ch;
+          }
+        }
+
+        if (to < from)
+          Error("Invalid range in []");
+
+        for (int ch = from; ch <= to; ch++)
+          set.set(ch);
+      }
+      else
+      {
+        set.set(from);
+      }
+    }
+
+    return AddChars(set, negate);
+  }
+
+ private:
+
+  const std::string&    p_;
+  std::size_t           pos_ { 0 };
+  std::vector<AstNode>& nodes_;
+};
+
+// Literal information of a subpattern
+struct LiteralInfo
+{
+  bool        exact { false }; // The subpattern matches only the 'text'
+  std::string text;
+  std::string required;        // Any match of the subpattern contains it
+};
+
+const std::string& Longest(const std::string& lhs, const std::string& rhs)
+{
+  return (rhs.length() > lhs.length()) ? rhs : lhs;
+}
+
+LiteralInfo ExtractLiterals(const std::vector<AstNode>& ast, const int index)
+{
+  constexpr std::size_t MAX_LITERAL_LEN = 64;
+
+  const AstNode& node = ast[index];
+  LiteralInfo info;
+
+  switch (node.kind)
+  {
+    case AstNode::EMPTY:
+      info.exact = true;
+      break;
+
+    case AstNode::CHARS:
+    {
+      // The text is in lower case, so only lower case characters are taken into account
+      int lower = -1,
+          count = 0;
+
+      for (int ch = 0; ch < 256; ch++)
+      {
+        if (node.chars.test(ch) && std::tolower(ch) == ch)
+        {
+          lower = ch;
+          count++;
+        }
+      }
+
+      if (count == 1)
+      {
+        info.exact    = true;
+        info.text     = std::string(1, static_cast<char>(lower));
+        info.required = info.text;
+      }
+      break;
+    }
+
+    case AstNode::CONCAT:
+    {
+      std::string run;
+      info.exact = true;
+
+      for (const auto child : node.children)
+      {
+        const LiteralInfo ci = ExtractLiterals(ast, child);
+
+        if (ci.exact)
+        {
+          run += ci.text;
+          info.text += ci.text;
+        }
+        else
+        {
+          info.exact    = false;
+          info.required = Longest(Longest(info.required, run), ci.required);
+          run.clear();
+        }
+      }
+
+      info.required = Longest(info.required, run);
+
+      if (!info.exact)
+        info.text.clear();
+      break;
+    }
+
+    case AstNode::ALTERNATE:
+    {
+      std::vector<LiteralInfo> alternatives;
+
+      for (const auto child : node.children)
+        alternatives.push_back(ExtractLiterals(ast, child));
+
+      const bool sameExact = std::all_of(alternatives.begin(), alternatives.end(), [&](const LiteralInfo& a)
+      {
+        return a.exact && a.text == alternatives.front().text;
+      });
+
+      const bool sameRequired = std::all_of(alternatives.begin(), alternatives.end(), [&](const LiteralInfo& a)
+      {
+        return a.required == alternatives.front().required;
+      });
+
+      if (sameExact)
+        info = alternatives.front();
+      else if (sameRequired)
+        info.required = alternatives.front().required;
+      break;
+    }
+
+    case AstNode::REPEAT:
+    {
+      if (node.max == 0)
+      {
+        info.exact = true;
+        break;
+      }
+
+      if (node.min == 0)
+        break;
+
+      const LiteralInfo ci = ExtractLiterals(ast, node.children.front());
+
+      info.required = ci.required;
+
+      if (ci.exact)
+      {
+        std::string repeated;
+
+        for (int i = 0; i < node.min && repeated.length() < MAX_LITERAL_LEN; i++)
+          repeated += ci.text;
+
+        info.required = Longest(info.required, repeated);
+
+        if (node.min == node.max && repeated.length() == ci.text.length() * node.min)
+        {
+          info.exact = true;
+          info.text  = repeated;
+        }
+      }
+      break;
+    }
+  }
+
+  if (info.required.length() > MAX_LITERAL_LEN)
+    info.required.resize(MAX_LITERAL_LEN);
+
+  return info;
+}
+
+} // namespace
+
+// Thompson NFA
+struct Regex::Nfa
+{
+  struct State
+  {
+    enum Type { CHARS, SPLIT, MATCH };
+
+    Type    type { SPLIT };
+    CharSet chars;
+    int     out  { -1 };
+    int     out1 { -1 };
+  };
+
+  // Fragment of the automaton with dangling exits (state, 0 - out / 1 - out1)
+  struct Fragment
+  {
+    int start { -1 };
+    std::vector<std::pair<int, int>> outs;
+  };
+
+  std::vector<State> states;
+  int start { -1 };
+
+  // @param reverse - build the automaton of the reversed pattern
+  void Build(const std::vector<AstNode>& ast, const int root, const bool reverse)
+  {
+    Fragment fragment = BuildNode(ast, root, reverse);
+
+    State match;
+    match.type = State::MATCH;
+
+    Patch(fragment.outs, AddState(std::move(match)));
+    start = fragment.start;
+  }
+
+  int AddState(State&& state)
+  {
+    if (states.size() >= static_cast<std::size_t>(MAX_NFA_STATES))
+      throw std::invalid_argument("The regular expression is too complex");
+
+    states.push_back(std::move(state));
+    return static_cast<int>(states.size()) - 1;
+  }
+
+  void Patch(const std::vector<std::pair<int, int>>& outs, const int target)
+  {
+    for (const auto& out : outs)
+      (out.second == 0 ? states[out.first].out : states[out.first].out1) = target;
+  }
+
+  Fragment Epsilon()
+  {
+    const int s = AddState(State());
+    return Fragment { s, { { s, 0 } } };
+  }
+
+  Fragment Star(Fragment fragment)
+  {
+    State split;
+    split.out = fragment.start;
+
+    const int s = AddState(std::move(split));
+    Patch(fragment.outs, s);
+
+    return Fragment { s, { { s, 1 } } };
+  }
+
+  Fragment Optional(Fragment fragment)
+  {
+    State split;
+    split.out = fragment.start;
+
+    const int s = AddState(std::move(split));
+    fragment.outs.emplace_back(s, 1);
+
+    return Fragment { s, std::move(fragment.outs) };
+  }
+
+  Fragment Concat(std::vector<Fragment>& pieces)
+  {
+    if (pieces.empty())
+      return Epsilon();
+
+    for (std::size_t i = 1; i < pieces.size(); i++)
+      Patch(pieces[i - 1].outs, pieces[i].start);
+
+    return Fragment { pieces.front().start, std::move(pieces.back().outs) };
+  }
+
+  Fragment BuildNode(const std::vector<AstNode>& ast, const int index, const bool reverse)
+  {
+    const AstNode& node = ast[index];
+
+    switch (node.kind)
+    {
+      case AstNode::CHARS:
+      {
+        State state;
+
+        state.type  = State::CHARS;
+        state.chars = node.chars;
+
+        const int s = AddState(std::move(state));
+        return Fragment { s, { { s, 0 } } };
+      }
+
+      case AstNode::CONCAT:
+      {
+        std::vector<Fragment> pieces;
+
+        for (std::size_t i = 0; i < node.children.size(); i++)
+        {
+          const int child = reverse ? node.children[node.children.size() - 1 - i] : node.children[i];
+          pieces.push_back(BuildNode(ast, child, reverse));
+        }
+
+        return Concat(pieces);
+      }
+
+      case AstNode::ALTERNATE:
+      {
+        Fragment result = BuildNode(ast, node.children.front(), reverse);
+
+        for (std::size_t i = 1; i < node.children.size(); i++)
+        {
+          Fragment alternative = BuildNode(ast, node.children[i], reverse);
+
+          State split;
+
+          split.out  = result.start;
+          split.out1 = alternative.start;
+
+          result.start = AddState(std::move(split));
+          result.outs.insert(result.outs.end(), alternative.outs.begin(), alternative.outs.end());
+        }
+
+        return result;
+      }
+
+      case AstNode::REPEAT:
+      {
+        // x{2,4} -> x x x? x?,  x{2,} -> x x x*
+        std::vector<Fragment> pieces;
+
+        for (int i = 0; i < node.min; i++)
+          pieces.push_back(BuildNode(ast, node.children.front(), reverse));
+
+        if (node.max == -1)
+        {
+          pieces.push_back(Star(BuildNode(ast, node.children.front(), reverse)));
+        }
+        else
+        {
+          for (int i = node.min; i < node.max; i++)
+            pieces.push_back(Optional(BuildNode(ast, node.children.front(), reverse)));
+        }
+
+        return Concat(pieces);
+      }
+
+      case AstNode::EMPTY:
+      default:
+        return Epsilon();
+    }
+  }
+};
+
+// DFA which states (sets of NFA states) are built on demand while matching
+class Regex::LazyDfa
+{
+ public:
+
+  // @param unanchored - a match can start at any position of the text
+  explicit LazyDfa(const Nfa& nfa, const bool unanchored)
+      : nfa_(nfa)
+      , unanchored_(unanchored)
+      , marks_(nfa.states.size(), 0)
+  {
+    startSet_ = Closure({ nfa_.start });
+  }
+
+  int Start()
+  {
+    if (start_ < 0)
+      start_ = Intern(std::vector<int>(startSet_));
+
+    return start_;
+  }
+
+  int Next(const int state, const unsigned char c)
+  {
+    const int known = next_[state][c];
+
+    if (known >= 0)
+      return known;
+
+    std::vector<int> seeds;
+
+    for (const auto s : sets_[state])
+    {
+      const Nfa::State& nfaState = nfa_.states[s];
+
+      if (nfaState.type == Nfa::State::CHARS && nfaState.chars.test(c))
+        seeds.push_back(nfaState.out);
+    }
+
+    std::vector<int> set = Closure(seeds);
+
+    if (unanchored_)
+    {
+      set.insert(set.end(), startSet_.begin(), startSet_.end());
+      std::sort(set.begin(), set.end());
+      set.erase(std::unique(set.begin(), set.end()), set.end());
+    }
+
+    // The memory is bounded: the cache is dropped and built again
+    if (sets_.size() >= MAX_DFA_STATES)
+    {
+      Flush();
+      return Intern(std::move(set));
+    }
+
+    const int id = Intern(std::move(set));
+    next_[state][c] = id;
+
+    return id;
+  }
+
+  bool IsMatch(const int state) const noexcept
+  {
+    return match_[state];
+  }
+
+  bool IsDead(const int state) const noexcept
+  {
+    return sets_[state].empty();
+  }
+
+  /// Amount of the times the cache was dropped (the states are numbered anew after that)
+  unsigned Flushes() const noexcept
+  {
+    return flushes_;
+  }
+
+ private:
+
+  // Sorted CHARS and MATCH states reachable from the seeds by epsilon moves
+  std::vector<int> Closure(const std::vector<int>& seeds)
+  {
+    generation_++;
+
+    std::vector<int> result,
+                     stack(seeds);
+
+    while (!stack.empty())
+    {
+      const int s = stack.back();
+      stack.pop_back();
+
+      if (s < 0 || marks_[s] == generation_)
+        continue;
+
+      marks_[s] = generation_;
+
+      const Nfa::State& state = nfa_.states[s];
+
+      if (state.type == Nfa::State::SPLIT)
+      {
+        stack.push_back(state.out1);
+        stack.push_back(state.out);
+      }
+      else
+      {
+        result.push_back(s);
+      }
+    }
+
+    std::sort(result.begin(), result.end());
+    return result;
+  }
+
+  int Intern(std::vector<int>&& set)
+  {
+    auto it = ids_.find(set);
+
+    if (it != ids_.end())
+      return it->second;
+
+    const int id = static_cast<int>(sets_.size());
+
+    const bool isMatch = std::any_of(set.begin(), set.end(), [this](const int s)
+    {
+      return nfa_.states[s].type == Nfa::State::MATCH;
+    });
+
+    std::array<int, 256> transitions;
+    transitions.fill(-1);
+
+    ids_.emplace(set, id);
+    sets_.push_back(std::move(set));
+    next_.push_back(transitions);
+    match_.push_back(isMatch);
+
+    return id;
+  }
+
+  void Flush()
+  {
+    ids_.clear();
+    sets_.clear();
+    next_.clear();
+    match_.clear();
+
+    start_ = -1;
+    flushes_++;
+  }
+
+ private:
+
+  const Nfa& nfa_;
+  const bool unanchored_;
+
+  std::vector<int> startSet_;
+  int start_ { -1 };
+
+  std::map<std::vector<int>, int>   ids_;
+  std::vector<std::vector<int>>     sets_;
+  std::vector<std::array<int, 256>> next_;
+  std::vector<char>                 match_;
+
+  std::vector<unsigned> marks_;
+  unsigned generation_ { 0 };
+
+  unsigned flushes_ { 0 };
+};
+
+Regex::Regex(const std::string& pattern)
+    : pattern_(pattern)
+{
+  std::string body = pattern;
+
+  if (!body.empty() && body.front() == '^')
+  {
+    anchoredStart_ = true;
+    body.erase(0, 1);
+  }
+
+  if (!body.empty() && body.back() == '$')
+  {
+    // '\$' is a usual character
+    std::size_t slashes = 0;
+
+    while (slashes + 1 < body.length() && body[body.length() - 2 - slashes] == '\\')
+      slashes++;
+
+    if (slashes % 2 == 0)
+    {
+      anchoredEnd_ = true;
+      body.pop_back();
+    }
+  }
+
+  std::vector<AstNode> ast;
+  Parser parser(body, ast);
+
+  const int root = parser.Parse();
+
+  literal_ = ExtractLiterals(ast, root).required;
+
+  forwardNfa_ = std::make_unique<Nfa>();
+  forwardNfa_->Build(ast, root, false);
+
+  reverseNfa_ = std::make_unique<Nfa>();
+  reverseNfa_->Build(ast, root, true);
+
+  searchDfa_  = std::make_unique<LazyDfa>(*forwardNfa_, !anchoredStart_);
+  longestDfa_ = std::make_unique<LazyDfa>(*forwardNfa_, false);
+  reverseDfa_ = std::make_unique<LazyDfa>(*reverseNfa_, !anchoredEnd_);
+}
+
+Regex::~Regex() = default;
+
+const std::string& Regex::Pattern() const noexcept
+{
+  return pattern_;
+}
+
+const std::string& Regex::RequiredLiteral() const noexcept
+{
+  return literal_;
+}
+
+bool Regex::IsMatch(const std::string_view text) const
+{
+  if (!literal_.empty() && text.find(literal_) == std::string_view::npos)
+    return false;
+
+  LazyDfa& dfa = *searchDfa_;
+  int state = dfa.Start();
+
+  if (!anchoredEnd_ && dfa.IsMatch(state))
+    return true;
+
+  for (const char c : text)
+  {
+    state = dfa.Next(state, static_cast<unsigned char>(c));
+
+    if (dfa.IsDead(state))
+      return false;
+
+    if (!anchoredEnd_ && dfa.IsMatch(state))
+      return true;
+  }
+
+  return dfa.IsMatch(state);
+}
+
+std::vector<MatchSpan> Regex::FindAll(const std::string_view text) const
+{
+  std::vector<MatchSpan> spans;
+
+  if (!literal_.empty() && text.find(literal_) == std::string_view::npos)
+    return spans;
+
+  const std::size_t n = text.length();
+
+  // 1) The backward pass marks positions where some match starts
+  std::vector<char> starts(n + 1, 0);
+
+  LazyDfa& reverse = *reverseDfa_;
+  int state = reverse.Start();
+
+  starts[n] = reverse.IsMatch(state);
+
+  for (std::size_t i = n; i-- > 0; )
+  {
+    state = reverse.Next(state, static_cast<unsigned char>(text[i]));
+
+    if (reverse.IsDead(state))
+      break;
+
+    starts[i] = reverse.IsMatch(state);
+  }
+
+  // 2) The forward anchored pass from the leftmost start finds the longest match,
+  //    the next match is searched after its end. The pass is deterministic, so a pass that
+  //    reaches the state an earlier pass had at the same position continues as that one did:
+  //    it stops and takes the last match end of that pass. Every state is met at a position
+  //    once, so the text is scanned at most once per state of the DFA (not once per match)
+
+  LazyDfa& longest = *longestDfa_;
+
+  std::unordered_map<std::uint64_t, std::size_t> lastEnds; // (position, state) -> last match end after it (npos - none)
+  std::vector<std::pair<std::size_t, int>>        trail;    // (position, state) of the current pass
+
+  unsigned flushes = longest.Flushes();
+
+  auto key = [](const std::size_t i, const int state)
+  {
+    return (static_cast<std::uint64_t>(i) << 32) | static_cast<std::uint32_t>(state);
+  };
+
+  std::size_t pos = 0;
+
+  while (pos < n && !(anchoredStart_ && pos > 0))
+  {
+    if (!starts[pos])
+    {
+      pos++;
+      continue;
+    }
+
+    std::size_t end = std::string::npos;
+    state = longest.Start();
+
+    trail.clear();
+
+    for (std::size_t i = pos; ; )
+    {
+      // The states are numbered anew after the cache of the DFA is dropped
+      if (longest.Flushes() != flushes)
+      {
+        flushes = longest.Flushes();
+
+        lastEnds.clear();
+        trail.clear();
+      }
+
+      if (!lastEnds.empty())
+      {
+        const auto known = lastEnds.find(key(i, state));
+
+        if (known != lastEnds.end())
+        {
+          if (known->second != std::string::npos)
+            end = known->second;
+
+          break;
+        }
+      }
+
+      trail.emplace_back(i, state);
+
+      if (longest.IsMatch(state) && (!anchoredEnd_ || i == n))
+        end = i;
+
+      if (i == n)
+        break;
+
+      state = longest.Next(state, static_cast<unsigned char>(text[i++]));
+
+      if (longest.IsDead(state))
+        break;
+    }
+
+    const bool isFound = (end != std::string::npos && end > pos); // Otherwise only an empty match starts here
+
+    if (isFound)
+      spans.emplace_back(pos, end - pos);
+
+    // The next pass starts at the next marked position after the end of the match,
+    // so only the rest of this pass from there is kept
+
+    const std::size_t next = isFound ? end : pos + 1;
+    const std::size_t nextStart = std::find(starts.begin() + next, starts.end() - 1, 1) - starts.begin();
+
+    for (const auto& step : trail)
+    {
+      if (step.first >= nextStart)
+        lastEnds.emplace(key(step.first, step.second), (end != std::string::npos && end >= step.first) ? end : std::string::npos);
+    }
+
+    pos = next;
+  }
+
+  return spans;
+}
+
+} // namespace searcher
@@ -0,0 +1,82 @@
+﻿#ifndef SearchRegexH
+#define SearchRegexH
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+
+namespace searcher
+{
+  // Position of a match in the text
+  struct MatchSpan
+  {
+    std::size_t pos    { 0 };
+    std::size_t length { 0 };
+
+    MatchSpan() = default;
+
+    explicit MatchSpan(const std::size_t a_pos, const std::size_t a_length)
+        : pos(a_pos)
+        , length(a_length)
+    {}
+  };
+
+  // Case-insensitive regular expression that is matched by lazily built DFAs,
+  // so the matching time is linear to the text length (no backtracking).
+  //
+  // Supported syntax: literals, '.', [classes], \d \D \w \W \s \S, escapes,
+  // groups (...) and (?:...), alternation '|', quantifiers * + ? {n} {n,} {n,m},
+  // anchors ^ and $ (at the start and the end of the pattern only).
+  //
+  // The text must be in lower case (the pattern is case folded instead).
+  // An object is not thread-safe: DFAs are built while matching
+
+  class Regex final
+  {
+   public:
+
+    /// @param[in] pattern - regular expression
+    /// @throw std::invalid_argument - invalid or too complex pattern
+
+    explicit Regex(const std::string& pattern);
+    ~Regex();
+
+    Regex(const Regex&) = delete;
+    Regex& operator=(const Regex&) = delete;
+
+    /// Method of checking whether the text contains a match (single pass)
+    bool IsMatch(const std::string_view text) const;
+
+    /// Method of finding all non-overlapping leftmost-longest non-empty matches.
+    /// Every position of the text is scanned at most once per state of the DFA (not once per match)
+    std::vector<MatchSpan> FindAll(const std::string_view text) const;
+
+    const std::string& Pattern() const noexcept;
+
+    /// Literal that any match contains (empty if there is no such literal).
+    /// Texts without the literal are rejected by the substring search without running DFAs
+    const std::string& RequiredLiteral() const noexcept;
+
+   private:
+
+    struct Nfa;
+    class  LazyDfa;
+
+    std::string pattern_;
+    std::string literal_;
+
+    bool anchoredStart_ { false };
+    bool anchoredEnd_   { false };
+
+    std::unique_ptr<Nfa> forwardNfa_;
+    std::unique_ptr<Nfa> reverseNfa_;
+
+    std::unique_ptr<LazyDfa> searchDfa_;  // Forward, finds out whether there is a match
+    std::unique_ptr<LazyDfa> longestDfa_; // Forward anchored, finds the end of the longest match
+    std::unique_ptr<LazyDfa> reverseDfa_; // Backward, finds positions where matches start
+  };
+
+} // namespace searcher
+
+#endif
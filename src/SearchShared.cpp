@@ -0,0 +1,201 @@
+﻿#pragma hdrstop
+
+#include "src/SearchShared.h"
+
+#include <stdexcept>
+
+#ifdef _WIN32
+  #include <windows.h>
+#else
+  #include <cerrno>
+  #include <cstring>
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
+#pragma package(smart_init)
+
+namespace searcher {
+
+namespace {
+
+#ifndef _WIN32
+
+/// Name of the POSIX shared memory object ("/name")
+std::string ObjectName(const std::string& name)
+{
+  return (!name.empty() && name[0] == '/') ? name : "/" + name;
+}
+
+[[noreturn]] void ThrowError(const std::string& action, const std::string& name)
+{
+  throw std::runtime_error("Can't " + action + " shared memory \"" + name + "\": " + std::strerror(errno));
+}
+
+#else
+
+[[noreturn]] void ThrowError(const std::string& action, const std::string& name)
+{
+  const DWORD error = GetLastError();
+  throw std::runtime_error("Can't " + action + " shared memory \"" + name + "\": error " + std::to_string(error));
+}
+
+#endif
+
+} // namespace
+
+std::shared_ptr<SharedMemory> SharedMemory::Create(const std::string& name, const std::size_t size, const bool replace)
+{
+  std::shared_ptr<SharedMemory> memory(new SharedMemory());
+
+#ifdef _WIN32
+  const unsigned long long size64 = size;
+
+  memory->handle_ = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+                                       static_cast<DWORD>(size64 >> 32), static_cast<DWORD>(size64), name.c_str());
+
+  if (!memory->handle_)
+    ThrowError("create", name);
+
+  // A mapping of a process that is still running can't be replaced
+  if (GetLastError() == ERROR_ALREADY_EXISTS)
+  {
+    if (!replace)
+      return nullptr;
+
+    ThrowError("create", name);
+  }
+
+  memory->data_ = MapViewOfFile(memory->handle_, FILE_MAP_WRITE, 0, 0, size);
+
+  if (!memory->data_)
+    ThrowError("map", name);
+#else
+  const std::string objectName = ObjectName(name);
+
+  if (replace)
+    shm_unlink(objectName.c_str());
+
+  const int fd = shm_open(objectName.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+
+  if (fd < 0)
+  {
+    if (!replace && errno == EEXIST)
+      return nullptr;
+
+    ThrowError("create", name);
+  }
+
+  if (ftruncate(fd, static_cast<off_t>(size)) != 0)
+  {
+    const int error = errno;
+
+    close(fd);
+    shm_unlink(objectName.c_str());
+
+    errno = error;
+    ThrowError("allocate", name);
+  }
+
+  void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (data == MAP_FAILED)
+  {
+    shm_unlink(objectName.c_str());
+    ThrowError("map", name);
+  }
+
+  memory->data_ = data;
+#endif
+
+  memory->size_ = size;
+
+  return memory;
+}
+
+std::shared_ptr<SharedMemory> SharedMemory::Open(const std::string& name, const bool writable)
+{
+  std::shared_ptr<SharedMemory> memory(new SharedMemory());
+
+#ifdef _WIN32
+  memory->handle_ = OpenFileMappingA(writable ? FILE_MAP_WRITE : FILE_MAP_READ, FALSE, name.c_str());
+
+  if (!memory->handle_)
+    ThrowError("open", name);
+
+  memory->data_ = MapViewOfFile(memory->handle_, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0);
+
+  if (!memory->data_)
+    ThrowError("map", name);
+
+  // The size of the view is rounded up to pages: the content itself tells its size
+  MEMORY_BASIC_INFORMATION info {};
+  VirtualQuery(memory->data_, &info, sizeof(info));
+
+  memory->size_ = info.RegionSize;
+#else
+  const int fd = shm_open(ObjectName(name).c_str(), writable ? O_RDWR : O_RDONLY, 0);
+
+  if (fd < 0)
+    ThrowError("open", name);
+
+  struct stat info {};
+
+  if (fstat(fd, &info) != 0 || info.st_size <= 0)
+  {
+    close(fd);
+    ThrowError("open", name);
+  }
+
+  const std::size_t size = static_cast<std::size_t>(info.st_size);
+  void* data = mmap(nullptr, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+
+  close(fd);
+
+  if (data == MAP_FAILED)
+    ThrowError("map", name);
+
+  memory->data_ = data;
+  memory->size_ = size;
+#endif
+
+  return memory;
+}
+
+void SharedMemory::Remove(const std::string& name) noexcept
+{
+#ifdef _WIN32
+  static_cast<void>(name);
+#else
+  shm_unlink(ObjectName(name).c_str());
+#endif
+}
+
+SharedMemory::~SharedMemory()
+{
+#ifdef _WIN32
+  if (data_)
+    UnmapViewOfFile(data_);
+
+  if (handle_)
+    CloseHandle(handle_);
+#else
+  if (data_)
+    munmap(data_, size_);
+#endif
+}
+
+void* SharedMemory::Data() const noexcept
+{
+  return data_;
+}
+
+std::size_t SharedMemory::Size() const noexcept
+{
+  return size_;
+}
+
+} // namespace searcher
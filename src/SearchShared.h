@@ -0,0 +1,100 @@
+﻿#ifndef SearchSharedH
+#define SearchSharedH
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace searcher
+{
+  // Read-only view of an array owned by someone else: a vector of the owner
+  // or a section of a shared memory segment. The owner must outlive the view
+
+  template <typename T>
+  class ArrayView
+  {
+   public:
+
+    ArrayView() noexcept = default;
+
+    ArrayView(const T* data, const std::size_t size) noexcept
+        : data_(data)
+        , size_(size)
+    {}
+
+    ArrayView(const std::vector<T>& values) noexcept
+        : data_(values.data())
+        , size_(values.size())
+    {}
+
+    const T* data()  const noexcept { return data_; }
+    const T* begin() const noexcept { return data_; }
+    const T* end()   const noexcept { return data_ + size_; }
+
+    std::size_t size()  const noexcept { return size_; }
+    bool        empty() const noexcept { return size_ == 0; }
+
+    const T& operator[](const std::size_t i) const noexcept { return data_[i]; }
+
+   private:
+
+    const T*    data_ { nullptr };
+    std::size_t size_ { 0 };
+  };
+
+  // Named segment of memory shared between processes of the machine:
+  // POSIX shared memory object or a file mapping backed by the paging file on Windows.
+  // The segment is unmapped when the object is destroyed
+
+  class SharedMemory final
+  {
+   public:
+
+    /// Method of creating a segment (mapped for writing).
+    /// A segment with the same name left by another process is replaced
+    ///
+    /// @param[in] name    - name of the segment (on Windows "Global\\" prefix makes it visible to all sessions)
+    /// @param[in] size    - size of the segment (bytes)
+    /// @param[in] replace - replace the segment with the same name (otherwise nullptr is returned if it exists)
+    /// @throw std::runtime_error
+
+    static std::shared_ptr<SharedMemory> Create(const std::string& name, const std::size_t size, const bool replace = true);
+
+    /// Method of opening an existing segment
+    ///
+    /// @param[in] name     - name of the segment
+    /// @param[in] writable - map the segment for writing (otherwise it's read-only)
+    /// @throw std::runtime_error - there is no such segment
+
+    static std::shared_ptr<SharedMemory> Open(const std::string& name, const bool writable);
+
+    /// Method of removing the name of the segment: processes that mapped it keep using it,
+    /// the memory is freed when the last of them unmaps it (on Windows it's always so)
+    static void Remove(const std::string& name) noexcept;
+
+    ~SharedMemory();
+
+    SharedMemory(const SharedMemory&) = delete;
+    SharedMemory& operator=(const SharedMemory&) = delete;
+
+    void*       Data() const noexcept;
+    std::size_t Size() const noexcept;
+
+   private:
+
+    SharedMemory() = default;
+
+   private:
+
+    void*       data_ { nullptr };
+    std::size_t size_ { 0 };
+
+#ifdef _WIN32
+    void* handle_ { nullptr }; // Handle of the file mapping
+#endif
+  };
+
+} // namespace searcher
+
+#endif
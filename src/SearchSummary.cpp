@@ -0,0 +1,343 @@
+﻿#pragma hdrstop
+
+#include "src/SearchSummary.h"
+#include "src/SearchCore.h"
+#include "src/SearchQuery.h"
+
+#include <algorithm>
+
+#pragma package(smart_init)
+
+namespace searcher {
+
+namespace {
+
+constexpr unsigned MIN_BITS_LOG = 9;  // 512 bits
+constexpr unsigned MAX_BITS_LOG = 14; // 16 Kbit
+
+constexpr unsigned BITS_PER_TRIGRAM = 8;
+
+// Share of set bits after which a filter rejects almost nothing
+constexpr double MAX_FILL = 0.5;
+
+inline std::uint64_t TrigramHash(const char* p) noexcept
+{
+  const std::uint64_t trigram = static_cast<unsigned char>(p[0]) |
+                                (static_cast<unsigned char>(p[1]) << 8) |
+                                (static_cast<unsigned char>(p[2]) << 16);
+
+  return (trigram + 1) * 0x9E3779B97F4A7C15ull;
+}
+
+unsigned PopCount(std::uint64_t value) noexcept
+{
+  unsigned count = 0;
+
+  for (; value; count++)
+    value &= value - 1;
+
+  return count;
+}
+
+} // namespace
+
+SummaryProbe::SummaryProbe(const QueryPlan& plan, const SubtreeSummaries& summaries)
+{
+  if (summaries.FilterWords() == 0)
+    return;
+
+  // Alternatives of the clause (including keyboard layout variants of the terms).
+  // Returns false if some alternative may be anywhere: a regular expression
+  // without a literal, a term shorter than a trigram or a condition on values
+
+  auto clauseBits = [&summaries](const QueryClause& clause, Clause& alternatives)
+  {
+    for (const auto& term : clause.terms)
+    {
+      if (term.condition)
+        return false;
+
+      const std::string& text = term.regex ? term.regex->RequiredLiteral() : term.text;
+
+      if (text.length() < 3)
+        return false;
+
+      alternatives.emplace_back();
+      summaries.TextBits(text, alternatives.back().words, alternatives.back().masks);
+
+      for (const auto& variant : term.variants)
+      {
+        alternatives.emplace_back();
+        summaries.TextBits(variant, alternatives.back().words, alternatives.back().masks);
+      }
+    }
+
+    return true;
+  };
+
+  bool hasMust       = false,
+       shouldAnywhere = false;
+
+  for (const auto& clause : plan.Clauses())
+  {
+    Clause alternatives;
+
+    switch (clause.occur)
+    {
+      case TermOccur::MUST:
+        hasMust = true;
+
+        if (clauseBits(clause, alternatives))
+          must_.push_back(std::move(alternatives));
+        break;
+
+      case TermOccur::SHOULD:
+        if (!shouldAnywhere && clauseBits(clause, alternatives))
+          should_.push_back(std::move(alternatives));
+        else
+          shouldAnywhere = true;
+        break;
+
+      case TermOccur::MUST_NOT:
+        // Exclusions can't be checked by a summary
+        break;
+    }
+  }
+
+  // SHOULD clauses restrict rows only if there are no MUST ones
+  if (hasMust || shouldAnywhere)
+    should_.clear();
+
+  empty_ = must_.empty() && should_.empty();
+}
+
+bool SummaryProbe::Empty() const noexcept
+{
+  return empty_;
+}
+
+void SubtreeSummaries::Clear() noexcept
+{
+  bitsLog_ = 0;
+
+  std::vector<std::int32_t>().swap(index_);
+  std::vector<std::uint64_t>().swap(filters_);
+
+  indexView_   = ArrayView<std::int32_t>();
+  filtersView_ = ArrayView<std::uint64_t>();
+}
+
+void SubtreeSummaries::Bind(const unsigned bitsLog, const ArrayView<std::int32_t> index, const ArrayView<std::uint64_t> filters) noexcept
+{
+  bitsLog_     = bitsLog;
+  indexView_   = index;
+  filtersView_ = filters;
+}
+
+unsigned SubtreeSummaries::BitsLog() const noexcept
+{
+  return bitsLog_;
+}
+
+ArrayView<std::int32_t> SubtreeSummaries::Index() const noexcept
+{
+  return indexView_;
+}
+
+ArrayView<std::uint64_t> SubtreeSummaries::Filters() const noexcept
+{
+  return filtersView_;
+}
+
+std::size_t SubtreeSummaries::FilterWords() const noexcept
+{
+  return bitsLog_ ? (std::size_t(1) << bitsLog_) / 64 : 0;
+}
+
+std::size_t SubtreeSummaries::MemoryUsage() const noexcept
+{
+  return indexView_.size() * sizeof(std::int32_t) + filtersView_.size() * sizeof(std::uint64_t);
+}
+
+void SubtreeSummaries::AddText(std::uint64_t* filter, const std::string_view text) const noexcept
+{
+  const unsigned shift = 64 - bitsLog_;
+
+  for (std::size_t i = 0; i + 3 <= text.length(); i++)
+  {
+    const std::uint64_t hash = TrigramHash(text.data() + i);
+
+    // Two bits per trigram: the high bits of the hash and of its rotation
+    const std::uint64_t bit1 = hash >> shift;
+    const std::uint64_t bit2 = ((hash << 32) | (hash >> 32)) >> shift;
+
+    filter[bit1 >> 6] |= std::uint64_t(1) << (bit1 & 63);
+    filter[bit2 >> 6] |= std::uint64_t(1) << (bit2 & 63);
+  }
+}
+
+void SubtreeSummaries::TextBits(const std::string_view text, std::vector<std::uint32_t>& words, std::vector<std::uint64_t>& masks) const
+{
+  std::vector<std::uint64_t> filter(FilterWords(), 0);
+
+  if (filter.empty())
+    return;
+
+  AddText(filter.data(), text);
+
+  for (std::size_t i = 0; i < filter.size(); i++)
+  {
+    if (filter[i])
+    {
+      words.push_back(static_cast<std::uint32_t>(i));
+      masks.push_back(filter[i]);
+    }
+  }
+}
+
+void SubtreeSummaries::Build(const SearchDataset& dataset)
+{
+  Clear();
+
+  const std::size_t rows    = dataset.RowCount();
+  const std::size_t columns = dataset.ColumnCount();
+
+  index_.assign(rows, -1);
+
+  // Amount of trigrams in every subtree (upper bound of distinct ones)
+  // defines the filter size: it's enough for a typical subtree
+
+  std::vector<std::uint64_t> trigrams(rows, 0);
+  std::vector<std::uint64_t> internal;
+
+  for (std::size_t row = rows; row-- > 0; )
+  {
+    for (std::size_t column = 0; column < columns; column++)
+    {
+      const std::size_t length = dataset.Text(row, column).length();
+      trigrams[row] += (length > 2) ? length - 2 : 0;
+    }
+
+    if (dataset.SubtreeEnd(row) > row + 1)
+      internal.push_back(trigrams[row]);
+
+    if (dataset.Parent(row) >= 0)
+      trigrams[dataset.Parent(row)] += trigrams[row];
+  }
+
+  if (internal.empty())
+    return;
+
+  std::nth_element(internal.begin(), internal.begin() + internal.size() / 2, internal.end());
+  const std::uint64_t typical = internal[internal.size() / 2] * BITS_PER_TRIGRAM;
+
+  bitsLog_ = MIN_BITS_LOG;
+
+  while (bitsLog_ < MAX_BITS_LOG && (std::uint64_t(1) << bitsLog_) < typical)
+    bitsLog_++;
+
+  const std::size_t words = FilterWords();
+
+  // Children follow their parents, so the filters of children
+  // are ready when the rows are processed from the last to the first one
+
+  std::vector<std::uint64_t> filters(internal.size() * words, 0);
+  std::int32_t next = 0;
+
+  for (std::size_t row = rows; row-- > 0; )
+  {
+    const unsigned end = dataset.SubtreeEnd(row);
+
+    if (end == row + 1)
+      continue;
+
+    index_[row] = next++;
+    std::uint64_t* filter = filters.data() + index_[row] * words;
+
+    for (std::size_t column = 0; column < columns; column++)
+      AddText(filter, dataset.Text(row, column));
+
+    for (unsigned child = row + 1; child < end; child = dataset.SubtreeEnd(child))
+    {
+      if (index_[child] < 0)
+      {
+        for (std::size_t column = 0; column < columns; column++)
+          AddText(filter, dataset.Text(child, column));
+
+        continue;
+      }
+
+      const std::uint64_t* childFilter = filters.data() + index_[child] * words;
+
+      for (std::size_t i = 0; i < words; i++)
+        filter[i] |= childFilter[i];
+    }
+  }
+
+  // Saturated filters are dropped, the others are packed
+
+  std::int32_t kept = 0;
+
+  for (std::size_t row = 0; row < rows; row++)
+  {
+    if (index_[row] < 0)
+      continue;
+
+    const std::uint64_t* filter = filters.data() + index_[row] * words;
+    std::size_t setBits = 0;
+
+    for (std::size_t i = 0; i < words; i++)
+      setBits += PopCount(filter[i]);
+
+    if (setBits > MAX_FILL * words * 64)
+    {
+      index_[row] = -1;
+      continue;
+    }
+
+    filters_.insert(filters_.end(), filter, filter + words);
+    index_[row] = kept++;
+  }
+
+  if (kept == 0)
+  {
+    Clear();
+    return;
+  }
+
+  Bind(bitsLog_, index_, filters_);
+}
+
+bool SubtreeSummaries::TermPossible(const std::uint64_t* filter, const SummaryProbe::TermBits& term) noexcept
+{
+  for (std::size_t i = 0; i < term.words.size(); i++)
+  {
+    if ((filter[term.words[i]] & term.masks[i]) != term.masks[i])
+      return false;
+  }
+
+  return true;
+}
+
+bool SubtreeSummaries::MayMatch(const unsigned row, const SummaryProbe& probe) const noexcept
+{
+  if (probe.empty_ || row >= indexView_.size() || indexView_[row] < 0)
+    return true;
+
+  const std::uint64_t* filter = filtersView_.data() + indexView_[row] * FilterWords();
+
+  auto clausePossible = [filter](const SummaryProbe::Clause& clause)
+  {
+    return std::any_of(clause.begin(), clause.end(), [filter](const SummaryProbe::TermBits& term)
+    {
+      return TermPossible(filter, term);
+    });
+  };
+
+  if (!std::all_of(probe.must_.begin(), probe.must_.end(), clausePossible))
+    return false;
+
+  return probe.should_.empty() || std::any_of(probe.should_.begin(), probe.should_.end(), clausePossible);
+}
+
+} // namespace searcher
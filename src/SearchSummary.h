@@ -0,0 +1,120 @@
+﻿#ifndef SearchSummaryH
+#define SearchSummaryH
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "src/SearchShared.h"
+
+namespace searcher
+{
+  class SearchDataset;
+  class QueryPlan;
+
+  class SubtreeSummaries;
+
+  // Trigrams of the query terms prepared for checking subtree summaries
+  class SummaryProbe
+  {
+   public:
+
+    /// @param[in] plan      - query plan
+    /// @param[in] summaries - summaries the probe is checked against
+
+    explicit SummaryProbe(const QueryPlan& plan, const SubtreeSummaries& summaries);
+
+    /// The probe can't reject any subtree
+    bool Empty() const noexcept;
+
+   private:
+
+    friend class SubtreeSummaries;
+
+    // Bits of the filter a term sets: words_[i] & masks_[i] must be set for every i
+    struct TermBits
+    {
+      std::vector<std::uint32_t> words;
+      std::vector<std::uint64_t> masks;
+    };
+
+    // Alternatives of a clause; an empty list of bits means the term may be anywhere
+    using Clause = std::vector<TermBits>;
+
+    std::vector<Clause> must_;   // Every clause must be possible
+    std::vector<Clause> should_; // Without MUST clauses any of the clauses must be possible
+
+    bool empty_ { true };
+  };
+
+  // Bloom filters of trigrams of all text in a subtree (every column of every row).
+  // A filter of a node is aggregated bottom-up from the filters of the child nodes,
+  // so a whole branch that can't contain the query terms is skipped by one check.
+  // Only nodes with children have filters; saturated filters are dropped as useless
+
+  class SubtreeSummaries
+  {
+   public:
+
+    void Clear() noexcept;
+
+    /// Method of building the summaries of the dataset (after SearchDataset::Finish())
+    void Build(const SearchDataset& dataset);
+
+    /// Method of using summaries stored elsewhere (e.g. in a shared memory segment)
+    ///
+    /// @param[in] bitsLog - filter size is 2^bitsLog bits
+    /// @param[in] index   - every row: index of its filter (-1 - no filter)
+    /// @param[in] filters - filters one after another
+
+    void Bind(const unsigned bitsLog, const ArrayView<std::int32_t> index, const ArrayView<std::uint64_t> filters) noexcept;
+
+    unsigned BitsLog() const noexcept;
+
+    ArrayView<std::int32_t>  Index() const noexcept;
+    ArrayView<std::uint64_t> Filters() const noexcept;
+
+    /// Method of checking whether the subtree of the row may contain a row that satisfies the query
+    ///
+    /// @param[in] row   - row index
+    /// @param[in] probe - trigrams of the query
+    /// @return          - false if the subtree certainly doesn't contain such rows
+
+    bool MayMatch(const unsigned row, const SummaryProbe& probe) const noexcept;
+
+    /// Size of a filter in 64-bit words
+    std::size_t FilterWords() const noexcept;
+
+    /// Memory used by the summaries (bytes)
+    std::size_t MemoryUsage() const noexcept;
+
+    /// Method of adding the bits of the trigrams of the text (used by the probe)
+    ///
+    /// @param[in]  text  - text in lower case (at least 3 characters)
+    /// @param[out] words - indices of the words of the filter
+    /// @param[out] masks - bits in the words
+
+    void TextBits(const std::string_view text, std::vector<std::uint32_t>& words, std::vector<std::uint64_t>& masks) const;
+
+   private:
+
+    void AddText(std::uint64_t* filter, const std::string_view text) const noexcept;
+
+    static bool TermPossible(const std::uint64_t* filter, const SummaryProbe::TermBits& term) noexcept;
+
+   private:
+
+    unsigned bitsLog_ { 0 }; // Filter size is 2^bitsLog_ bits
+
+    std::vector<std::int32_t>  index_;   // Every row: index of its filter (-1 - no filter)
+    std::vector<std::uint64_t> filters_;
+
+    // Summaries in use: the vectors above or an external storage (see Bind())
+    ArrayView<std::int32_t>  indexView_;
+    ArrayView<std::uint64_t> filtersView_;
+  };
+
+} // namespace searcher
+
+#endif
@@ -0,0 +1,211 @@
+﻿#pragma hdrstop
+
+#include "src/SearchTrace.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#pragma package(smart_init)
+
+namespace searcher {
+
+namespace {
+
+constexpr char          TRACE_MAGIC[4] = { 'V', 'S', 'T', 'T' };
+constexpr std::uint8_t  TRACE_VERSION  = 1;
+
+std::uint64_t ZigZag(const std::int64_t value) noexcept
+{
+  return (static_cast<std::uint64_t>(value) << 1) ^ static_cast<std::uint64_t>(value >> 63);
+}
+
+std::int64_t UnZigZag(const std::uint64_t value) noexcept
+{
+  return static_cast<std::int64_t>(value >> 1) ^ -static_cast<std::int64_t>(value & 1);
+}
+
+} // namespace
+
+TraceWriter::TraceWriter(const std::string& fileName)
+    : stream_(fileName, std::ios::binary | std::ios::trunc)
+    , start_(std::chrono::steady_clock::now())
+{
+  if (!stream_)
+    throw std::runtime_error("Can't create the trace file: " + fileName);
+
+  stream_.write(TRACE_MAGIC, sizeof(TRACE_MAGIC));
+  stream_.put(static_cast<char>(TRACE_VERSION));
+}
+
+std::uint64_t TraceWriter::Now() const
+{
+  using namespace std::chrono;
+  return duration_cast<microseconds>(steady_clock::now() - start_).count();
+}
+
+void TraceWriter::WriteVarint(std::uint64_t value)
+{
+  while (value >= 0x80)
+  {
+    stream_.put(static_cast<char>((value & 0x7F) | 0x80));
+    value >>= 7;
+  }
+
+  stream_.put(static_cast<char>(value));
+}
+
+void TraceWriter::WriteString(const std::string& value)
+{
+  WriteVarint(value.length());
+  stream_.write(value.data(), value.length());
+}
+
+void TraceWriter::Write(TraceEvent event)
+{
+  event.time = std::max(Now(), lastTime_);
+
+  stream_.put(static_cast<char>(event.kind));
+  WriteVarint(event.time - lastTime_);
+
+  lastTime_ = event.time;
+
+  switch (event.kind)
+  {
+    case TraceEvent::Kind::CHANGE:
+      WriteString(event.text);
+      break;
+
+    case TraceEvent::Kind::KEY_UP:
+      WriteVarint(event.key);
+      WriteString(event.text);
+      break;
+
+    case TraceEvent::Kind::SEARCH:
+      WriteString(event.text);
+      WriteVarint(event.options);
+      WriteVarint(event.columns.size());
+
+      for (const auto column : event.columns)
+        WriteVarint(ZigZag(column));
+
+      WriteVarint(event.duration);
+      WriteVarint(event.totalRows);
+      WriteVarint(event.visibleRows);
+      WriteVarint(event.matchedRows);
+      WriteVarint(event.visibleRoots);
+      break;
+
+    case TraceEvent::Kind::RESET:
+      break;
+  }
+
+  // The application may be closed any moment, so events are flushed as soon as possible
+  stream_.flush();
+}
+
+TraceReader::TraceReader(const std::string& fileName)
+    : stream_(fileName, std::ios::binary)
+{
+  if (!stream_)
+    throw std::runtime_error("Can't open the trace file: " + fileName);
+
+  char magic[sizeof(TRACE_MAGIC)];
+
+  if (!stream_.read(magic, sizeof(magic)) || !std::equal(magic, magic + sizeof(magic), TRACE_MAGIC))
+    throw std::runtime_error("The file is not a search trace: " + fileName);
+
+  if (stream_.get() != TRACE_VERSION)
+    throw std::runtime_error("Unsupported version of the trace: " + fileName);
+}
+
+std::uint64_t TraceReader::ReadVarint()
+{
+  std::uint64_t value = 0;
+
+  for (unsigned shift = 0; shift < 64; shift += 7)
+  {
+    const int byte = stream_.get();
+
+    if (byte == std::char_traits<char>::eof())
+      throw std::runtime_error("The trace is corrupted");
+
+    value |= static_cast<std::uint64_t>(byte & 0x7F) << shift;
+
+    if (!(byte & 0x80))
+      return value;
+  }
+
+  throw std::runtime_error("The trace is corrupted");
+}
+
+std::string TraceReader::ReadString()
+{
+  constexpr std::uint64_t MAX_STRING_LEN = 1 << 20;
+
+  const std::uint64_t len = ReadVarint();
+
+  if (len > MAX_STRING_LEN)
+    throw std::runtime_error("The trace is corrupted");
+
+  std::string value(len, '\0');
+
+  if (!value.empty() && !stream_.read(&value[0], value.length()))
+    throw std::runtime_error("The trace is corrupted");
+
+  return value;
+}
+
+bool TraceReader::Read(TraceEvent& event)
+{
+  const int kind = stream_.get();
+
+  if (kind == std::char_traits<char>::eof())
+    return false;
+
+  if (kind > static_cast<int>(TraceEvent::Kind::RESET))
+    throw std::runtime_error("The trace is corrupted");
+
+  event = TraceEvent();
+
+  event.kind = static_cast<TraceEvent::Kind>(kind);
+  event.time = lastTime_ + ReadVarint();
+
+  lastTime_ = event.time;
+
+  switch (event.kind)
+  {
+    case TraceEvent::Kind::CHANGE:
+      event.text = ReadString();
+      break;
+
+    case TraceEvent::Kind::KEY_UP:
+      event.key  = static_cast<std::uint32_t>(ReadVarint());
+      event.text = ReadString();
+      break;
+
+    case TraceEvent::Kind::SEARCH:
+    {
+      event.text    = ReadString();
+      event.options = static_cast<std::uint32_t>(ReadVarint());
+
+      event.columns.resize(ReadVarint());
+
+      for (auto& column : event.columns)
+        column = static_cast<int>(UnZigZag(ReadVarint()));
+
+      event.duration     = ReadVarint();
+      event.totalRows    = static_cast<std::uint32_t>(ReadVarint());
+      event.visibleRows  = static_cast<std::uint32_t>(ReadVarint());
+      event.matchedRows  = static_cast<std::uint32_t>(ReadVarint());
+      event.visibleRoots = static_cast<std::uint32_t>(ReadVarint());
+      break;
+    }
+
+    case TraceEvent::Kind::RESET:
+      break;
+  }
+
+  return true;
+}
+
+} // namespace searcher
@@ -0,0 +1,98 @@
+﻿#ifndef SearchTraceH
+#define SearchTraceH
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace searcher
+{
+  // Event of the search string recorded to a trace
+  struct TraceEvent
+  {
+    enum class Kind : std::uint8_t
+    {
+      CHANGE, // The text of the search string is changed
+      KEY_UP, // A key is released in the search string
+      SEARCH, // The search request is processed
+      RESET   // The search results are reset
+    };
+
+    Kind          kind { Kind::CHANGE };
+    std::uint64_t time { 0 }; // Time since the start of the recording (in us)
+
+    std::string text; // Text of the search string
+
+    std::uint32_t key { 0 }; // KEY_UP: virtual key code
+
+    // SEARCH:
+    std::uint32_t    options { 0 }; // Mask of search options (see OptionBit())
+    std::vector<int> columns;       // Columns searched by unscoped terms
+    std::uint64_t    duration { 0 };// Time of processing the request (in us)
+
+    std::uint32_t totalRows    { 0 };
+    std::uint32_t visibleRows  { 0 }; // Amount of rows shown in the tree
+    std::uint32_t matchedRows  { 0 }; // Amount of rows that satisfy the request
+    std::uint32_t visibleRoots { 0 }; // Amount of shown top-level rows
+  };
+
+  // Writer of a compact binary trace: every event is a kind byte, a varint
+  // time delta and varint-encoded fields of the event
+
+  class TraceWriter final
+  {
+   public:
+
+    /// @throw std::runtime_error - the file can't be created
+    explicit TraceWriter(const std::string& fileName);
+
+    /// Method of writing the event. The time of the event is set by the writer
+    void Write(TraceEvent event);
+
+    /// Time since the start of the recording (in us)
+    std::uint64_t Now() const;
+
+   private:
+
+    void WriteVarint(std::uint64_t value);
+    void WriteString(const std::string& value);
+
+   private:
+
+    std::ofstream stream_;
+
+    std::chrono::steady_clock::time_point start_;
+    std::uint64_t lastTime_ { 0 };
+  };
+
+  class TraceReader final
+  {
+   public:
+
+    /// @throw std::runtime_error - the file can't be opened or isn't a trace
+    explicit TraceReader(const std::string& fileName);
+
+    /// Method of reading the next event
+    ///
+    /// @param[out] event - read event
+    /// @return           - false at the end of the trace
+    /// @throw std::runtime_error - the trace is corrupted
+
+    bool Read(TraceEvent& event);
+
+   private:
+
+    std::uint64_t ReadVarint();
+    std::string   ReadString();
+
+   private:
+
+    std::ifstream stream_;
+    std::uint64_t lastTime_ { 0 };
+  };
+
+} // namespace searcher
+
+#endif
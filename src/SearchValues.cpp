@@ -0,0 +1,379 @@
+﻿#pragma hdrstop
+
+#include "src/SearchValues.h"
+
+#include <cmath>
+
+#pragma package(smart_init)
+
+namespace searcher {
+
+namespace {
+
+bool IsDigit(const char c) noexcept
+{
+  return (c >= '0' && c <= '9');
+}
+
+bool IsBlank(const char c) noexcept
+{
+  return (c == ' ' || c == '\t' || c == '\xA0'); // Including the no-break space (Windows-1251)
+}
+
+std::string_view Trim(std::string_view text) noexcept
+{
+  while (!text.empty() && IsBlank(text.front()))
+    text.remove_prefix(1);
+
+  while (!text.empty() && IsBlank(text.back()))
+    text.remove_suffix(1);
+
+  return text;
+}
+
+/// Method of parsing a number: [sign] digits (groups may be separated by spaces) [, or . digits]
+///
+/// @param[in]  text     - text of the number
+/// @param[out] mantissa - all digits of the number as an integer
+/// @param[out] scale    - amount of the digits after the separator
+/// @return             - false if the text isn't a number (or it has more than 18 digits)
+
+bool ParseNumber(std::string_view text, std::int64_t& mantissa, unsigned& scale) noexcept
+{
+  text = Trim(text);
+
+  bool isNegative = false;
+
+  if (!text.empty() && (text[0] == '-' || text[0] == '+'))
+  {
+    isNegative = (text[0] == '-');
+    text.remove_prefix(1);
+  }
+
+  std::uint64_t value  = 0;
+  unsigned      digits = 0;
+  bool          isFraction = false;
+
+  scale = 0;
+
+  for (std::size_t i = 0; i < text.length(); i++)
+  {
+    const char c = text[i];
+
+    if (IsDigit(c))
+    {
+      if (++digits > 18)
+        return false;
+
+      value  = value * 10 + static_cast<unsigned>(c - '0');
+      scale += isFraction;
+      continue;
+    }
+
+    const bool isLast = (i + 1 == text.length());
+
+    // Separator of digit groups (1 234 567)
+    if (!isFraction && (IsBlank(c) || c == '\'') && digits > 0 && !isLast && IsDigit(text[i + 1]))
+      continue;
+
+    // Decimal separator (both are used by the locales)
+    if (!isFraction && (c == ',' || c == '.') && digits > 0 && !isLast)
+    {
+      isFraction = true;
+      continue;
+    }
+
+    return false;
+  }
+
+  if (digits == 0)
+    return false;
+
+  mantissa = isNegative ? -static_cast<std::int64_t>(value) : static_cast<std::int64_t>(value);
+  return true;
+}
+
+/// Method of parsing a date: yyyy[-mm[-dd]] or [[dd.]mm.]yyyy
+///
+/// @param[in]  text  - text of the date
+/// @param[out] year  - year
+/// @param[out] month - month (0 - only the year is specified)
+/// @param[out] day   - day (0 - the day isn't specified)
+/// @param[out] rest  - text after the date (e.g. the time)
+/// @return           - false if the text doesn't start with a date
+
+bool ParseDate(std::string_view text, int& year, int& month, int& day, std::string_view& rest) noexcept
+{
+  text = Trim(text);
+
+  int         fields[3] = { 0, 0, 0 };
+  std::size_t lengths[3] = { 0, 0, 0 };
+  std::size_t count = 0;
+  char        separator = '\0';
+
+  std::size_t pos = 0;
+
+  while (count < 3)
+  {
+    const std::size_t start = pos;
+
+    while (pos < text.length() && IsDigit(text[pos]) && pos - start < 4)
+      fields[count] = fields[count] * 10 + (text[pos++] - '0');
+
+    lengths[count] = pos - start;
+
+    if (lengths[count] == 0)
+      return false;
+
+    count++;
+
+    // The same separator between all fields
+    if (count == 3 || pos + 1 >= text.length() || (text[pos] != '-' && text[pos] != '.') ||
+        (separator != '\0' && text[pos] != separator) || !IsDigit(text[pos + 1]))
+      break;
+
+    separator = text[pos++];
+  }
+
+  rest = text.substr(pos);
+
+  // yyyy-mm-dd or dd.mm.yyyy: the year is written with 4 digits
+  const bool isIso = (lengths[0] == 4);
+
+  if (isIso == (separator == '.') && count > 1)
+    return false;
+
+  const std::size_t yearField = isIso ? 0 : count - 1;
+
+  if (lengths[yearField] != 4)
+    return false;
+
+  year  = fields[yearField];
+  month = (count > 1) ? fields[isIso ? 1 : count - 2] : 0;
+  day   = (count > 2) ? fields[isIso ? 2 : 0] : 0;
+
+  if (count > 1 && (month < 1 || month > 12 || lengths[isIso ? 1 : count - 2] > 2))
+    return false;
+
+  if (count > 2 && (day < 1 || day > 31 || lengths[isIso ? 2 : 0] > 2))
+    return false;
+
+  return true;
+}
+
+// Powers of ten for decimal numbers (up to the max. amount of digits)
+const double powersOfTen[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9,
+                               1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18 };
+
+} // namespace
+
+bool ValueTraits<ColumnType::INTEGER>::Parse(const std::string_view text, Value& value) noexcept
+{
+  unsigned scale = 0;
+  return ParseNumber(text, value, scale) && scale == 0;
+}
+
+bool ValueTraits<ColumnType::INTEGER>::ParsePeriod(const std::string_view text, Value& first, Value& last) noexcept
+{
+  if (!Parse(text, first))
+    return false;
+
+  last = first;
+  return true;
+}
+
+ValueTraits<ColumnType::INTEGER>::Value ValueTraits<ColumnType::INTEGER>::Next(const Value value) noexcept
+{
+  return value + 1; // Parsed values have at most 18 digits
+}
+
+ValueTraits<ColumnType::INTEGER>::Value ValueTraits<ColumnType::INTEGER>::Previous(const Value value) noexcept
+{
+  return value - 1;
+}
+
+bool ValueTraits<ColumnType::DECIMAL>::Parse(const std::string_view text, Value& value) noexcept
+{
+  std::int64_t mantissa = 0;
+  unsigned     scale    = 0;
+
+  if (!ParseNumber(text, mantissa, scale))
+    return false;
+
+  // The same text always gives the same value, so equal numbers
+  // of the request and of the cell are equal here
+  value = static_cast<double>(mantissa) / powersOfTen[scale];
+  return true;
+}
+
+bool ValueTraits<ColumnType::DECIMAL>::ParsePeriod(const std::string_view text, Value& first, Value& last) noexcept
+{
+  if (!Parse(text, first))
+    return false;
+
+  last = first;
+  return true;
+}
+
+ValueTraits<ColumnType::DECIMAL>::Value ValueTraits<ColumnType::DECIMAL>::Next(const Value value) noexcept
+{
+  return std::nextafter(value, MAX);
+}
+
+ValueTraits<ColumnType::DECIMAL>::Value ValueTraits<ColumnType::DECIMAL>::Previous(const Value value) noexcept
+{
+  return std::nextafter(value, MIN);
+}
+
+bool ValueTraits<ColumnType::DATE>::Parse(const std::string_view text, Value& value) noexcept
+{
+  int year = 0, month = 0, day = 0;
+  std::string_view rest;
+
+  if (!ParseDate(text, year, month, day, rest) || day == 0)
+    return false;
+
+  // The time may follow the date
+  if (!rest.empty() && !IsBlank(rest.front()) && rest.front() != 't' && rest.front() != 'T')
+    return false;
+
+  value = year * 10000 + month * 100 + day;
+  return true;
+}
+
+bool ValueTraits<ColumnType::DATE>::ParsePeriod(const std::string_view text, Value& first, Value& last) noexcept
+{
+  int year = 0, month = 0, day = 0;
+  std::string_view rest;
+
+  if (!ParseDate(text, year, month, day, rest) || !Trim(rest).empty())
+    return false;
+
+  // A year or a month is the range of its days (a day that doesn't exist
+  // in the month is between the days of the month and the next one)
+
+  first = year * 10000 + (month ? month : 1)  * 100 + (day ? day : 1);
+  last  = year * 10000 + (month ? month : 12) * 100 + (day ? day : 31);
+
+  return true;
+}
+
+ValueTraits<ColumnType::DATE>::Value ValueTraits<ColumnType::DATE>::Next(const Value value) noexcept
+{
+  return value + 1;
+}
+
+ValueTraits<ColumnType::DATE>::Value ValueTraits<ColumnType::DATE>::Previous(const Value value) noexcept
+{
+  return value - 1;
+}
+
+TypedValues::TypedValues(const ColumnType type)
+    : type_(type)
+{}
+
+ColumnType TypedValues::Type() const noexcept
+{
+  return type_;
+}
+
+void TypedValues::Add(const std::string_view text)
+{
+  switch (type_)
+  {
+    case ColumnType::INTEGER:
+    {
+      using Traits = ValueTraits<ColumnType::INTEGER>;
+      Traits::Value value;
+
+      integers_.push_back(Traits::Parse(text, value) ? value : Traits::NONE);
+      break;
+    }
+
+    case ColumnType::DECIMAL:
+    {
+      using Traits = ValueTraits<ColumnType::DECIMAL>;
+      Traits::Value value;
+
+      decimals_.push_back(Traits::Parse(text, value) ? value : Traits::NONE);
+      break;
+    }
+
+    case ColumnType::DATE:
+    {
+      using Traits = ValueTraits<ColumnType::DATE>;
+      Traits::Value value;
+
+      dates_.push_back(Traits::Parse(text, value) ? value : Traits::NONE);
+      break;
+    }
+
+    case ColumnType::TEXT:
+      break;
+  }
+}
+
+std::size_t TypedValues::Size() const noexcept
+{
+  return integers_.size() + decimals_.size() + dates_.size(); // Only one of them is used
+}
+
+std::size_t TypedValues::MemoryUsage() const noexcept
+{
+  return integers_.capacity() * sizeof(std::int64_t) + decimals_.capacity() * sizeof(double) +
+         dates_.capacity() * sizeof(std::int32_t);
+}
+
+template <ColumnType Column>
+std::shared_ptr<const ValueCondition> ValueRange<Column>::Parse(const std::string_view text)
+{
+  Value first, last;
+
+  // Range: from..to
+  if (const std::size_t dots = text.find(".."); dots != std::string_view::npos)
+  {
+    Value unused;
+
+    if (!Traits::ParsePeriod(text.substr(0, dots), first, unused) || !Traits::ParsePeriod(text.substr(dots + 2), unused, last))
+      return nullptr;
+
+    return std::make_shared<ValueRange>(first, last);
+  }
+
+  const std::size_t opLength = (text.substr(0, 2) == ">=" || text.substr(0, 2) == "<=") ? 2 :
+                               (!text.empty() && (text[0] == '>' || text[0] == '<' || text[0] == '=')) ? 1 : 0;
+
+  const std::string_view op = text.substr(0, opLength);
+
+  if (!Traits::ParsePeriod(text.substr(opLength), first, last))
+    return nullptr;
+
+  if (op == ">")
+    return std::make_shared<ValueRange>(Traits::Next(last), Traits::MAX);
+
+  if (op == ">=")
+    return std::make_shared<ValueRange>(first, Traits::MAX);
+
+  if (op == "<")
+    return std::make_shared<ValueRange>(Traits::MIN, Traits::Previous(first));
+
+  if (op == "<=")
+    return std::make_shared<ValueRange>(Traits::MIN, last);
+
+  return std::make_shared<ValueRange>(first, last);
+}
+
+std::shared_ptr<const ValueCondition> ValueCondition::Parse(const ColumnType type, const std::string_view text)
+{
+  switch (type)
+  {
+    case ColumnType::INTEGER: return ValueRange<ColumnType::INTEGER>::Parse(text);
+    case ColumnType::DECIMAL: return ValueRange<ColumnType::DECIMAL>::Parse(text);
+    case ColumnType::DATE:    return ValueRange<ColumnType::DATE>::Parse(text);
+    case ColumnType::TEXT:    break;
+  }
+
+  return nullptr;
+}
+
+} // namespace searcher
@@ -0,0 +1,234 @@
+﻿#ifndef SearchValuesH
+#define SearchValuesH
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+namespace searcher
+{
+  // Type of the values of a column. Values of a typed column are parsed once into a native array,
+  // and a scoped term is a condition on them (amount:>1000, date:2026-10) rather than a text to find
+
+  enum class ColumnType
+  {
+    TEXT,
+    INTEGER, // 1234, -5, 1 234 567
+    DECIMAL, // 1234.56, 1 234,56
+    DATE     // 2026-10-19, 19.10.2026 (the time after the date is ignored)
+  };
+
+  // Native type of the values of the column type and its parsing.
+  // A text that isn't a value is stored as NONE, it's outside of any condition
+
+  template <ColumnType Type>
+  struct ValueTraits;
+
+  template <>
+  struct ValueTraits<ColumnType::INTEGER>
+  {
+    using Value = std::int64_t;
+
+    static constexpr Value NONE = std::numeric_limits<Value>::min();
+    static constexpr Value MIN  = NONE + 1;
+    static constexpr Value MAX  = std::numeric_limits<Value>::max();
+
+    /// Method of parsing the value of a cell
+    static bool Parse(const std::string_view text, Value& value) noexcept;
+
+    /// Method of parsing the value of a condition: the values it stands for (the same for numbers)
+    static bool ParsePeriod(const std::string_view text, Value& first, Value& last) noexcept;
+
+    static Value Next(const Value value) noexcept;
+    static Value Previous(const Value value) noexcept;
+  };
+
+  template <>
+  struct ValueTraits<ColumnType::DECIMAL>
+  {
+    using Value = double;
+
+    static constexpr Value NONE = std::numeric_limits<Value>::quiet_NaN(); // Fails every comparison
+    static constexpr Value MIN  = -std::numeric_limits<Value>::infinity();
+    static constexpr Value MAX  = std::numeric_limits<Value>::infinity();
+
+    static bool Parse(const std::string_view text, Value& value) noexcept;
+    static bool ParsePeriod(const std::string_view text, Value& first, Value& last) noexcept;
+
+    static Value Next(const Value value) noexcept;
+    static Value Previous(const Value value) noexcept;
+  };
+
+  // Dates are stored as yyyymmdd numbers: the order of the numbers is the order of the dates
+
+  template <>
+  struct ValueTraits<ColumnType::DATE>
+  {
+    using Value = std::int32_t;
+
+    static constexpr Value NONE = std::numeric_limits<Value>::min();
+    static constexpr Value MIN  = NONE + 1;
+    static constexpr Value MAX  = std::numeric_limits<Value>::max();
+
+    /// Method of parsing the date of a cell (the whole date is required)
+    static bool Parse(const std::string_view text, Value& value) noexcept;
+
+    /// Method of parsing the date of a condition: a year (2026), a month (2026-10, 10.2026) or a day
+    static bool ParsePeriod(const std::string_view text, Value& first, Value& last) noexcept;
+
+    static Value Next(const Value value) noexcept;
+    static Value Previous(const Value value) noexcept;
+  };
+
+  // Values of a typed column parsed into the native array of the type (one value per row)
+  class TypedValues
+  {
+   public:
+
+    explicit TypedValues(const ColumnType type = ColumnType::TEXT);
+
+    ColumnType Type() const noexcept;
+
+    /// Method of adding the value of the next row
+    ///
+    /// @param[in] text - text of the cell
+
+    void Add(const std::string_view text);
+
+    std::size_t Size() const noexcept;
+
+    /// Values of the type (the type must be the type of the column)
+    template <ColumnType Column>
+    const std::vector<typename ValueTraits<Column>::Value>& Values() const noexcept;
+
+    /// Memory used by the values (bytes)
+    std::size_t MemoryUsage() const noexcept;
+
+   private:
+
+    ColumnType type_;
+
+    std::vector<std::int64_t> integers_;
+    std::vector<double>       decimals_;
+    std::vector<std::int32_t> dates_;
+  };
+
+  template <>
+  inline const std::vector<std::int64_t>& TypedValues::Values<ColumnType::INTEGER>() const noexcept
+  {
+    return integers_;
+  }
+
+  template <>
+  inline const std::vector<double>& TypedValues::Values<ColumnType::DECIMAL>() const noexcept
+  {
+    return decimals_;
+  }
+
+  template <>
+  inline const std::vector<std::int32_t>& TypedValues::Values<ColumnType::DATE>() const noexcept
+  {
+    return dates_;
+  }
+
+  // Condition of a query term on the values of a typed column:
+  //   1000, =1000        - the value (a date may be a year or a month)
+  //   >1000, >=1000      - greater than the value
+  //   <1000, <=1000      - less than the value
+  //   1000..2000         - between the values (inclusive)
+
+  class ValueCondition
+  {
+   public:
+
+    virtual ~ValueCondition() = default;
+
+    /// Method of parsing the condition
+    ///
+    /// @param[in] type - type of the column
+    /// @param[in] text - condition text
+    /// @return         - nullptr if the text isn't a condition on the type
+
+    static std::shared_ptr<const ValueCondition> Parse(const ColumnType type, const std::string_view text);
+
+    virtual ColumnType Type() const noexcept = 0;
+
+    /// Method of checking the text of a cell (it's parsed)
+    virtual bool Matches(const std::string_view text) const noexcept = 0;
+
+    /// Method of checking the stored value of the row
+    virtual bool Matches(const TypedValues& values, const std::size_t row) const noexcept = 0;
+
+    /// Method of marking all rows whose values satisfy the condition (in one pass over the array)
+    ///
+    /// @param[in]     values   - values of the column
+    /// @param[in,out] selected - every row: set to 1 if the value satisfies the condition
+
+    virtual void Select(const TypedValues& values, std::uint8_t* const selected) const noexcept = 0;
+  };
+
+  // Condition on the values of the type: first <= value <= last.
+  // Every type has its own matcher, so comparisons are made on native values
+
+  template <ColumnType Column>
+  class ValueRange final : public ValueCondition
+  {
+   public:
+
+    using Traits = ValueTraits<Column>;
+    using Value  = typename Traits::Value;
+
+    explicit ValueRange(const Value first, const Value last) noexcept
+        : first_(first)
+        , last_(last)
+    {}
+
+    /// Method of parsing the condition (nullptr - the text isn't a condition on the type)
+    static std::shared_ptr<const ValueCondition> Parse(const std::string_view text);
+
+    ColumnType Type() const noexcept override
+    {
+      return Column;
+    }
+
+    bool Matches(const std::string_view text) const noexcept override
+    {
+      Value value;
+      return Traits::Parse(text, value) && Contains(value);
+    }
+
+    bool Matches(const TypedValues& values, const std::size_t row) const noexcept override
+    {
+      return Contains(values.Values<Column>()[row]);
+    }
+
+    void Select(const TypedValues& values, std::uint8_t* const selected) const noexcept override
+    {
+      const auto&       array = values.Values<Column>();
+      const Value*      data  = array.data();
+      const std::size_t size  = array.size();
+
+      // Without branches, so the loop is vectorized
+      for (std::size_t i = 0; i < size; i++)
+        selected[i] |= static_cast<std::uint8_t>((data[i] >= first_) & (data[i] <= last_));
+    }
+
+   private:
+
+    bool Contains(const Value value) const noexcept
+    {
+      return (value >= first_) && (value <= last_);
+    }
+
+   private:
+
+    Value first_;
+    Value last_;
+  };
+
+} // namespace searcher
+
+#endif
@@ -2,6 +2,9 @@
 
 #include "src/VstSearcher.h"
 #include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <functional>
 
 #pragma package(smart_init)
 
@@ -21,7 +24,12 @@ __fastcall ISet<T>::operator>>(T&& value)
   return *this;
 }
 
-template <typename T>const auto& __fastcall ISet<T>::getData() const noexcept{  return data;}
+template <typename T>
+const auto& __fastcall ISet<T>::getData() const noexcept
+{
+  return data;
+}
+
 template <typename T>
 bool __fastcall ISet<T>::contains(T&& value) const
 {
@@ -55,87 +63,34 @@ void __fastcall TSearchOptions::remove(SearchOption&& option)
   data.erase(std::move(option));
 }
 
+TSearchColumns::TSearchColumns(std::function<void()> onChange)
+    : onChange_(std::move(onChange))
+{}
+
 void __fastcall TSearchColumns::add(unsigned&& iColumn)
 {
-  data.insert(std::move(iColumn));
+  if (data.insert(std::move(iColumn)).second && onChange_)
+    onChange_();
 }
 
 void __fastcall TSearchColumns::remove(unsigned&& iColumn)
 {
-  data.erase(std::move(iColumn));
-}
-
-bool operator>(const Matches& lhs, const Matches& rhs)
-{
-  if ((lhs.totalMatches == rhs.totalMatches) &&
-     (lhs.wordsMatches == rhs.wordsMatches))
-  {
-    return false;
-  }
-  else if ((lhs.totalMatches == rhs.totalMatches) &&
-          (lhs.wordsMatches > rhs.wordsMatches))
-  {
-    return true;
-  }
-  else if ((lhs.totalMatches == rhs.totalMatches) &&
-          (lhs.wordsMatches < rhs.wordsMatches))
-  {
-    return false;
-  }
-  else if ((lhs.totalMatches > rhs.totalMatches) &&
-          (lhs.wordsMatches == rhs.wordsMatches))
-  {
-    return true;
-  }
-  else if ((lhs.totalMatches < rhs.totalMatches) &&
-          (lhs.wordsMatches == rhs.wordsMatches))
-  {
-    return false;
-  }
-  else if ((lhs.totalMatches > rhs.totalMatches) &&
-          (lhs.wordsMatches > rhs.wordsMatches))
-  {
-    return true;
-  }
-  else if ((lhs.totalMatches < rhs.totalMatches) &&
-          (lhs.wordsMatches < rhs.wordsMatches))
-  {
-    return false;
-  }
-  else if ((lhs.totalMatches > rhs.totalMatches) &&
-          (lhs.wordsMatches < rhs.wordsMatches))
-  {
-    return false;
-  }
-  else if ((lhs.totalMatches < rhs.totalMatches) &&
-          (lhs.wordsMatches > rhs.wordsMatches))
-  {
-    return true;
-  }
-
-  return false;
+  if (data.erase(std::move(iColumn)) && onChange_)
+    onChange_();
 }
 
-bool operator<(const Matches& lhs, const Matches& rhs)
+void __fastcall TSearchColumns::setType(const unsigned iColumn, const ColumnType type)
 {
-  if ((lhs.totalMatches == rhs.totalMatches) &&
-      (lhs.wordsMatches == rhs.wordsMatches))
-  {
-    return false;
-  }
-
-  return !(operator>(lhs, rhs));
+  if (type == ColumnType::TEXT)
+    types_.erase(iColumn);
+  else
+    types_[iColumn] = type;
 }
 
-Matches& Matches::operator+=(const Matches& rhs)
+ColumnType __fastcall TSearchColumns::getType(const unsigned iColumn) const noexcept
 {
-  if (rhs.totalMatches > 0)
-    totalMatches += rhs.totalMatches;
-
-  if (rhs.wordsMatches > 0)
-    wordsMatches += rhs.wordsMatches;
-
-  return *this;
+  auto it = types_.find(iColumn);
+  return (it != types_.end()) ? it->second : ColumnType::TEXT;
 }
 
 void __fastcall ISearcher::edtOnChange(TObject *Sender)
@@ -143,10 +98,25 @@ void __fastcall ISearcher::edtOnChange(TObject *Sender)
   if (TEditDefaultOnChange)
     TEditDefaultOnChange(Sender);
 
+  if (IsTraceRecording())
+  {
+    TraceEvent event;
+
+    event.kind = TraceEvent::Kind::CHANGE;
+    event.text = AnsiString(edt_->Text).c_str();
+
+    RecordTraceEvent(std::move(event));
+  }
+
   edt_->RightButton->Visible = !edt_->Text.IsEmpty();
 
   if (edt_->Text.IsEmpty())
+  {
+    timer_.reset();
+    SearchExecutor::Instance().Cancel(this);
+
     ResetSearchResults();
+  }
 }
 
 void __fastcall ISearcher::edtOnKeyPress(TObject *Sender, System::WideChar &Key)
@@ -164,6 +134,17 @@ void __fastcall ISearcher::edtOnKeyUp(TObject *Sender, WORD &Key, TShiftState Sh
   if (TEditDefaultOnKeyUp)
     TEditDefaultOnKeyUp(Sender, Key, Shift);
 
+  if (IsTraceRecording())
+  {
+    TraceEvent event;
+
+    event.kind = TraceEvent::Kind::KEY_UP;
+    event.key  = Key;
+    event.text = AnsiString(edt_->Text).c_str();
+
+    RecordTraceEvent(std::move(event));
+  }
+
   // Allow enter only nums, letters, chars and Backspace
   if ((!std::isgraph(Key) && (Key != VK_BACK)) || (Key >= VK_F1 && Key <= VK_F24))
   {
@@ -206,13 +187,15 @@ void __fastcall ISearcher::edtOnKeyUp(TObject *Sender, WORD &Key, TShiftState Sh
     // interface freezes could  appear, so a delay (in ms) is created
     // before performing calculations
 
-    if (timer_.isActive())
-      timer_.reset();
-
     timer_.start(inputDelay_, this);
   }
 }
 
+DelayTimer::~DelayTimer()
+{
+  reset();
+}
+
 bool __fastcall DelayTimer::isActive() const noexcept
 {
   return timer_ != 0;
@@ -220,23 +203,157 @@ bool __fastcall DelayTimer::isActive() const noexcept
 
 void __fastcall DelayTimer::reset() noexcept
 {
+  if (!timer_)
+    return;
+
   KillTimer(nullptr, timer_);
+  activeTimers_.erase(timer_);
+
   timer_ = 0;
 }
 
 void __fastcall DelayTimer::start(const unsigned delay, ISearcher* const owner)
 {
+  reset();
+
   owner_ = owner;
   timer_ = SetTimer(nullptr, 0, delay, TimerProc);
+
+  if (timer_)
+    activeTimers_[timer_] = this;
 }
 
 void __stdcall DelayTimer::TimerProc(HWND hwnd, UINT uMsg, UINT_PTR idEvent, DWORD dwTime)
 {
-  if (uMsg == WM_TIMER && idEvent == timer_)
+  if (uMsg != WM_TIMER)
+    return;
+
+  auto it = activeTimers_.find(idEvent);
+
+  if (it == activeTimers_.end())
+  {
+    KillTimer(nullptr, idEvent);
+    return;
+  }
+
+  DelayTimer* const timer = it->second;
+  timer->reset(); // The timer is one-shot
+
+  if (timer->owner_)
+    SearchExecutor::Instance().Submit(timer->owner_);
+}
+
+SearchExecutor& __fastcall SearchExecutor::Instance()
+{
+  static SearchExecutor executor;
+  return executor;
+}
+
+void __fastcall SearchExecutor::Register(ISearcher* const searcher)
+{
+  if (!searcher)
+    return;
+
+  if (std::find(searchers_.begin(), searchers_.end(), searcher) == searchers_.end())
+    searchers_.push_back(searcher);
+}
+
+void __fastcall SearchExecutor::Unregister(ISearcher* const searcher) noexcept
+{
+  Cancel(searcher);
+  searchers_.erase(std::remove(searchers_.begin(), searchers_.end(), searcher), searchers_.end());
+}
+
+void __fastcall SearchExecutor::Submit(ISearcher* const searcher)
+{
+  if (!searcher)
+    return;
+
+  // The searcher is already waiting: its ProcessRequest()
+  // will handle the latest entered request anyway
+
+  if (!IsPending(searcher))
+    queue_.push_back(searcher);
+
+  Schedule();
+}
+
+void __fastcall SearchExecutor::Cancel(ISearcher* const searcher) noexcept
+{
+  queue_.erase(std::remove(queue_.begin(), queue_.end(), searcher), queue_.end());
+
+  if (queue_.empty() && dispatchTimer_)
+  {
+    KillTimer(nullptr, dispatchTimer_);
+    dispatchTimer_ = 0;
+  }
+}
+
+bool __fastcall SearchExecutor::IsPending(ISearcher* const searcher) const noexcept
+{
+  return (std::find(queue_.begin(), queue_.end(), searcher) != queue_.end());
+}
+
+void __fastcall SearchExecutor::Schedule()
+{
+  // WM_TIMER has the lowest priority in the message queue, so the input
+  // and painting messages are handled before the next request is processed
+
+  if (!dispatchTimer_ && !queue_.empty())
+    dispatchTimer_ = SetTimer(nullptr, 0, 0, DispatchProc);
+}
+
+void __stdcall SearchExecutor::DispatchProc(HWND hwnd, UINT uMsg, UINT_PTR idEvent, DWORD dwTime)
+{
+  if (uMsg != WM_TIMER)
+    return;
+
+  SearchExecutor& executor = Instance();
+
+  KillTimer(nullptr, idEvent);
+
+  if (idEvent != executor.dispatchTimer_)
+    return;
+
+  executor.dispatchTimer_ = 0;
+
+  if (executor.queue_.empty())
+    return;
+
+  ISearcher* const searcher = executor.queue_.front();
+  executor.queue_.pop_front();
+
+  try
   {
-    if (owner_)
-      owner_->ProcessRequest();
+    searcher->ProcessRequest();
+  }
+  catch (Exception& e)
+  {
+    Application->ShowException(&e);
   }
+
+  executor.Schedule();
+}
+
+std::vector<SearchHit> __fastcall SearchExecutor::SearchAll(const String& request, const std::size_t maxHits) const
+{
+  std::vector<SearchHit> hits;
+
+  for (auto searcher : searchers_)
+    searcher->CollectMatches(request, hits);
+
+  // The stable sort keeps the order of trees registration
+  // and the order of nodes for equally relevant hits
+
+  std::stable_sort(hits.begin(), hits.end(), [](const SearchHit& lhs, const SearchHit& rhs)
+  {
+    return lhs.matches > rhs.matches;
+  });
+
+  if (maxHits && hits.size() > maxHits)
+    hits.resize(maxHits);
+
+  return hits;
 }
 
 void __fastcall ISearcher::SetLabelCaption(String&& caption) noexcept
@@ -251,6 +368,9 @@ void __fastcall ISearcher::edtOnRightButtonClick(TObject *Sender)
   if (TEditDefaultOnRightButtonClick)
     TEditDefaultOnRightButtonClick(Sender);
 
+  timer_.reset();
+  SearchExecutor::Instance().Cancel(this);
+
   edt_->Clear();
   ResetSearchResults();
 }
@@ -270,6 +390,8 @@ void __fastcall ISearcher::ShowPopupMessage(String&& msg) noexcept
 
 __fastcall ISearcher::~ISearcher()
 {
+  SearchExecutor::Instance().Unregister(this);
+
   if (edt_ && edt_->CustomHint)
     edt_->CustomHint->Free();
 }
@@ -308,6 +430,8 @@ void __fastcall ISearcher::Init(TButtonedEdit *Edit, TLabel *Label)
   edt_->OnKeyPress = edtOnKeyPress;
   edt_->OnKeyUp 	 = edtOnKeyUp;
   edt_->OnRightButtonClick = edtOnRightButtonClick;
+
+  SearchExecutor::Instance().Register(this);
 }
 
 void __fastcall ISearcher::SetMinRequestLength(const unsigned min_len) noexcept
@@ -337,51 +461,245 @@ void __fastcall ISearcher::AddWordsToList(const String& searchWords)
 
   std::string sWords = AnsiString(searchWords).c_str();
 
-  static const char* delim = "./;,\t ";
+  if (SearchOptions.contains(SearchOption::REGEX_SEARCH))
+  {
+    plan_.ParseRegex(sWords);
+  }
+  else
+  {
+    plan_.Parse(sWords, [this](const std::string& name, int& column)
+    {
+      return ResolveColumn(name, column);
+    },
+    [this](const int column)
+    {
+      return (column >= 0) ? SearchColumns.getType(column) : ColumnType::TEXT;
+    });
+
+    if (SearchOptions.contains(SearchOption::LAYOUT_VARIANTS))
+      plan_.AddLayoutVariants();
+  }
 
-  std::string::size_type start = 0,
-                         end   = 0;
+  OptimizeQueryPlan();
 
-  while ((start = sWords.find_first_not_of(delim, end)) != std::string::npos)
+  for (const auto& clause : plan_.Clauses())
   {
-    end = sWords.find_first_of(delim, start);
-    words_.insert(sWords.substr(start, end - start));
+    if (clause.occur == TermOccur::MUST_NOT)
+      continue;
+
+    for (const auto& term : clause.terms)
+      words_.insert(term.text);
   }
 }
 
-Matches __fastcall ISearcher::CountMatches(const String& sText) const noexcept
+Matches __fastcall ISearcher::CountMatches(const String& sText, const int column) const noexcept
 {
   std::string text = AnsiString(sText).c_str();
+  ToLower(text);
+
+  return plan_.Count(text, column);
+}
 
-  std::transform(text.begin(), text.end(), text.begin(), std::tolower);
+bool __fastcall ISearcher::ResolveColumn(const std::string& name, int& column) const
+{
+  return false;
+}
+
+void __fastcall ISearcher::OptimizeQueryPlan()
+{
+  plan_.Optimize(QueryPlan::EstimateSelectivity, std::max<std::size_t>(SearchColumns.getData().size(), 1));
+}
+
+template <typename Function>
+void __fastcall ISearcher::WithRequest(const String& request, Function function)
+{
+  // Keep the current request of the searcher untouched
+  std::unordered_set<std::string> currentWords;
+  QueryPlan currentPlan;
 
-  int iMatches = 0;
-  int iWordsMatches = 0;
+  currentWords.swap(words_);
+  std::swap(currentPlan, plan_);
 
-  for (const auto word : words_)
+  try
   {
-    std::string searchWord = word;
-    std::transform(searchWord.begin(), searchWord.end(), searchWord.begin(), std::tolower);
+    AddWordsToList(request);
 
-    std::string::size_type startSearchFrom = 0,
-                           wordStartPos = 0;
+    if (!WordsListEmpty())
+      function();
+  }
+  catch (...)
+  {
+    words_.swap(currentWords);
+    std::swap(currentPlan, plan_);
+    throw;
+  }
 
-    if (text.find(searchWord, startSearchFrom) != std::string::npos)
-      iWordsMatches++;
+  words_.swap(currentWords);
+  std::swap(currentPlan, plan_);
+}
 
-    while ((wordStartPos = text.find(searchWord, startSearchFrom)) != std::string::npos)
-    {
-      iMatches += searchWord.length();
-      startSearchFrom = wordStartPos + searchWord.length();
-    }
+void __fastcall ISearcher::CollectMatches(const String& request, std::vector<SearchHit>& hits)
+{
+  if (!isInitialized_)
+    return;
+
+  WithRequest(request, [this, &hits]() { DoCollectMatches(hits); });
+}
+
+HitCursor __fastcall ISearcher::FindMatches(const String& request)
+{
+  HitCursor cursor;
+
+  if (!isInitialized_)
+    return cursor;
+
+  WithRequest(request, [this, &cursor]() { cursor = DoFindMatches(); });
+
+  return cursor;
+}
+
+bool __fastcall HitCursor::IsValid()
+{
+  if (nodes_ && *cacheEpoch_ != epoch_)
+  {
+    rows_  = SearchCursor();
+    nodes_ = nullptr;
+  }
+
+  return (nodes_ != nullptr);
+}
+
+bool __fastcall HitCursor::Next(SearchHit& hit)
+{
+  SearchMatch match;
+
+  if (!IsValid() || !rows_.Next(match))
+    return false;
+
+  hit = SearchHit(searcher_, (*nodes_)[match.row], match.matches);
+
+  return true;
+}
+
+std::vector<SearchHit> __fastcall HitCursor::Take(const std::size_t count)
+{
+  std::vector<SearchHit> hits;
+  SearchHit hit;
+
+  while (hits.size() < count && Next(hit))
+    hits.push_back(hit);
+
+  return hits;
+}
+
+std::size_t __fastcall HitCursor::Count()
+{
+  return IsValid() ? rows_.Count() : 0;
+}
+
+void __fastcall ISearcher::StartTraceRecording(const String& fileName)
+{
+  try
+  {
+    trace_ = std::make_unique<TraceWriter>(AnsiString(fileName).c_str());
+  }
+  catch (const std::exception& e)
+  {
+    throw Exception(e.what());
+  }
+}
+
+void __fastcall ISearcher::StopTraceRecording() noexcept
+{
+  trace_.reset();
+}
+
+bool __fastcall ISearcher::IsTraceRecording() const noexcept
+{
+  return (trace_ != nullptr);
+}
+
+void __fastcall ISearcher::RecordTraceEvent(TraceEvent&& event)
+{
+  if (trace_)
+    trace_->Write(std::move(event));
+}
+
+void __fastcall ISearcher::SetMemoryBudget(const std::size_t bytes)
+{
+  memoryBudget_ = bytes;
+
+  EnforceMemoryBudget();
+}
+
+std::size_t __fastcall ISearcher::GetMemoryBudget() const noexcept
+{
+  return memoryBudget_;
+}
+
+std::vector<CacheUsage> __fastcall ISearcher::GetMemoryUsage() const
+{
+  std::vector<CacheUsage> usage;
+
+  for (const auto cache : { SearchCache::RESULTS, SearchCache::HIGHLIGHTS, SearchCache::INDEXES, SearchCache::DATA })
+  {
+    CacheUsage cacheUsage;
+
+    cacheUsage.cache = cache;
+    cacheUsage.bytes = CacheMemoryUsage(cache);
+
+    usage.push_back(cacheUsage);
+  }
+
+  return usage;
+}
+
+void __fastcall ISearcher::EnforceMemoryBudget()
+{
+  if (memoryBudget_ == 0)
+    return;
+
+  std::size_t total = 0;
+
+  const std::vector<CacheUsage> usage = GetMemoryUsage();
+
+  for (const auto& cache : usage)
+    total += cache.bytes;
+
+  // The cheapest to rebuild go first
+  for (const auto& cache : usage)
+  {
+    if (total <= memoryBudget_ || cache.cache == SearchCache::DATA)
+      break;
+
+    if (cache.bytes == 0)
+      continue;
+
+    EvictCache(cache.cache);
+    total -= cache.bytes;
   }
+}
+
+void __fastcall ISearcher::SearchColumnsChanged()
+{
+  // The current request is searched again in the new columns
+  if (isInitialized_ && !WordsListEmpty())
+    SearchExecutor::Instance().Submit(this);
+}
+
+unsigned __fastcall ISearcher::SearchOptionsMask() const
+{
+  unsigned mask = 0;
+
+  for (const auto option : SearchOptions.getData())
+    mask |= OptionBit(option);
 
-  return Matches(iMatches, iWordsMatches);
+  return mask;
 }
 
 bool __fastcall ISearcher::WordsListEmpty() const noexcept
 {
-	return words_.empty();
+	return plan_.Empty();
 }
 
 std::size_t __fastcall ISearcher::WordsListSize() const noexcept
@@ -392,6 +710,7 @@ std::size_t __fastcall ISearcher::WordsListSize() const noexcept
 void __fastcall ISearcher::ClearWordsList() noexcept
 {
 	words_.clear();
+  plan_.Clear();
 }
 
 int __fastcall ISearcher::CalculateTextWidth(HANDLE handle, const char* text) const
@@ -409,12 +728,17 @@ int __fastcall ISearcher::CalculateTextWidth(HANDLE handle, const char* text) co
 	return rect.right;
 }
 
-__fastcall VstSearcher::VstSearcher(TVirtualStringTree *Tree, TButtonedEdit *Edit, TLabel *Label)
+__fastcall VstSearcher::VstSearcher(TVirtualStringTree *Tree, TButtonedEdit *Edit, TLabel *Label, const bool prewarmCache)
 {
-	Init(Tree, Edit, Label);
+	Init(Tree, Edit, Label, prewarmCache);
 }
 
-void __fastcall VstSearcher::Init(TVirtualStringTree *Tree, TButtonedEdit *Edit, TLabel *Label)
+__fastcall VstSearcher::~VstSearcher()
+{
+  StopCachePrewarm();
+}
+
+void __fastcall VstSearcher::Init(TVirtualStringTree *Tree, TButtonedEdit *Edit, TLabel *Label, const bool prewarmCache)
 {
   if (isInitialized_)
     return;
@@ -430,11 +754,6 @@ void __fastcall VstSearcher::Init(TVirtualStringTree *Tree, TButtonedEdit *Edit,
 
   vt_->DoubleBuffered = true;
 
-  void __fastcall (__closure *const TVTCompareEvent)(TBaseVirtualTree* Sender,
-                                                     PVirtualNode Node1, PVirtualNode Node2,
-                                                     TColumnIndex Column, int &Result)
-  = vt_->OnCompareNodes;
-
   void __fastcall (__closure *const TVTBeforeCellPaintEvent)(TBaseVirtualTree* Sender,
                                                              Vcl::Graphics::TCanvas* TargetCanvas,
                                                              PVirtualNode Node, TColumnIndex Column,
@@ -447,12 +766,17 @@ void __fastcall VstSearcher::Init(TVirtualStringTree *Tree, TButtonedEdit *Edit,
                               const TVTHeaderHitInfo &HitInfo)
   = vt_->OnHeaderClick;
 
-  TVTDefaultCompareEvent 		     = TVTCompareEvent;
+  void __fastcall (__closure *const TVTStructureChange)(TBaseVirtualTree* Sender,
+                                                        PVirtualNode Node, TChangeReason Reason)
+  = vt_->OnStructureChange;
+
   TVTDefaultBeforeCellPaintEvent = TVTBeforeCellPaintEvent;
   TVTDefaultHeaderClick 		     = TVTHeaderClick;
+  TVTDefaultStructureChange      = TVTStructureChange;
 
   vt_->OnBeforeCellPaint = vstOnBeforeCellPaint;
   vt_->OnHeaderClick     = vstOnHeaderClick;
+  vt_->OnStructureChange = vstOnStructureChange;
 
   defaultSortColumn_ 	  = vt_->Header->SortColumn;
   defaultSortDirection_ = vt_->Header->SortDirection;
@@ -460,6 +784,9 @@ void __fastcall VstSearcher::Init(TVirtualStringTree *Tree, TButtonedEdit *Edit,
   isInitialized_ = true;
 
   ClearWordsList();
+
+  if (prewarmCache)
+    StartCachePrewarm();
 };
 
 void __fastcall VstSearcher::ShowAllRecords() noexcept
@@ -478,27 +805,6 @@ void __fastcall VstSearcher::ShowAllRecords() noexcept
   vt_->EndUpdate();
 }
 
-template <typename T>
-static int CompareValues(const T& data_1, const T& data_2)
-{
-  if (data_1 > data_2)
-    return 1;
-  else if (data_1 < data_2)
-    return -1;
-
-  return 0;
-}
-
-void __fastcall VstSearcher::vstOnCompareNodes(TBaseVirtualTree *Sender, PVirtualNode Node1,
- 								  			 PVirtualNode Node2, TColumnIndex Column, int &Result)
-{
-  const auto mit1 = matches_.find(Node1);
-  const auto mit2 = matches_.find(Node2);
-
-  if ((mit1 != matches_.end()) && (mit2 != matches_.end()))
-    Result = CompareValues(mit1->second, mit2->second);
-}
-
 void __fastcall VstSearcher::vstOnBeforeCellPaint(TBaseVirtualTree* Sender,
                                                  Vcl::Graphics::TCanvas* TargetCanvas,
                                                  PVirtualNode Node, TColumnIndex Column,
@@ -525,97 +831,798 @@ void __fastcall VstSearcher::vstOnHeaderClick(TVTHeader* Sender, const TVTHeader
   }
 }
 
-void __fastcall VstSearcher::RelevantSort() noexcept
+void __fastcall VstSearcher::vstOnStructureChange(TBaseVirtualTree* Sender, PVirtualNode Node, TChangeReason Reason)
+{
+  if (TVTDefaultStructureChange)
+    TVTDefaultStructureChange(Sender, Node, Reason);
+
+  if (!movingNodes_)
+    InvalidateSearchCache();
+}
+
+void __fastcall VstSearcher::InvalidateSearchCache() noexcept
+{
+  // Cursors over the nodes end (the nodes may be deleted)
+  cacheEpoch_++;
+
+  // Nodes saved by the search session may be deleted
+  session_.treeChanged = true;
+
+  // The shared cache no longer matches the tree
+  if (cacheValid_ && dataset_.Generation() != 0)
+    sharedCacheDetached_ = true;
+
+  cacheValid_ = false;
+
+  // The prewarm starts over with the changed tree
+  cacheBuild_.active = false;
+
+  results_.Clear();
+
+  parts_.Clear();
+}
+
+void __fastcall VstSearcher::BuildSearchCache()
+{
+  const bool isPrewarming = IsCachePrewarming();
+
+  if (!cacheBuild_.active)
+    BeginCacheBuild();
+
+  if (cacheBuild_.active)
+  {
+    AddCacheRows(std::chrono::steady_clock::time_point::max());
+    FinishCacheBuild();
+  }
+
+  if (isPrewarming)
+  {
+    StopCachePrewarm();
+    ReportPrewarmProgress();
+  }
+}
+
+void __fastcall VstSearcher::BeginCacheBuild()
+{
+  cacheValid_ = false;
+  cacheEpoch_++;
+
+  // Rows of the session state don't match the new cache
+  session_.valid = false;
+
+  dataset_.Clear();
+  nodes_.clear();
+  results_.Clear();
+
+  parts_.Clear();
+
+  cacheBuild_ = CacheBuild();
+
+  const int columnsCount = vt_->Header->Columns->Count;
+
+  std::vector<std::string> captions;
+
+  for (int i = 0; i < columnsCount; i++)
+    captions.push_back(AnsiString(vt_->Header->Columns->Items[i]->Text).c_str());
+
+  // A tree without columns has one column (as in the dataset)
+  if (captions.empty())
+    captions.emplace_back();
+
+  // Rows in the tree order: nodes and indices of their parents.
+  // Nodes are only walked here (their text isn't got), so it's done at once
+
+  std::vector<int>& parents = cacheBuild_.parents;
+
+  // Path from the top-level node to the current one (node, row)
+  std::vector<std::pair<TVirtualNode*, int>> path;
+
+  for (auto Node = vt_->GetFirst(); Node != nullptr; Node = vt_->GetNext(Node))
+  {
+    while (!path.empty() && path.back().first != Node->Parent)
+      path.pop_back();
+
+    if (path.empty())
+      cacheBuild_.roots.push_back(static_cast<std::uint32_t>(nodes_.size()));
+
+    parents.push_back(path.empty() ? -1 : path.back().second);
+    path.emplace_back(Node, static_cast<int>(nodes_.size()));
+
+    nodes_.push_back(Node);
+  }
+
+  if (AttachSharedCache(captions, parents))
+  {
+    dataset_.SetColumnTypes(GetColumnTypes());
+
+    cacheBuild_ = CacheBuild();
+    cacheValid_ = true;
+    return;
+  }
+
+  dataset_.SetColumns(std::move(captions), (columnsCount > 0) ? int(vt_->Header->MainColumn) : 0);
+
+  cacheBuild_.active = true;
+}
+
+bool __fastcall VstSearcher::AddCacheRows(const std::chrono::steady_clock::time_point deadline)
+{
+  // The clock is checked once per this amount of rows
+  constexpr std::size_t CHECK_INTERVAL = 64;
+
+  const bool hasColumns = (vt_->Header->Columns->Count > 0);
+
+  std::vector<std::string> texts(dataset_.ColumnCount());
+
+  for (std::size_t& row = cacheBuild_.row; row < nodes_.size(); )
+  {
+    for (std::size_t i = 0; i < texts.size(); i++)
+    {
+      texts[i] = AnsiString(vt_->Text[nodes_[row]][hasColumns ? int(i) : -1]).c_str();
+      ToLower(texts[i]);
+    }
+
+    dataset_.AddRow(cacheBuild_.parents[row], texts);
+    row++;
+
+    if (row % CHECK_INTERVAL == 0 && std::chrono::steady_clock::now() >= deadline)
+      break;
+  }
+
+  return (cacheBuild_.row >= nodes_.size());
+}
+
+void __fastcall VstSearcher::FinishCacheBuild()
+{
+  cacheBuild_ = CacheBuild();
+
+  dataset_.Finish();
+
+  if (SearchOptions.contains(SearchOption::COMPRESSED_CACHE))
+    dataset_.Compress();
+
+  if (!sharedCacheName_.empty() && !sharedCacheDetached_)
+  {
+    try
+    {
+      dataset_.Publish(sharedCacheName_);
+    }
+    catch (const std::exception&)
+    {
+      // The cache stays private
+    }
+  }
+
+  // Values of typed columns are parsed once (after the dataset is published they're still private)
+  dataset_.SetColumnTypes(GetColumnTypes());
+
+  cacheValid_ = true;
+
+  EnforceMemoryBudget();
+}
+
+bool __fastcall VstSearcher::AttachSharedCache(const std::vector<std::string>& captions, const std::vector<int>& parents)
+{
+  if (sharedCacheName_.empty() || sharedCacheDetached_)
+    return false;
+
+  try
+  {
+    dataset_.Attach(sharedCacheName_);
+  }
+  catch (const std::exception&)
+  {
+    return false;
+  }
+
+  // Only the structure of the tree is compared: getting the text
+  // of the nodes is what the shared cache saves
+
+  bool isSame = (dataset_.Captions() == captions) && (dataset_.RowCount() == parents.size());
+
+  for (std::size_t row = 0; isSame && row < parents.size(); row++)
+    isSame = (dataset_.Parent(row) == parents[row]);
+
+  // The cache of another tree is published under the name: the private cache isn't published
+  // over it, otherwise both processes would rebuild their caches on every new generation
+
+  if (!isSame)
+  {
+    dataset_.Clear();
+    sharedCacheDetached_ = true;
+  }
+
+  return isSame;
+}
+
+void __fastcall VstSearcher::EnsureSearchCache()
+{
+  // Compression of the shared cache is chosen by the process that has published it.
+  // A new generation of the shared cache replaces the attached one
+
+  const bool isShared = (dataset_.Generation() != 0);
+
+  if (!cacheValid_ ||
+      (!isShared && dataset_.Compressed() != SearchOptions.contains(SearchOption::COMPRESSED_CACHE)) ||
+      (isShared && SearchDataset::PublishedGeneration(sharedCacheName_) != dataset_.Generation()))
+    BuildSearchCache();
+
+  // A type of a column is changed
+  const std::vector<ColumnType> types = GetColumnTypes();
+
+  if (dataset_.ColumnTypes() != types)
+  {
+    dataset_.SetColumnTypes(types);
+    cacheEpoch_++; // Cursors read the values of the typed columns
+
+    // Scoped terms of the requests are parsed as conditions on the types
+    results_.Clear();
+
+    parts_.Clear();
+  }
+}
+
+std::vector<ColumnType> __fastcall VstSearcher::GetColumnTypes() const
+{
+  std::vector<ColumnType> types(std::max(vt_->Header->Columns->Count, 1), ColumnType::TEXT);
+
+  for (std::size_t i = 0; i < types.size(); i++)
+    types[i] = SearchColumns.getType(i);
+
+  return types;
+}
+
+void __fastcall VstSearcher::ShareSearchCache(const String& name)
+{
+  sharedCacheName_     = AnsiString(name).c_str();
+  sharedCacheDetached_ = false;
+
+  cacheValid_        = false;
+  cacheBuild_.active = false;
+}
+
+void __fastcall VstSearcher::StartCachePrewarm()
+{
+  if (!vt_ || prewarmTimer_ || cacheValid_)
+    return;
+
+  // WM_TIMER has the lowest priority in the message queue,
+  // so a chunk is built only when there is nothing else to do
+
+  prewarmTimer_ = SetTimer(nullptr, 0, 0, PrewarmProc);
+
+  if (prewarmTimer_)
+    prewarmTimers_[prewarmTimer_] = this;
+}
+
+void __fastcall VstSearcher::StopCachePrewarm() noexcept
+{
+  if (!prewarmTimer_)
+    return;
+
+  KillTimer(nullptr, prewarmTimer_);
+  prewarmTimers_.erase(prewarmTimer_);
+
+  prewarmTimer_ = 0;
+}
+
+bool __fastcall VstSearcher::IsCachePrewarming() const noexcept
+{
+  return prewarmTimer_ != 0;
+}
+
+void __fastcall VstSearcher::ContinueCachePrewarm()
+{
+  const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(CACHE_PREWARM_SLICE);
+
+  if (!cacheBuild_.active)
+    BeginCacheBuild();
+
+  if (cacheBuild_.active && AddCacheRows(deadline))
+    FinishCacheBuild();
+
+  // The cache is built (or attached to the shared one)
+  if (cacheValid_)
+    StopCachePrewarm();
+
+  ReportPrewarmProgress();
+}
+
+void __fastcall VstSearcher::ReportPrewarmProgress()
+{
+  if (!OnCachePrewarm)
+    return;
+
+  const unsigned totalRows = nodes_.size();
+
+  OnCachePrewarm(this, cacheValid_ ? totalRows : unsigned(cacheBuild_.row), totalRows);
+}
+
+void __stdcall VstSearcher::PrewarmProc(HWND hwnd, UINT uMsg, UINT_PTR idEvent, DWORD dwTime)
+{
+  if (uMsg != WM_TIMER)
+    return;
+
+  auto it = prewarmTimers_.find(idEvent);
+
+  if (it == prewarmTimers_.end())
+  {
+    KillTimer(nullptr, idEvent);
+    return;
+  }
+
+  VstSearcher* const searcher = it->second;
+
+  // Exceptions must not leave the timer callback. The cache will be built from scratch
+  // by the first request that needs it (a failed slice may have added a part of a row)
+
+  try
+  {
+    searcher->ContinueCachePrewarm();
+  }
+  catch (Exception& e)
+  {
+    searcher->StopCachePrewarm();
+    searcher->cacheBuild_.active = false;
+
+    Application->ShowException(&e);
+  }
+  catch (const std::exception& e) // Out of memory while the cache is built
+  {
+    searcher->StopCachePrewarm();
+    searcher->cacheBuild_.active = false;
+
+    Exception exception(e.what());
+    Application->ShowException(&exception);
+  }
+}
+
+void __fastcall VstSearcher::SaveSnapshot(const String& fileName)
+{
+  if (!vt_) return;
+
+  EnsureSearchCache();
+
+  std::ofstream stream(AnsiString(fileName).c_str(), std::ios::binary | std::ios::trunc);
+
+  if (!stream)
+    throw Exception("Can't create the snapshot file: " + fileName);
+
+  try
+  {
+    dataset_.Save(stream);
+  }
+  catch (const std::exception& e)
+  {
+    throw Exception(e.what());
+  }
+}
+
+void __fastcall VstSearcher::RelevantSort()
 {
   if (!SearchOptions.contains(SearchOption::RELEVANT_SORT))
     return;
 
   if (!vt_) return;
 
-  vt_->Header->SortColumn 	= -1;
-  vt_->Header->SortDirection = sdDescending;
+  const auto roots = RootRows();
 
-  vt_->SortTree(vt_->Header->SortColumn, vt_->Header->SortDirection);
+  if (result_.rootMatches.size() != roots.size())
+    return;
 
-  vt_->Header->SortColumn    = defaultSortColumn_;
-  vt_->Header->SortDirection = defaultSortDirection_;
+  // Top-level nodes are moved to the end one by one in the order of relevance,
+  // so the order is applied in one pass. Equal nodes keep the order of the cache.
+  // The reset restores the order even if the tree fails to move a node
+
+  session_.reordered = true;
+  movingNodes_       = true;
+
+  try
+  {
+    for (const auto i : RelevanceOrder(result_.rootMatches))
+      vt_->MoveTo(nodes_[roots[i]], vt_->RootNode, amAddChildLast, false);
+  }
+  catch (...)
+  {
+    movingNodes_ = false;
+    throw;
+  }
+
+  movingNodes_ = false;
 }
 
 void __fastcall VstSearcher::ResetSearchResults()
 {
-  ShowAllRecords();
-  vt_->FullCollapse();
-
   if (edt_->CustomHint->ShowingHint)
     edt_->CustomHint->HideHint();
 
   SetLabelCaption(vt_->TotalCount);
 
+  highlights_.Clear();
+
   vt_->Header->SortColumn 	 = defaultSortColumn_;
   vt_->Header->SortDirection = defaultSortDirection_;
 
-  vt_->SortTree(vt_->Header->SortColumn, vt_->Header->SortDirection);
-  vt_->ScrollIntoView(vt_->FocusedNode, true);
+  if (session_.active)
+  {
+    if (session_.valid && cacheValid_)
+    {
+      RestoreSession();
+    }
+    else if (!session_.treeChanged) // The cache was built or rebuilt during the session
+    {
+      RestoreSessionNodes();
+    }
+    else // Nodes were added or deleted during the session, the whole tree is reset
+    {
+      ShowAllRecords();
+      vt_->FullCollapse();
+
+      vt_->SortTree(vt_->Header->SortColumn, vt_->Header->SortDirection);
+    }
+
+    vt_->ScrollIntoView(vt_->FocusedNode, true);
+  }
+
+  session_ = SearchSession();
 
   ClearWordsList();
-  matches_.clear();
 
-  vt_->Repaint();
+  // Highlighting of the words is removed
+  vt_->Invalidate();
+
+  if (IsTraceRecording())
+  {
+    TraceEvent event;
+    event.kind = TraceEvent::Kind::RESET;
+
+    RecordTraceEvent(std::move(event));
+  }
 }
 
-// This structure passes to the IterateSubTreeProc
-struct TIterateData
+// State flags of a row in the search session
+static constexpr std::uint8_t ROW_VISIBLE  = 0x01;
+static constexpr std::uint8_t ROW_EXPANDED = 0x02;
+static constexpr std::uint8_t ROW_CHANGED  = 0x04;
+
+void __fastcall VstSearcher::BeginSession()
 {
-  VstSearcher* searcher;
-  Matches*     matches;
+  session_ = SearchSession();
 
-  explicit TIterateData(VstSearcher* const _searcher, Matches* const _matches)
-      : searcher(_searcher)
-      , matches(_matches)
-  {};
-};
+  session_.active        = true;
+  session_.valid         = cacheValid_;
+  session_.sortColumn    = defaultSortColumn_;
+  session_.sortDirection = defaultSortDirection_;
+
+  for (auto Node = vt_->RootNode->FirstChild; Node != nullptr; Node = Node->NextSibling)
+    session_.roots.push_back(Node);
+
+  auto saveNode = [this](TVirtualNode* Node)
+  {
+    if (Node->States.Contains(vsExpanded))
+      session_.expanded.push_back(Node);
 
-void __fastcall IterateSubtreeProc(TBaseVirtualTree *Sender, PVirtualNode Node, void *Data, bool &Abort)
+    if (!Node->States.Contains(vsVisible))
+      session_.hidden.push_back(Node);
+  };
+
+  // Without the cache only the nodes are saved
+  if (!session_.valid)
+  {
+    for (auto Node = vt_->GetFirst(); Node != nullptr; Node = vt_->GetNext(Node))
+      saveNode(Node);
+
+    return;
+  }
+
+  // Rows of the state are the rows of the cache
+  session_.rows.resize(nodes_.size());
+
+  for (std::size_t row = 0; row < nodes_.size(); row++)
+  {
+    TVirtualNode* Node = nodes_[row];
+
+    session_.rows[row] = (Node->States.Contains(vsVisible)  ? ROW_VISIBLE  : 0) |
+                         (Node->States.Contains(vsExpanded) ? ROW_EXPANDED : 0);
+
+    saveNode(Node);
+  }
+
+  const auto& roots = dataset_.Roots();
+
+  for (std::size_t i = 0; i < roots.size(); i++)
+  {
+    if (session_.rows[roots[i]] & ROW_VISIBLE)
+      session_.shownRoots.Add(static_cast<std::uint32_t>(i));
+  }
+}
+
+void __fastcall VstSearcher::RestoreSession()
 {
-  if (!Data) return;
+  vt_->BeginUpdate();
+
+  for (const auto row : session_.changed)
+  {
+    TVirtualNode*      Node  = nodes_[row];
+    const std::uint8_t state = session_.rows[row];
+
+    const bool isExpanded = (state & ROW_EXPANDED);
+    const bool isVisible  = (state & ROW_VISIBLE);
+
+    if (Node->States.Contains(vsExpanded) != isExpanded)
+      vt_->Expanded[Node] = isExpanded;
+
+    if (Node->States.Contains(vsVisible) != isVisible)
+      vt_->IsVisible[Node] = isVisible;
+  }
 
-  TIterateData itData = *reinterpret_cast<TIterateData*>(Data);
-  Matches m = itData.searcher->CountMatchesInNode(Node);
+  RestoreSessionOrder();
 
-  const bool isAutoExpandNodes =
-  itData.searcher->SearchOptions.contains(SearchOption::AUTO_EXPAND_NODES);
+  vt_->EndUpdate();
+}
+
+void __fastcall VstSearcher::RestoreSessionNodes()
+{
+  vt_->BeginUpdate();
+
+  ShowAllRecords();
+  vt_->FullCollapse();
 
-  if (isAutoExpandNodes && Sender->GetNodeLevel(Node) > 0)
+  for (const auto Node : session_.expanded)
+    vt_->Expanded[Node] = true;
+
+  for (const auto Node : session_.hidden)
+    vt_->IsVisible[Node] = false;
+
+  RestoreSessionOrder();
+
+  vt_->EndUpdate();
+}
+
+void __fastcall VstSearcher::RestoreSessionOrder()
+{
+  // Top-level nodes that are already in place are skipped, the rest are moved
+  // to the end in the saved order
+
+  if (session_.reordered)
   {
-    // Expand all child nodes with matches
-    // if AUTO_EXPAND_NODES option is specified
+    std::size_t inPlace = 0;
 
-    if (m.totalMatches > 0)
+    for (auto Node = vt_->RootNode->FirstChild;
+         Node != nullptr && inPlace < session_.roots.size() && Node == session_.roots[inPlace];
+         Node = Node->NextSibling)
     {
-      TVirtualNode* ParentNode = Node->Parent;
+      inPlace++;
+    }
 
-      while (ParentNode && ParentNode != Sender->RootNode)
-      {
-        if (!ParentNode->States.Contains(vsExpanded))
-          Sender->Expanded[ParentNode] = true;
+    movingNodes_ = true;
 
-        ParentNode = ParentNode->Parent;
-      }
+    for (std::size_t i = inPlace; i < session_.roots.size(); i++)
+      vt_->MoveTo(session_.roots[i], vt_->RootNode, amAddChildLast, false);
+
+    movingNodes_ = false;
+  }
+
+  // The sort column was changed during the session
+  if (session_.sortColumn != defaultSortColumn_ || session_.sortDirection != defaultSortDirection_)
+    vt_->SortTree(vt_->Header->SortColumn, vt_->Header->SortDirection);
+}
+
+void __fastcall VstSearcher::SetRowVisible(const unsigned row, const bool visible)
+{
+  TVirtualNode* Node = nodes_[row];
+
+  if (Node->States.Contains(vsVisible) == visible)
+    return;
+
+  if (session_.valid && !(session_.rows[row] & ROW_CHANGED))
+  {
+    session_.rows[row] |= ROW_CHANGED;
+    session_.changed.push_back(row);
+  }
+
+  vt_->IsVisible[Node] = visible;
+}
+
+void __fastcall VstSearcher::SetRowExpanded(const unsigned row, const bool expanded)
+{
+  TVirtualNode* Node = nodes_[row];
+
+  if (Node->States.Contains(vsExpanded) == expanded)
+    return;
+
+  if (session_.valid && !(session_.rows[row] & ROW_CHANGED))
+  {
+    session_.rows[row] |= ROW_CHANGED;
+    session_.changed.push_back(row);
+  }
+
+  vt_->Expanded[Node] = expanded;
+}
+
+void __fastcall VstSearcher::DoCollectMatches(std::vector<SearchHit>& hits)
+{
+  if (!vt_) return;
+
+  EnsureSearchCache();
+
+  // Matches are taken from the lazy search, the result of every row isn't kept
+  for (const auto& match : SearchCore(dataset_).Find(plan_, GetSearchColumns()))
+    hits.emplace_back(this, nodes_[match.row], match.matches);
+}
+
+HitCursor __fastcall VstSearcher::DoFindMatches()
+{
+  if (!vt_) return HitCursor();
+
+  EnsureSearchCache();
+
+  return HitCursor(this, SearchCore(dataset_).Find(plan_, GetSearchColumns()), nodes_, cacheEpoch_);
+}
+
+void __fastcall VstSearcher::ApplySearchResult()
+{
+  const auto roots = RootRows();
+
+  // During the session only the top-level nodes whose visibility differs
+  // from the previous request are touched
+
+  if (session_.valid)
+  {
+    (result_.roots - session_.shownRoots).ForEach([this, &roots](const std::uint32_t i)
+    {
+      SetRowVisible(roots[i], true);
+    });
+
+    (session_.shownRoots - result_.roots).ForEach([this, &roots](const std::uint32_t i)
+    {
+      SetRowVisible(roots[i], false);
+    });
+
+    session_.shownRoots = result_.roots;
+  }
+  else
+  {
+    for (std::size_t i = 0; i < roots.size(); i++)
+      SetRowVisible(roots[i], result_.roots.Contains(static_cast<std::uint32_t>(i)));
+  }
+
+  if (!SearchOptions.contains(SearchOption::AUTO_EXPAND_NODES))
+    return;
+
+  // Expand all child nodes with matches if AUTO_EXPAND_NODES option
+  // is specified, collapse the rest (matched rows are in ascending order)
+
+  std::size_t row = 0;
+
+  auto collapseUpTo = [this, &row](const std::size_t end)
+  {
+    for (; row < end; row++)
+    {
+      if (ParentRow(row) >= 0)
+        SetRowExpanded(row, false);
     }
-    else // Collapse
+  };
+
+  result_.rows.ForEach([this, &row, &collapseUpTo](const std::uint32_t matchedRow)
+  {
+    collapseUpTo(matchedRow);
+    row = matchedRow + 1;
+
+    for (int parent = ParentRow(matchedRow); parent >= 0; parent = ParentRow(parent))
+      SetRowExpanded(parent, true);
+  });
+
+  collapseUpTo(nodes_.size());
+}
+
+ArrayView<std::uint32_t> __fastcall VstSearcher::RootRows() const noexcept
+{
+  return cacheValid_ ? dataset_.Roots() : ArrayView<std::uint32_t>(cacheBuild_.roots);
+}
+
+int __fastcall VstSearcher::ParentRow(const unsigned row) const noexcept
+{
+  return cacheValid_ ? dataset_.Parent(row) : cacheBuild_.parents[row];
+}
+
+unsigned __fastcall VstSearcher::VisibleRowCount() const
+{
+  if (!cacheValid_)
+    return vt_->VisibleCount;
+
+  const auto roots = dataset_.Roots();
+
+  unsigned count = 0;
+
+  // Rows of a subtree follow its top-level row, so the subtree of a hidden
+  // or collapsed node is skipped at once
+
+  result_.roots.ForEach([this, &roots, &count](const std::uint32_t i)
+  {
+    const unsigned end = dataset_.SubtreeEnd(roots[i]);
+
+    for (unsigned row = roots[i]; row < end; )
     {
-      if (Node->States.Contains(vsExpanded))
-        Sender->Expanded[Node] = false;
+      const TVirtualNode* Node = nodes_[row];
+
+      if (!Node->States.Contains(vsVisible))
+      {
+        row = dataset_.SubtreeEnd(row);
+        continue;
+      }
+
+      count++;
+
+      row = Node->States.Contains(vsExpanded) ? row + 1 : dataset_.SubtreeEnd(row);
     }
+  });
+
+  return count;
+}
+
+std::string __fastcall VstSearcher::ResultContext(const std::vector<int>& columns) const
+{
+  std::string context = std::to_string(SearchOptionsMask());
+
+  for (const auto column : columns)
+    context += ',' + std::to_string(column);
+
+  return context;
+}
+
+std::size_t __fastcall VstSearcher::CacheMemoryUsage(const SearchCache cache) const
+{
+  switch (cache)
+  {
+    case SearchCache::RESULTS:
+      return results_.MemoryUsage() + parts_.MemoryUsage();
+
+    case SearchCache::HIGHLIGHTS:
+      return highlights_.MemoryUsage();
+
+    case SearchCache::INDEXES:
+      return dataset_.IndexMemoryUsage();
+
+    case SearchCache::DATA:
+      return dataset_.MemoryUsage() - dataset_.IndexMemoryUsage() +
+             nodes_.capacity() * sizeof(PVirtualNode) +
+             cacheBuild_.parents.capacity() * sizeof(int) +
+             cacheBuild_.roots.capacity() * sizeof(std::uint32_t) +
+             result_.MemoryUsage() +
+             session_.rows.capacity() * sizeof(std::uint8_t) +
+             session_.changed.capacity() * sizeof(unsigned) +
+             session_.roots.capacity() * sizeof(PVirtualNode) +
+             session_.expanded.capacity() * sizeof(PVirtualNode) +
+             session_.hidden.capacity() * sizeof(PVirtualNode) +
+             session_.shownRoots.MemoryUsage();
   }
 
-  // Add to the common matches counter amount
-  // of matches in the current node
+  return 0;
+}
+
+void __fastcall VstSearcher::EvictCache(const SearchCache cache)
+{
+  switch (cache)
+  {
+    case SearchCache::RESULTS:
+      results_.Clear();
+
+      parts_.Clear();
+      break;
+
+    case SearchCache::HIGHLIGHTS:
+      highlights_.Clear(); // Visible cells are laid out again on the next paint
+      break;
 
-	itData.matches->totalMatches += m.totalMatches;
+    case SearchCache::INDEXES:
+      dataset_.DropIndexes(); // Every row is checked, typed columns are parsed from the text
+      cacheEpoch_++;          // Cursors read the summaries
+      break;
 
-  if (m.wordsMatches > itData.matches->wordsMatches)
-    itData.matches->wordsMatches = m.wordsMatches;
+    case SearchCache::DATA:
+      break;
+  }
 }
 
 void __fastcall VstSearcher::ProcessRequest()
@@ -629,47 +1636,108 @@ void __fastcall VstSearcher::ProcessRequest()
     return;
   }
 
+  const auto startTime = std::chrono::steady_clock::now();
+
   try
   {
+    // While the cache is prewarmed the request is evaluated on the tree. Its nodes are collected
+    // at the start of the build (the build may attach the shared cache instead)
+
+    if (IsCachePrewarming() && !cacheBuild_.active)
+    {
+      BeginCacheBuild();
+
+      if (cacheValid_)
+      {
+        StopCachePrewarm();
+        ReportPrewarmProgress();
+      }
+    }
+
+    const bool useCache = !IsCachePrewarming();
+
+    if (useCache)
+      EnsureSearchCache();
+
+    // The state before the first request of the session is restored by the reset
+    if (!session_.active)
+      BeginSession();
+
+    // Nodes changed without the cache aren't recorded, the reset restores the saved nodes
+    if (!useCache)
+      session_.valid = false;
+
     AddWordsToList(edt_->Text);
 
-    vt_->OnCompareNodes = vstOnCompareNodes;
+    // Highlighted parts of cells depend on the request
+    highlights_.Clear();
 
-    TVirtualNode* Node = vt_->GetFirst();
-    vt_->ScrollIntoView(Node, false);
+    const std::vector<int> columns = GetSearchColumns();
 
-    vt_->BeginUpdate();
+    // Without the relevance sort the amounts of matches aren't needed (see EvaluationFor).
+    // A recent request (e.g. after the last character is erased) isn't evaluated again.
+    // Others are evaluated by column: the same request with other search columns is combined
+    // from the parts of the columns (only an added column is evaluated), and a request that refines
+    // the previous one (the next typed character) is evaluated where the previous one is found
 
-    while (Node)
+    if (useCache)
     {
-      Matches m;
-      TIterateData itD(this, &m);
+      const std::string request = AnsiString(edt_->Text).c_str();
+      const std::string context = ResultContext(columns);
 
-      vt_->IterateSubtree(Node, new TVTGetNodeProcRef(IterateSubtreeProc), &itD);
-
-      if (SearchOptions.contains(SearchOption::RELEVANT_SORT))
+      if (const SearchResult* cached = results_.Find(request, context))
       {
-        auto mit = matches_.find(Node);
-
-        if (mit != matches_.end())
-          mit->second = m;
-        else
-          matches_[Node] = m;
+        result_ = *cached;
       }
+      else
+      {
+        SearchCore(dataset_).RunByColumns(plan_, columns, parts_, result_, EvaluationFor(SearchOptionsMask()));
 
-      vt_->IsVisible[Node] = (m.totalMatches > 0);
-      Node = vt_->GetNextSibling(Node);
+        results_.Add(request, context, plan_, result_);
+      }
+    }
+    else
+    {
+      ScanTree(columns);
     }
 
+    vt_->ScrollIntoView(vt_->GetFirst(), false);
+
+    vt_->BeginUpdate();
+
+    const unsigned matchedRows  = result_.MatchedRows();
+    const unsigned visibleRoots = result_.VisibleRoots();
+
+    ApplySearchResult();
     RelevantSort();
 
+    const unsigned visibleCount = VisibleRowCount();
+
     String caption;
-    caption.printf(L"%d of %d", vt_->VisibleCount, vt_->TotalCount);
+    caption.printf(L"%u of %u", visibleCount, unsigned(vt_->TotalCount));
 
     SetLabelCaption(std::move(caption));
     vt_->EndUpdate();
 
-    vt_->OnCompareNodes = TVTDefaultCompareEvent;
+    if (IsTraceRecording())
+    {
+      TraceEvent event;
+
+      event.kind         = TraceEvent::Kind::SEARCH;
+      event.text         = AnsiString(edt_->Text).c_str();
+      event.options      = SearchOptionsMask();
+      event.columns      = columns;
+      event.duration     = std::chrono::duration_cast<std::chrono::microseconds>(
+                             std::chrono::steady_clock::now() - startTime).count();
+      event.totalRows    = vt_->TotalCount;
+      event.visibleRows  = visibleCount;
+      event.matchedRows  = matchedRows;
+      event.visibleRoots = visibleRoots;
+
+      RecordTraceEvent(std::move(event));
+    }
+
+    EnforceMemoryBudget();
   }
   catch (Exception& e)
   {
@@ -677,10 +1745,18 @@ void __fastcall VstSearcher::ProcessRequest()
       vt_->EndUpdate();
 
     ClearWordsList();
-    matches_.clear();
 
     Application->ShowException(&e);
   }
+  catch (const std::exception& e) // Invalid regular expression
+  {
+    if (vt_->IsUpdating())
+      vt_->EndUpdate();
+
+    ClearWordsList();
+
+    ShowPopupMessage(e.what());
+  }
 }
 
 Matches __fastcall VstSearcher::CountMatchesInColumn(TVirtualNode* Node, const int colIndex) const
@@ -688,96 +1764,276 @@ Matches __fastcall VstSearcher::CountMatchesInColumn(TVirtualNode* Node, const i
   if (colIndex >= vt_->Header->Columns->Count)
     throw Exception("Invalid search column index is specified");
 
-  return ISearcher::CountMatches(vt_->Text[Node][colIndex]);
+  return ISearcher::CountMatches(vt_->Text[Node][colIndex], colIndex);
 }
 
 Matches __fastcall VstSearcher::CountMatchesInNode(TVirtualNode* Node) const
 {
-  if (!Node)
-    throw Exception("Invalid arguments");
-
   Matches matches;
+  MatchNode(Node, matches);
+
+  return matches;
+}
+
+// Text of the node for the query plan. Text of a column is taken
+// from the tree only when the plan needs it and only once
+
+class TNodeRowText final : public IRowText
+{
+ public:
+
+  explicit TNodeRowText(TVirtualStringTree* const Tree, TVirtualNode* const Node, const std::vector<int>& Columns)
+      : vt_(Tree)
+      , node_(Node)
+      , columns_(Columns)
+  {};
+
+  std::string_view Text(const int column) override
+  {
+    for (const auto& text : texts_)
+    {
+      if (text.first == column)
+        return text.second;
+    }
+
+    if (column >= vt_->Header->Columns->Count)
+      throw Exception("Invalid search column index is specified");
+
+    std::string text = AnsiString(vt_->Text[node_][column]).c_str();
+    ToLower(text);
+
+    texts_.emplace_back(column, std::move(text));
+    return texts_.back().second;
+  }
+
+  const std::vector<int>& SearchColumns() const override
+  {
+    return columns_;
+  }
+
+ private:
+
+  TVirtualStringTree*     vt_;
+  TVirtualNode*           node_;
+  const std::vector<int>& columns_;
+
+  std::deque<std::pair<int, std::string>> texts_; // Deque keeps references valid
+};
+
+std::vector<int> __fastcall VstSearcher::GetSearchColumns() const
+{
+  std::vector<int> columns;
 
   if (!SearchColumns.empty())
   {
     for (auto it = SearchColumns.getData().cbegin(); it != SearchColumns.getData().cend(); it++)
-      matches += CountMatchesInColumn(Node, *it);
+      columns.push_back(*it);
+
+    std::sort(columns.begin(), columns.end());
   }
   else
   {
-    matches = ISearcher::CountMatches(vt_->Text[Node][-1]);
+    columns.push_back(-1);
   }
 
-  return matches;
+  return columns;
 }
 
-void __fastcall VstSearcher::HighlightTreeText(TCanvas* canvas, PVirtualNode Node,
-											   TColumnIndex Column, TRect &CellRect) const
+bool __fastcall VstSearcher::MatchNode(TVirtualNode* Node, Matches& matches) const
 {
-  // Don't highlight words in columns that wasn't added to the container
-  if (!SearchColumns.empty() && !SearchColumns.contains(Column))
-      return;
+  if (!Node)
+    throw Exception("Invalid arguments");
 
-  if (!vt_) return;
+  const std::vector<int> columns = GetSearchColumns();
+  TNodeRowText row(vt_, Node, columns);
 
-  for (const auto& word : words_)
+  return plan_.Evaluate(row, matches);
+}
+
+void __fastcall VstSearcher::ScanTree(const std::vector<int>& columns)
+{
+  const EvaluationMode mode = EvaluationFor(SearchOptionsMask());
+
+  const auto& roots = cacheBuild_.roots;
+
+  result_.Reset(nodes_.size(), roots.size(), mode);
+
+  // The same evaluation as SearchCore::Run() with the text got from the nodes
+  for (std::size_t i = 0; i < roots.size(); i++)
   {
-    TFont* NodeFont = new TFont();
-    TRect  displayRect;
-    String nodeText;
+    const std::size_t end = (i + 1 < roots.size()) ? roots[i + 1] : nodes_.size();
+
+    bool rootMatched = false;
+
+    for (unsigned row = roots[i]; row < end; row++)
+    {
+      TNodeRowText text(vt_, nodes_[row], columns);
+
+      if (mode != EvaluationMode::COUNT)
+      {
+        const bool isMatched = plan_.Satisfies(text);
+
+        if (isMatched)
+          result_.rows.Add(row);
 
-    vt_->GetTextInfo(Node, Column, NodeFont, displayRect, nodeText);
+        rootMatched |= isMatched;
 
-    std::string strNodeText   = AnsiString(nodeText).c_str();
-    std::string strSearchWord = word;
+        // Visibility of the top-level row is decided by its first matched row
+        if (isMatched && mode == EvaluationMode::ROOTS)
+          break;
 
-    canvas->Font = vt_->Font;
+        continue;
+      }
+
+      Matches& m = result_.rowMatches[row];
+      const bool isMatched = plan_.Evaluate(text, m);
 
-    bool isColumnFixed = false;
+      if (isMatched)
+        result_.rows.Add(row);
 
-    if (Column >= 0)
-      isColumnFixed = vt_->Header->Columns->Items[Column]->Options.Contains(coFixed);
+      rootMatched |= isMatched;
 
-    displayRect.Left += vt_->TextMargin - ((!isColumnFixed) ? vt_->OffsetX : 0);
+      Matches& rootMatches = result_.rootMatches[i];
 
-    std::string searchWordUpperCase = strSearchWord;
-    std::string nodeTextUpperCase   = strNodeText;
+      rootMatches.totalMatches += m.totalMatches;
+
+      if (m.wordsMatches > rootMatches.wordsMatches)
+        rootMatches.wordsMatches = m.wordsMatches;
+    }
 
-    std::transform(nodeTextUpperCase.begin(), nodeTextUpperCase.end(),
-                   nodeTextUpperCase.begin(), std::tolower);
-    std::transform(searchWordUpperCase.begin(), searchWordUpperCase.end(),
-                   searchWordUpperCase.begin(), std::tolower);
+    if (rootMatched)
+      result_.roots.Add(static_cast<std::uint32_t>(i));
+  }
+}
 
-    std::string::size_type wordStartPosInText = 0,
-                           iStartSearchFrom   = 0;
+bool __fastcall VstSearcher::ResolveColumn(const std::string& name, int& column) const
+{
+  if (!vt_) return false;
 
-    // The highlight logic is:
-    // 1) Finding position of search word (strSearchWord) in node text (strNodeText);
-    // 2) In order to determine the position CellRect.Left, we need to calculate the width
-    //    of the area (uncoloredStringPart) that is up to the position of our word (wordStartPosInText);
-    // 3) Determine the position of CellRect.Right like: position CellRect.Left + the width of colored area (coloredStringPart);
-    // 4) Move iterator iStartSearchFrom by the value of the searched word length;
-    // 5) Repeating (1-4) while having matches in node string.
+  const String colName = String(name.c_str()).LowerCase();
 
-    while ((wordStartPosInText = nodeTextUpperCase.find(searchWordUpperCase,
-                                                        iStartSearchFrom)) != std::string::npos)
+  for (int i = 0; i < vt_->Header->Columns->Count; i++)
+  {
+    if (vt_->Header->Columns->Items[i]->Text.LowerCase() == colName)
     {
-        std::string uncoloredStringPart = strNodeText.substr(0, wordStartPosInText);
-        std::string coloredStringPart   = strNodeText.substr(wordStartPosInText, strSearchWord.length());
+      column = i;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void __fastcall VstSearcher::OptimizeQueryPlan()
+{
+  // Selectivity of the terms is measured on the cached text of the tree
+  if (cacheValid_)
+    SearchCore(dataset_).Optimize(plan_, GetSearchColumns());
+  else
+    ISearcher::OptimizeQueryPlan();
+}
+
+namespace {
+
+// Measurement of text in the font selected into the canvas
+class GdiTextMeasurer final : public ITextMeasurer
+{
+ public:
+
+  explicit GdiTextMeasurer(TCanvas* canvas)
+      : canvas_(canvas)
+  {}
+
+  std::uint64_t FontKey() const override
+  {
+    TFont* font = canvas_->Font;
+
+    const std::uint64_t style = (font->Style.Contains(fsBold)      ? 1 : 0) | (font->Style.Contains(fsItalic)    ? 2 : 0) |
+                                (font->Style.Contains(fsUnderline) ? 4 : 0) | (font->Style.Contains(fsStrikeOut) ? 8 : 0);
+
+    const std::uint64_t name = std::hash<std::wstring>()(std::wstring(font->Name.c_str()));
+
+    return name ^ (static_cast<std::uint64_t>(font->Height & 0xFFFF) << 32) ^ (static_cast<std::uint64_t>(font->Charset) << 48) ^ (style << 56);
+  }
 
-        // To correctly highlight a word, it is necessary to take into account the text styles
-        canvas->Font->Style = NodeFont->Style;
+  void MeasureChars(std::array<int, 256>& widths) override
+  {
+    HDC dc = canvas_->Handle;
 
-        CellRect.Left   = displayRect.Left + CalculateTextWidth(canvas->Handle, uncoloredStringPart.c_str());
-        CellRect.Right  = CellRect.Left    + CalculateTextWidth(canvas->Handle, coloredStringPart.c_str());
+    if (GetCharWidth32A(dc, 0, 255, widths.data()))
+      return;
 
-        canvas->Brush->Color = TColor(0x73F1FF);
-        canvas->TextRect(CellRect, CellRect.Left, CellRect.Right, coloredStringPart.c_str());
+    for (unsigned c = 0; c < 256; c++)
+    {
+      const char character = static_cast<char>(c);
+      SIZE size {0, 0};
 
-        iStartSearchFrom = wordStartPosInText + strSearchWord.length();
+      GetTextExtentPoint32A(dc, &character, 1, &size);
+      widths[c] = size.cx;
     }
+  }
+
+ private:
+
+  TCanvas* canvas_;
+};
+
+} // namespace
+
+void __fastcall VstSearcher::HighlightTreeText(TCanvas* canvas, PVirtualNode Node,
+											   TColumnIndex Column, TRect &CellRect) const
+{
+  if (!vt_ || plan_.Empty()) return;
+
+  // Don't highlight words in columns that wasn't added to the container
+  // (except of words restricted to the column)
+
+  const bool isSearchColumn = SearchColumns.empty() || SearchColumns.contains(Column);
+
+  TFont* NodeFont = new TFont();
+  TRect  displayRect;
+  String nodeText;
+
+  vt_->GetTextInfo(Node, Column, NodeFont, displayRect, nodeText);
+
+  const std::string strNodeText = AnsiString(nodeText).c_str();
+
+  // To correctly highlight a word, it is necessary to take into account the text styles
+  canvas->Font        = vt_->Font;
+  canvas->Font->Style = NodeFont->Style;
+
+  delete NodeFont;
+
+  // The highlight logic is:
+  // 1) Taking position of the match (span) in node text (strNodeText);
+  // 2) CellRect.Left is the width of the text up to the match, CellRect.Right is CellRect.Left
+  //    + the width of the match. The widths are sums of the character widths of the font,
+  //    the layout of the cell is cached until the request is changed;
+  // 3) Repeating (1-2) for all matches in node string.
+
+  GdiTextMeasurer measurer(canvas);
+
+  const std::vector<HighlightRange>& ranges = highlights_.Ranges(Node, Column, strNodeText, plan_, isSearchColumn, measurer);
+
+  if (ranges.empty())
+    return;
+
+  bool isColumnFixed = false;
+
+  if (Column >= 0)
+    isColumnFixed = vt_->Header->Columns->Items[Column]->Options.Contains(coFixed);
+
+  displayRect.Left += vt_->TextMargin - ((!isColumnFixed) ? vt_->OffsetX : 0);
+
+  for (const auto& range : ranges)
+  {
+    const std::string coloredStringPart = strNodeText.substr(range.pos, range.length);
+
+    CellRect.Left   = displayRect.Left + range.left;
+    CellRect.Right  = displayRect.Left + range.right;
 
-    delete NodeFont;
+    canvas->Brush->Color = TColor(0x73F1FF);
+    canvas->TextRect(CellRect, CellRect.Left, CellRect.Right, coloredStringPart.c_str());
   }
 }
 } // namespace searcher
@@ -7,14 +7,26 @@
 
 #include "VirtualTrees.hpp"
 
+#include "src/SearchCore.h"
+#include "src/SearchHighlight.h"
+#include "src/SearchQuery.h"
+#include "src/SearchTrace.h"
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
 #include <unordered_set>
 #include <unordered_map>
+#include <vector>
+#include <deque>
+#include <memory>
 
 namespace searcher
 {
   constexpr unsigned MIN_SEARCH_REQUEST_LEN = 2;
   constexpr unsigned MAX_SEARCH_REQUEST_LEN = 128;
   constexpr unsigned DEFAULT_INPUT_DELAY 	  = 300; // ms
+  constexpr unsigned CACHE_PREWARM_SLICE    = 10;  // ms
 
   template <typename T>
   class ISet
@@ -43,14 +55,6 @@ namespace searcher
     std::unordered_set<T> data;
   };
 
-  // Search options
-  enum class SearchOption
-  {
-    AUTO_EXPAND_NODES,  		        // Automatic expanding nodes where matches are found
-    RELEVANT_SORT,     		          // Apply to the entire list sort by relevance
-    START_SEARCH_AFTER_BUTTON_CLICK // Start the search after pressing the corresponding button
-  };
-
   class TSearchOptions final : public ISet<SearchOption>
   {
    public:
@@ -65,35 +69,46 @@ namespace searcher
   {
    public:
 
+    TSearchColumns() = default;
+
+    /// @param[in] onChange - function called after a column is added or removed
+
+    explicit TSearchColumns(std::function<void()> onChange);
+
     void __fastcall add(unsigned&& iColumn) override;
     void __fastcall remove(unsigned&& iColumn) override;
-  };
 
-  struct Matches
-  {
-    unsigned totalMatches { 0 }; // Number of all matches in a row
-    unsigned wordsMatches { 0 }; // Number of matches in the line for the entered words
+    /// Method of setting the type of the column values (text by default). A term scoped
+    /// to a typed column is a condition on its values: amount:>1000, date:2026-10 (see ValueCondition)
+    ///
+    /// @param[in] iColumn - column index (the column doesn't have to be searched)
+    /// @param[in] type    - type of the values
 
-    Matches() = default;
+    void __fastcall setType(const unsigned iColumn, const ColumnType type);
 
-    explicit Matches(const unsigned a_totalMatches, const unsigned a_wordsMatches)
-        : totalMatches(a_totalMatches)
-        , wordsMatches(a_wordsMatches)
-    {}
+    ColumnType __fastcall getType(const unsigned iColumn) const noexcept;
+
+   private:
 
-    friend bool operator>(const Matches& lhs, const Matches& rhs);
-    friend bool operator<(const Matches& lhs, const Matches& rhs);
+    std::unordered_map<unsigned, ColumnType> types_; // Typed columns
 
-    Matches& operator+=(const Matches& rhs);
+    std::function<void()> onChange_;
   };
 
   class ISearcher;
 
+  // One-shot input delay timer. Every searcher owns its own timer,
+  // so several searchers can wait for the input at the same time
+
   class DelayTimer final
   {
    public:
 
     DelayTimer() = default;
+    ~DelayTimer();
+
+    DelayTimer(const DelayTimer&) = delete;
+    DelayTimer& operator=(const DelayTimer&) = delete;
 
     bool __fastcall isActive() const noexcept;
 
@@ -106,15 +121,160 @@ namespace searcher
 
    private:
 
-    static inline UINT_PTR   timer_ { 0 };
-    static inline ISearcher* owner_ { nullptr };
+    UINT_PTR   timer_ { 0 };
+    ISearcher* owner_ { nullptr };
+
+    static inline std::unordered_map<UINT_PTR, DelayTimer*> activeTimers_; // Timer id -> timer
+  };
+
+  // A match found by the cross-tree search
+  struct SearchHit
+  {
+    ISearcher*   searcher { nullptr }; // Searcher the node belongs to
+    PVirtualNode node     { nullptr };
+    Matches      matches;
+
+    SearchHit() = default;
+
+    explicit SearchHit(ISearcher* const a_searcher, PVirtualNode a_node, const Matches& a_matches)
+        : searcher(a_searcher)
+        , node(a_node)
+        , matches(a_matches)
+    {}
+  };
+
+  // Lazy sequence of the nodes that satisfy a request (see ISearcher::FindMatches).
+  // Nodes are evaluated as the cursor is advanced. The cursor ends (finds nothing more) when the cache
+  // it reads is rebuilt: the tree is changed, the cache is rebuilt or its indexes are dropped.
+  // The searcher must outlive the cursor
+
+  class HitCursor
+  {
+   public:
+
+    HitCursor() = default;
+
+    /// @param[in] searcher   - searcher of the tree
+    /// @param[in] rows       - lazy search over the cache of the searcher
+    /// @param[in] nodes      - nodes of the rows of the cache
+    /// @param[in] cacheEpoch - counter of the searcher changed when the cache is rebuilt
+
+    explicit HitCursor(ISearcher* const searcher, SearchCursor&& rows, const std::vector<TVirtualNode*>& nodes,
+                       const unsigned& cacheEpoch)
+        : searcher_(searcher)
+        , rows_(std::move(rows))
+        , nodes_(&nodes)
+        , cacheEpoch_(&cacheEpoch)
+        , epoch_(cacheEpoch)
+    {}
+
+    /// Method of finding the next matched node
+    ///
+    /// @param[out] hit - the node and its matches
+    /// @return         - false if there are no more matched nodes
+
+    bool __fastcall Next(SearchHit& hit);
+
+    /// Method of taking the next matched nodes
+    ///
+    /// @param[in] count - max. amount of nodes
+    /// @return          - matched nodes in the tree order
+
+    std::vector<SearchHit> __fastcall Take(const std::size_t count);
+
+    /// Amount of the remaining matched nodes (the cursor is exhausted)
+    std::size_t __fastcall Count();
+
+   private:
+
+    /// Method of checking whether the cache is the one the cursor was created on
+    /// (otherwise the cursor is ended: its rows and nodes are gone)
+    bool __fastcall IsValid();
+
+   private:
+
+    ISearcher*                        searcher_ { nullptr };
+    SearchCursor                      rows_;
+    const std::vector<TVirtualNode*>* nodes_ { nullptr }; // Nodes of the dataset rows (nullptr - the cursor is ended)
+
+    const unsigned* cacheEpoch_ { nullptr };
+    unsigned        epoch_      { 0 }; // Epoch of the cache the cursor was created on
+  };
+
+  // Caches of a searcher in the order they're dropped when the memory budget is exceeded
+  enum class SearchCache
+  {
+    RESULTS,    // Results of the recent requests
+    HIGHLIGHTS, // Layouts of the highlighted cells
+    INDEXES,    // Subtree summaries and values of typed columns (the search is slower without them)
+    DATA        // Cached text of the tree, the current result and the search session (never dropped)
+  };
+
+  // Memory used by a cache of a searcher
+  struct CacheUsage
+  {
+    SearchCache cache { SearchCache::DATA };
+    std::size_t bytes { 0 };
+  };
+
+  // Search executor shared by all searchers of the process.
+  // Requests are queued and processed one by one in the order of submission
+  // (a searcher is never queued twice, so a fast typist can't starve the others),
+  // control returns to the message loop between two requests
+
+  class SearchExecutor final
+  {
+   public:
+
+    static SearchExecutor& __fastcall Instance();
+
+    SearchExecutor(const SearchExecutor&) = delete;
+    SearchExecutor& operator=(const SearchExecutor&) = delete;
+
+    void __fastcall Register(ISearcher* const searcher);
+    void __fastcall Unregister(ISearcher* const searcher) noexcept;
+
+    /// Method of queuing the search request of the searcher
+    ///
+    /// @param[in] searcher - searcher whose ProcessRequest() will be called
+
+    void __fastcall Submit(ISearcher* const searcher);
+
+    /// Method of removing the searcher request from the queue (if any)
+    void __fastcall Cancel(ISearcher* const searcher) noexcept;
+
+    bool __fastcall IsPending(ISearcher* const searcher) const noexcept;
+
+    /// Method of searching in all registered searchers at once.
+    /// Neither trees nor current searchers requests are changed
+    ///
+    /// @param[in] request - search request
+    /// @param[in] maxHits - max. amount of returned hits (0 - unlimited)
+    /// @return            - matched nodes of all trees, the most relevant first
+
+    std::vector<SearchHit> __fastcall SearchAll(const String& request, const std::size_t maxHits = 0) const;
+
+   private:
+
+    SearchExecutor() = default;
+
+    void __fastcall Schedule();
+
+    static void __stdcall DispatchProc(HWND hwnd, UINT uMsg, UINT_PTR idEvent, DWORD dwTime);
+
+   private:
+
+    std::vector<ISearcher*> searchers_; // Registered searchers (in the order of registration)
+    std::deque<ISearcher*>  queue_;     // Searchers waiting for processing their requests
+
+    UINT_PTR dispatchTimer_ { 0 };
   };
 
 	class ISearcher
 	{
    public:
 
-    TSearchColumns SearchColumns; // Columns that will be searched for
+    TSearchColumns SearchColumns { [this] { SearchColumnsChanged(); } }; // Columns that will be searched for (a change repeats the search)
     TSearchOptions SearchOptions; // Search options
 
    public:
@@ -129,7 +289,9 @@ namespace searcher
     /// Method of resetting search results
     virtual void __fastcall ResetSearchResults() = 0;
 
-    /// Method of adding words from the search bar to the container
+    /// Method of adding words from the search bar to the container.
+    /// The string is parsed and compiled into the query plan (see QueryPlan for the grammar),
+    /// with REGEX_SEARCH option the whole string is a regular expression
     ///
     /// @param[in] searchWords - a string with all entered words
 
@@ -161,6 +323,46 @@ namespace searcher
 
     void __fastcall SetInputDelay(const unsigned delay) noexcept;
 
+    /// Method of collecting matches of the request without changing the tree
+    /// and the current search request
+    ///
+    /// @param[in]  request - search request
+    /// @param[out] hits    - container the matched nodes are added to
+
+    void __fastcall CollectMatches(const String& request, std::vector<SearchHit>& hits);
+
+    /// Method of searching the request lazily without changing the tree and the current
+    /// search request: "is there any match" (Next()), "first N" (Take()) or "how many" (Count())
+    /// cost only the nodes evaluated before the consumer stops
+    ///
+    /// @param[in] request - search request
+    /// @return            - cursor over the matched nodes (in the tree order)
+
+    HitCursor __fastcall FindMatches(const String& request);
+
+    /// Method of starting recording of the search string events (entered text, keys,
+    /// processed requests with their results and durations) to a trace file.
+    /// The trace can be replayed by tools/SearchReplay against a snapshot of the tree
+    ///
+    /// @param[in] fileName - trace file name
+
+    void __fastcall StartTraceRecording(const String& fileName);
+    void __fastcall StopTraceRecording() noexcept;
+
+    bool __fastcall IsTraceRecording() const noexcept;
+
+    /// Method of setting the memory budget of the searcher caches. When the caches exceed it,
+    /// they're dropped in the order of SearchCache (results, highlights, indexes) until the usage fits
+    ///
+    /// @param[in] bytes - budget (0 - unlimited)
+
+    void __fastcall SetMemoryBudget(const std::size_t bytes);
+
+    std::size_t __fastcall GetMemoryBudget() const noexcept;
+
+    /// Memory used by every cache of the searcher (in the order of SearchCache)
+    std::vector<CacheUsage> __fastcall GetMemoryUsage() const;
+
    private:
 
     unsigned minRequestLen_ { MIN_SEARCH_REQUEST_LEN }; // Minimum search query length (default = MIN_SEARCH_REQUEST_LEN)
@@ -169,6 +371,10 @@ namespace searcher
 
     DelayTimer timer_;
 
+    std::size_t memoryBudget_ { 0 }; // Memory budget of the caches (0 - unlimited)
+
+    std::unique_ptr<TraceWriter> trace_; // Trace of the search string events (if it's recorded)
+
     void __fastcall (__closure *TEditDefaultOnChange)(TObject *Sender);
     void __fastcall (__closure *TEditDefaultOnKeyPress)(TObject *Sender, System::WideChar &Key);
     void __fastcall (__closure *TEditDefaultOnKeyUp)(TObject *Sender, WORD &Key, TShiftState Shift);
@@ -179,9 +385,16 @@ namespace searcher
     void __fastcall edtOnKeyUp(TObject *Sender, WORD &Key, TShiftState Shift);
     void __fastcall edtOnRightButtonClick(TObject *Sender);
 
+    /// Method of calling the function with the request compiled instead of the current one
+    /// (the current request is restored after that)
+    template <typename Function>
+    void __fastcall WithRequest(const String& request, Function function);
+
    protected:
 
-    std::unordered_set<std::string> words_;  // Container with words
+    std::unordered_set<std::string> words_;  // Container with words (positive terms of the request)
+
+    QueryPlan plan_; // Compiled search request
 
     TButtonedEdit*   edt_;   // Search 'string'
     TLabel*	         lbl_;   // Label 'Total:' (optional)
@@ -199,12 +412,51 @@ namespace searcher
 
     /// Method for counting matches in a row
     ///
-    /// @param[in] sText - the string in which you want to count the number of matches
+    /// @param[in] sText  - the string in which you want to count the number of matches
+    /// @param[in] column - index of the column the string belongs to
+
+    Matches __fastcall CountMatches(const String& sText, const int column = -1) const noexcept;
+
+    /// Method of getting the column index by its name (for 'col:term' in the request)
+    ///
+    /// @param[in]  name   - column name
+    /// @param[out] column - column index
+    /// @return            - whether the column is found
 
-    Matches __fastcall CountMatches(const String& sText) const noexcept;
+    virtual bool __fastcall ResolveColumn(const std::string& name, int& column) const;
+
+    /// Method of ordering the query plan clauses (after the request is parsed)
+    virtual void __fastcall OptimizeQueryPlan();
 
     /// The method of sorting by relevance
-    virtual void __fastcall RelevantSort() noexcept = 0;
+    virtual void __fastcall RelevantSort() = 0;
+
+    /// Method of collecting matches of the current words list
+    ///
+    /// @param[out] hits - container the matched nodes are added to
+
+    virtual void __fastcall DoCollectMatches(std::vector<SearchHit>& hits) = 0;
+
+    /// Method of starting the lazy search of the current words list
+    virtual HitCursor __fastcall DoFindMatches() = 0;
+
+    /// Method of writing the event to the trace (if it's recorded)
+    void __fastcall RecordTraceEvent(TraceEvent&& event);
+
+    /// Memory used by the cache (bytes)
+    virtual std::size_t __fastcall CacheMemoryUsage(const SearchCache cache) const = 0;
+
+    /// Method of dropping the cache (DATA isn't dropped)
+    virtual void __fastcall EvictCache(const SearchCache cache) = 0;
+
+    /// Method of dropping the caches while their memory usage exceeds the budget
+    void __fastcall EnforceMemoryBudget();
+
+    /// Method of repeating the entered search after the search columns are changed
+    void __fastcall SearchColumnsChanged();
+
+    /// Mask of the current search options (see OptionBit())
+    unsigned __fastcall SearchOptionsMask() const;
 
     /// Method of displaying messages in a popup
     ///
@@ -224,21 +476,38 @@ namespace searcher
     int __fastcall CalculateTextWidth(HANDLE handle, const char* text) const;
 	};
 
+  class VstSearcher;
+
+  /// Progress of the cache prewarm (see VstSearcher::StartCachePrewarm)
+  ///
+  /// @param[in] Sender    - searcher whose cache is built
+  /// @param[in] rows      - rows already cached
+  /// @param[in] totalRows - rows of the tree (rows == totalRows - the cache is ready)
+
+  typedef void __fastcall (__closure *TCachePrewarmEvent)(VstSearcher* Sender, const unsigned rows, const unsigned totalRows);
+
   // Searcher for VirtualStringTree (VirtualTreeView)
   class VstSearcher final : public ISearcher
   {
+   public:
+
+    TCachePrewarmEvent OnCachePrewarm { nullptr }; // Progress of the cache prewarm (optional)
+
    public:
 
     VstSearcher() : ISearcher() {};
-    explicit VstSearcher(TVirtualStringTree *Tree, TButtonedEdit *Edit, TLabel *Label = nullptr);
+    explicit VstSearcher(TVirtualStringTree *Tree, TButtonedEdit *Edit, TLabel *Label = nullptr, const bool prewarmCache = false);
+
+    ~VstSearcher() override;
 
     /// Method for initializing objects required for the search operation
     ///
-    /// @param[in] Tree  - pointer to VST
-    /// @param[in] Edit  - search 'string'
-    /// @param[in] Label - label 'Total:' (optional)
+    /// @param[in] Tree         - pointer to VST
+    /// @param[in] Edit         - search 'string'
+    /// @param[in] Label        - label 'Total:' (optional)
+    /// @param[in] prewarmCache - start building the search cache in the background (see StartCachePrewarm)
 
-    void __fastcall Init(TVirtualStringTree *Tree, TButtonedEdit *Edit, TLabel *Label = nullptr);
+    void __fastcall Init(TVirtualStringTree *Tree, TButtonedEdit *Edit, TLabel *Label = nullptr, const bool prewarmCache = false);
 
     void __fastcall ProcessRequest() override;
     void __fastcall ResetSearchResults() override;
@@ -259,8 +528,47 @@ namespace searcher
 
     Matches __fastcall CountMatchesInColumn(TVirtualNode* Node, const int colIndex) const;
 
+    /// Method of evaluating the search request on the node
+    ///
+    /// @param[in]  Node    - pointer to Node
+    /// @param[out] matches - amount of matches
+    /// @return             - whether the node satisfies the request
+
+    bool __fastcall MatchNode(TVirtualNode* Node, Matches& matches) const;
+
     void __fastcall HighlightTreeText(TCanvas* canvas, PVirtualNode Node, TColumnIndex Column, TRect &CellRect) const;
 
+    /// Method of dropping the cached text of the tree. The cache is dropped automatically
+    /// when the tree structure is changed, call it when the text of nodes is changed
+    void __fastcall InvalidateSearchCache() noexcept;
+
+    /// Method of saving the searchable text of the tree to a snapshot file
+    /// (used for replaying search traces, see tools/SearchReplay)
+    ///
+    /// @param[in] fileName - snapshot file name
+
+    void __fastcall SaveSnapshot(const String& fileName);
+
+    /// Method of sharing the search cache between processes that show the same tree
+    /// (e.g. instances of the application on a terminal server). The first process builds
+    /// the cache and publishes it to shared memory, the others attach to it instead of building
+    /// their own one. A published cache that doesn't match the tree is ignored; a process whose
+    /// tree is changed after that builds a private cache
+    ///
+    /// @param[in] name - name of the shared memory (empty - the cache isn't shared)
+
+    void __fastcall ShareSearchCache(const String& name);
+
+    /// Method of building the search cache in the background, so the first request doesn't wait
+    /// for it. The cache is built in small chunks while the application is idle (the input and
+    /// painting go first), the progress is reported by OnCachePrewarm. Until the cache is ready
+    /// requests are evaluated on the nodes of the tree, then the cache is used.
+    /// A change of the tree structure restarts the build
+    void __fastcall StartCachePrewarm();
+    void __fastcall StopCachePrewarm() noexcept;
+
+    bool __fastcall IsCachePrewarming() const noexcept;
+
    private:
 
     int defaultSortColumn_;
@@ -268,39 +576,160 @@ namespace searcher
 
     TVirtualStringTree* vt_;
 
-    std::unordered_map<TVirtualNode*, Matches> matches_;
+    SearchDataset              dataset_;              // Cached text of the tree (in the tree order)
+    std::vector<TVirtualNode*> nodes_;                // Nodes of the dataset rows
+    bool                       cacheValid_ { false }; // The dataset corresponds to the tree
+    unsigned                   cacheEpoch_ { 0 };     // Changed when the nodes or the rows of the cache are replaced (see HitCursor)
+    bool                       movingNodes_ { false }; // The searcher reorders nodes itself (the cache stays valid)
 
-   private:
+    std::string sharedCacheName_;                  // Name of the shared cache (empty - the cache is private)
+    bool        sharedCacheDetached_ { false };    // The tree was changed after the shared cache was built (or doesn't match it)
+
+    // State of the cache being built: rows are added to the dataset in the tree order,
+    // a prewarm adds them in chunks (the nodes themselves are collected at once)
 
-    // This class needs for VST->IterateSubTree
-    class TVTGetNodeProcRef : public TCppInterfacedObject<TVTGetNodeProc>
+    struct CacheBuild
     {
-     private:
+      bool                       active { false }; // Nodes are collected, rows are being added
+      std::vector<int>           parents;          // Every row: index of the parent row
+      std::vector<std::uint32_t> roots;            // Top-level rows
+      std::size_t                row    { 0 };     // Next row to add
+    };
+
+    CacheBuild cacheBuild_;
+    UINT_PTR   prewarmTimer_ { 0 };
+
+    static inline std::unordered_map<UINT_PTR, VstSearcher*> prewarmTimers_; // Timer id -> searcher
+
+    SearchResult result_;  // Result of the last request
+    ResultCache  results_; // Results of the recent requests
 
-      typedef void __fastcall
-      (*TIterateSubtreeCallBack)(TBaseVirtualTree*, PVirtualNode Node, void *Data, bool &Abort);
+    // Parts of the result of the last evaluated request by column: when only the search
+    // columns are changed, the added columns are evaluated and the rest is reused
+
+    ColumnParts parts_;
+
+    mutable HighlightLayouts highlights_; // Highlighted parts of the painted cells (for the current request)
+
+    // State of the tree before the search session (from the first request after a reset
+    // to the next reset), the reset restores only what the search has changed
+
+    struct SearchSession
+    {
+      bool active      { false };
+      bool valid       { false }; // The cache wasn't rebuilt during the session
+      bool treeChanged { false }; // Nodes were added or deleted during the session (the saved nodes may be gone)
+      bool reordered   { false }; // Top-level nodes were sorted by relevance
 
-      TIterateSubtreeCallBack Callback;
+      int sortColumn { -1 };
+      typename Virtualtrees::TSortDirection sortDirection;
 
-     public:
+      std::vector<TVirtualNode*> roots;   // Order of the top-level nodes
+      std::vector<std::uint8_t>  rows;    // Every row: state flags (see VstSearcher.cpp)
+      std::vector<unsigned>      changed; // Rows changed by the search
 
-      TVTGetNodeProcRef(TIterateSubtreeCallBack _callback) : Callback(_callback)
-      {};
+      // Expanded and hidden nodes: the state is restored by them when its rows
+      // don't match the cache (it was built or rebuilt during the session)
 
-      INTFOBJECT_IMPL_IUNKNOWN(TInterfacedObject);
+      std::vector<TVirtualNode*> expanded;
+      std::vector<TVirtualNode*> hidden;
 
-      void __fastcall Invoke(TBaseVirtualTree* Sender, TVirtualNode *Node, void *Data, bool &Abort) override
-      {
-        return Callback(Sender, Node, Data, Abort);
-      }
+      RowBitmap shownRoots; // Visible top-level rows (indexes in Roots()) after the last request
     };
 
+    SearchSession session_;
+
+   private:
+
+    /// Types of the columns of the tree (see TSearchColumns::setType)
+    std::vector<ColumnType> __fastcall GetColumnTypes() const;
+
+    /// Method of caching the text of all nodes of the tree
+    /// (the rows added by the running prewarm are kept)
+    void __fastcall BuildSearchCache();
+
+    /// Steps of building the cache: collecting the nodes (or attaching to the shared cache),
+    /// adding the text of the rows until the deadline, finishing the dataset
+    ///
+    /// @param[in] deadline - time the rows are added until
+    /// @return             - whether all rows are added
+
+    void __fastcall BeginCacheBuild();
+    bool __fastcall AddCacheRows(const std::chrono::steady_clock::time_point deadline);
+    void __fastcall FinishCacheBuild();
+
+    /// Method of building the next chunk of the cache (called by the prewarm timer)
+    void __fastcall ContinueCachePrewarm();
+
+    /// Method of calling OnCachePrewarm with the current progress
+    void __fastcall ReportPrewarmProgress();
+
+    static void __stdcall PrewarmProc(HWND hwnd, UINT uMsg, UINT_PTR idEvent, DWORD dwTime);
+
+    /// Method of evaluating the request right on the nodes of the tree into result_ (while the cache
+    /// isn't ready). Rows of the result are the rows collected by the cache build
+    ///
+    /// @param[in] columns - search columns
+
+    void __fastcall ScanTree(const std::vector<int>& columns);
+
+    /// Method of building the cache if it's invalid or doesn't match the search options
+    void __fastcall EnsureSearchCache();
+
+    /// Method of attaching to the shared cache if it's built from the same tree
+    ///
+    /// @param[in] captions - captions of the columns
+    /// @param[in] parents  - every row: index of the parent row
+    /// @return             - whether the shared cache is used
+
+    bool __fastcall AttachSharedCache(const std::vector<std::string>& captions, const std::vector<int>& parents);
+
+    /// Method of applying result_ to the tree (visibility, expanding of nodes)
+    void __fastcall ApplySearchResult();
+
+    /// Structure of the rows of result_: of the cache, or of the cache being built
+    /// (its nodes and their parents are collected at the start of the build)
+
+    ArrayView<std::uint32_t> __fastcall RootRows() const noexcept;
+    int __fastcall ParentRow(const unsigned row) const noexcept;
+
+    /// Amount of the visible nodes after the result is applied: the subtrees of the shown
+    /// top-level nodes are counted down to the collapsed nodes (without the cache the tree counts them)
+    unsigned __fastcall VisibleRowCount() const;
+
+    /// Methods of saving the state of the tree at the start of the search session
+    /// and of restoring the changed nodes at the end of it
+
+    void __fastcall BeginSession();
+    void __fastcall RestoreSession();
+
+    /// Method of restoring the state of the tree by the saved nodes (the rows of the state don't match the cache)
+    void __fastcall RestoreSessionNodes();
+
+    /// Method of restoring the order of the top-level nodes and the sort of the tree
+    void __fastcall RestoreSessionOrder();
+
+    /// Methods of changing the node of the row (the change is recorded in the session)
+    void __fastcall SetRowVisible(const unsigned row, const bool visible);
+    void __fastcall SetRowExpanded(const unsigned row, const bool expanded);
+
+    /// Everything the result of a request in results_ depends on besides the request (options, columns)
+    std::string __fastcall ResultContext(const std::vector<int>& columns) const;
+
+    /// Columns searched by the terms that aren't restricted to a column
+    std::vector<int> __fastcall GetSearchColumns() const;
+
+    bool __fastcall ResolveColumn(const std::string& name, int& column) const override;
+    void __fastcall OptimizeQueryPlan() override;
+
+    std::size_t __fastcall CacheMemoryUsage(const SearchCache cache) const override;
+    void __fastcall EvictCache(const SearchCache cache) override;
+
     void __fastcall ShowAllRecords() noexcept;
-    void __fastcall RelevantSort() noexcept override;
+    void __fastcall RelevantSort() override;
+    void __fastcall DoCollectMatches(std::vector<SearchHit>& hits) override;
+    HitCursor __fastcall DoFindMatches() override;
 
-    void __fastcall (__closure *TVTDefaultCompareEvent)(TBaseVirtualTree* Sender,
-                                                        PVirtualNode Node1, PVirtualNode Node2,
-                                                        TColumnIndex Column, int &Result);
     void __fastcall (__closure *TVTDefaultBeforeCellPaintEvent)(TBaseVirtualTree* Sender,
                                                                 Vcl::Graphics::TCanvas* TargetCanvas,
                                                                 PVirtualNode Node, TColumnIndex Column,
@@ -308,9 +737,8 @@ namespace searcher
                                                                 const System::Types::TRect &CellRect,
                                                                 System::Types::TRect &ContentRect);
     void __fastcall (__closure *TVTDefaultHeaderClick)(TVTHeader* Sender, const TVTHeaderHitInfo &HitInfo);
+    void __fastcall (__closure *TVTDefaultStructureChange)(TBaseVirtualTree* Sender, PVirtualNode Node, TChangeReason Reason);
 
-    void __fastcall vstOnCompareNodes(TBaseVirtualTree *Sender, PVirtualNode Node1,
-                                      PVirtualNode Node2, TColumnIndex Column, int &Result);
     void __fastcall vstOnBeforeCellPaint(TBaseVirtualTree* Sender,
                                        Vcl::Graphics::TCanvas* TargetCanvas,
                                        PVirtualNode Node, TColumnIndex Column,
@@ -318,6 +746,7 @@ namespace searcher
                                        const System::Types::TRect &CellRect,
                                        System::Types::TRect &ContentRect);
     void __fastcall vstOnHeaderClick(TVTHeader* Sender, const TVTHeaderHitInfo &HitInfo);
+    void __fastcall vstOnStructureChange(TBaseVirtualTree* Sender, PVirtualNode Node, TChangeReason Reason);
   };
 }; // namespace searcher
 
@@ -0,0 +1,1485 @@
+﻿// Tests of the headless search core (plain checks, no framework): the tests build
+// their data in memory and compare the optimized paths with the simple ones.
+//
+// Build and run (from the repository root):
+//   g++ -std=c++17 -O2 -I. tests/SearchTests.cpp src/SearchCore.cpp src/SearchQuery.cpp
+//       src/SearchRegex.cpp src/SearchMultiPattern.cpp src/SearchSummary.cpp
+//       src/SearchCompression.cpp src/SearchShared.cpp src/SearchValues.cpp
+//       src/SearchBitmap.cpp src/SearchHighlight.cpp -o SearchTests && ./SearchTests
+
+#include "src/SearchCore.h"
+#include "src/SearchHighlight.h"
+#include "src/SearchShared.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <numeric>
+#include <random>
+#include <regex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace searcher;
+
+namespace {
+
+unsigned failures = 0;
+
+#define CHECK(condition)                                                        \
+  do                                                                            \
+  {                                                                             \
+    if (!(condition))                                                           \
+    {                                                                           \
+      std::printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+      failures++;                                                               \
+    }                                                                           \
+  } while (false)
+
+const char* const WORDS[] = { "invoice", "inventory", "order", "payment", "delivery", "invalid", "report", "contract" };
+
+const char* const REQUESTS[] = { "inv", "+inv +12", "order -c1", "-inv", "inv OR pay -c2", "code:c12", "+code:c12 +inv",
+                                 "note:order inv", "rep con", "\"invoice 12\"", "+c1 -note:pay" };
+
+const EvaluationMode MODES[] = { EvaluationMode::COUNT, EvaluationMode::ROWS, EvaluationMode::ROOTS };
+
+// Tree of the top-level rows with 19 children each, the same for the same seed
+void BuildDataset(SearchDataset& dataset, const unsigned seed, const unsigned rowCount)
+{
+  std::mt19937 random(seed);
+  std::vector<std::string> texts(3);
+
+  dataset.SetColumns({ "name", "code", "note" }, 0);
+
+  for (unsigned row = 0; row < rowCount; row++)
+  {
+    texts[0] = std::string(WORDS[random() % 8]) + " " + std::to_string(random() % 10000);
+    texts[1] = "c" + std::to_string(random() % 500);
+    texts[2] = std::string(WORDS[random() % 8]) + " c" + std::to_string(random() % 50);
+
+    dataset.AddRow((row % 20 != 0) ? static_cast<int>(row - row % 20) : -1, texts);
+  }
+
+  dataset.Finish();
+}
+
+// Tree of random depth: every top-level row has its group word in the notes of its subtree,
+// so the summaries of most subtrees don't contain the group words of the others
+
+void BuildDeepDataset(SearchDataset& dataset, const unsigned seed, const unsigned rowCount)
+{
+  std::mt19937 random(seed);
+  std::vector<std::string> texts(3);
+  std::vector<unsigned>    path; // Rows from the top-level one to the parent of the next row
+
+  dataset.SetColumns({ "name", "code", "note" }, 0);
+
+  unsigned group = 0;
+
+  for (unsigned row = 0; row < rowCount; row++)
+  {
+    if (row == 0 || random() % 24 == 0)
+    {
+      path.clear();
+      group++;
+    }
+    else
+    {
+      while (path.size() > 1 && random() % 3 == 0)
+        path.pop_back();
+    }
+
+    texts[0] = std::string(WORDS[random() % 8]) + " " + std::to_string(random() % 10000);
+    texts[1] = "c" + std::to_string(random() % 500);
+    texts[2] = (random() % 10 == 0) ? "\xf1\xf7\xe5\xf2 g" + std::to_string(group) : "note g" + std::to_string(group);
+
+    dataset.AddRow(path.empty() ? -1 : static_cast<int>(path.back()), texts);
+
+    if (path.size() < 6)
+      path.push_back(row);
+  }
+
+  dataset.Finish();
+}
+
+bool SameMatches(const std::vector<Matches>& lhs, const std::vector<Matches>& rhs)
+{
+  return std::equal(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(), [](const Matches& a, const Matches& b)
+  {
+    return a.totalMatches == b.totalMatches && a.wordsMatches == b.wordsMatches;
+  });
+}
+
+bool SameResult(const SearchResult& lhs, const SearchResult& rhs)
+{
+  return lhs.rows == rhs.rows && lhs.roots == rhs.roots &&
+         SameMatches(lhs.rowMatches, rhs.rowMatches) && SameMatches(lhs.rootMatches, rhs.rootMatches);
+}
+
+SearchResult Search(const SearchDataset& dataset, const char* const request, const std::vector<int>& columns,
+                    const EvaluationMode mode)
+{
+  QueryPlan plan;
+  plan.Parse(request, [&dataset](const std::string& name, int& column) { return dataset.ResolveColumn(name, column); });
+
+  SearchCore core(dataset);
+  core.Optimize(plan, columns);
+
+  SearchResult result;
+  core.Run(plan, columns, result, mode);
+
+  return result;
+}
+
+// Row of the texts copied from the dataset: the plan is evaluated on the plain text,
+// without the compressed codes, the interned values and the stored values of typed columns
+class PlainRow final : public IRowText
+{
+ public:
+
+  std::vector<std::string> texts;
+
+  explicit PlainRow(const std::vector<int>& columns)
+      : columns_(columns)
+  {}
+
+  std::string_view Text(const int column) override
+  {
+    return (column >= 0 && static_cast<std::size_t>(column) < texts.size()) ? texts[column] : std::string_view();
+  }
+
+  const std::vector<int>& SearchColumns() const override
+  {
+    return columns_;
+  }
+
+ private:
+
+  const std::vector<int>& columns_;
+};
+
+// Result of evaluating the plan on every row one by one (no summaries, no selection by values)
+SearchResult PlainSearch(const SearchDataset& dataset, const QueryPlan& plan, const std::vector<int>& columns,
+                         const EvaluationMode mode)
+{
+  const auto& roots = dataset.Roots();
+
+  SearchResult result;
+  result.Reset(dataset.RowCount(), roots.size(), mode);
+
+  PlainRow view(columns);
+  view.texts.resize(dataset.ColumnCount());
+
+  for (std::size_t i = 0; i < roots.size(); i++)
+  {
+    bool rootMatched = false;
+
+    for (unsigned row = roots[i]; row < dataset.SubtreeEnd(roots[i]); row++)
+    {
+      for (std::size_t column = 0; column < view.texts.size(); column++)
+        view.texts[column] = std::string(dataset.Text(row, static_cast<int>(column)));
+
+      Matches m;
+      const bool isMatched = (mode == EvaluationMode::COUNT) ? plan.Evaluate(view, m) : plan.Satisfies(view);
+
+      if (isMatched)
+        result.rows.Add(row);
+
+      rootMatched |= isMatched;
+
+      if (mode == EvaluationMode::COUNT)
+      {
+        result.rowMatches[row] = m;
+
+        result.rootMatches[i].totalMatches += m.totalMatches;
+        result.rootMatches[i].wordsMatches  = std::max(result.rootMatches[i].wordsMatches, m.wordsMatches);
+      }
+      else if (isMatched && mode == EvaluationMode::ROOTS)
+      {
+        break;
+      }
+    }
+
+    if (rootMatched)
+      result.roots.Add(static_cast<std::uint32_t>(i));
+  }
+
+  return result;
+}
+
+// Clauses of the plan in its order: +/- prefix, alternatives separated by '|', a scoped term is prefixed with the column
+std::string Describe(const QueryPlan& plan)
+{
+  std::string description;
+
+  for (const auto& clause : plan.Clauses())
+  {
+    if (!description.empty())
+      description += ' ';
+
+    if (clause.occur != TermOccur::SHOULD)
+      description += (clause.occur == TermOccur::MUST) ? '+' : '-';
+
+    for (std::size_t i = 0; i < clause.terms.size(); i++)
+    {
+      const QueryTerm& term = clause.terms[i];
+
+      if (i > 0)
+        description += '|';
+
+      if (term.scoped)
+        description += std::to_string(term.column) + ":";
+
+      description += term.phrase ? "\"" + term.text + "\"" : term.text;
+    }
+  }
+
+  return description;
+}
+
+// Relevance order of the rows must be the one of the stable sort by Matches (descending)
+void TestRelevanceOrder()
+{
+  std::mt19937 random(1);
+
+  const unsigned limits[] = { 1, 3, 1000, 0xFFFFFFFFu };
+
+  for (const auto limit : limits)
+  {
+    for (const std::size_t count : { std::size_t(0), std::size_t(1), std::size_t(7), std::size_t(5000) })
+    {
+      std::uniform_int_distribution<unsigned> value(0, limit);
+      std::vector<Matches> matches;
+
+      for (std::size_t i = 0; i < count; i++)
+        matches.emplace_back(value(random), value(random) % 4);
+
+      std::vector<unsigned> expected(count);
+      std::iota(expected.begin(), expected.end(), 0u);
+
+      std::stable_sort(expected.begin(), expected.end(), [&matches](const unsigned lhs, const unsigned rhs)
+      {
+        return matches[lhs] > matches[rhs];
+      });
+
+      CHECK(RelevanceOrder(matches) == expected);
+    }
+  }
+}
+
+// A dataset attached to the published one must give the same results as the dataset built by the process
+void TestPublishAttach()
+{
+  const std::string name = "vstsearcher-tests-" + std::to_string(std::random_device()());
+  const std::vector<int> columns { 0, 1, 2 };
+
+  SearchDataset built, published, attached;
+  BuildDataset(built, 2, 5000);
+  BuildDataset(published, 2, 5000);
+
+  CHECK(SearchDataset::PublishedGeneration(name) == 0);
+
+  std::uint32_t generation = 0;
+
+  try
+  {
+    generation = published.Publish(name);
+    CHECK(attached.Attach(name) == generation);
+  }
+  catch (const std::exception& e)
+  {
+    std::printf("%s\n", e.what());
+    CHECK(false);
+    return;
+  }
+
+  CHECK(generation != 0);
+  CHECK(published.Generation() == generation);
+  CHECK(attached.Generation() == generation);
+  CHECK(SearchDataset::PublishedGeneration(name) == generation);
+
+  CHECK(attached.RowCount() == built.RowCount());
+  CHECK(attached.Captions() == built.Captions());
+
+  for (unsigned row = 0; row < built.RowCount(); row += 97)
+  {
+    CHECK(attached.Parent(row) == built.Parent(row));
+    CHECK(attached.Text(row, 1) == built.Text(row, 1));
+  }
+
+  for (const auto mode : MODES)
+  {
+    for (const auto request : REQUESTS)
+    {
+      const SearchResult expected = Search(built, request, columns, mode);
+
+      CHECK(SameResult(Search(published, request, columns, mode), expected));
+      CHECK(SameResult(Search(attached, request, columns, mode), expected));
+    }
+  }
+
+  // The next publication gets the next generation, the attached dataset keeps the previous one
+  SearchDataset republished, reattached;
+  BuildDataset(republished, 3, 1000);
+
+  try
+  {
+    CHECK(republished.Publish(name) == generation + 1);
+    CHECK(reattached.Attach(name) == generation + 1);
+  }
+  catch (const std::exception& e)
+  {
+    std::printf("%s\n", e.what());
+    CHECK(false);
+  }
+
+  CHECK(reattached.RowCount() == 1000);
+  CHECK(attached.Generation() == generation);
+  CHECK(SameResult(Search(attached, "inv", columns, EvaluationMode::COUNT),
+                   Search(built, "inv", columns, EvaluationMode::COUNT)));
+
+  SharedMemory::Remove(name);
+  SharedMemory::Remove(name + "." + std::to_string(generation + 1));
+}
+
+// Measurer of a fake font: every character is 7 pixels wide (space - 3) multiplied by the key
+class FakeMeasurer : public ITextMeasurer
+{
+ public:
+
+  std::uint64_t key          { 1 };
+  unsigned      measureCount { 0 };
+
+  std::uint64_t FontKey() const override
+  {
+    return key;
+  }
+
+  void MeasureChars(std::array<int, 256>& widths) override
+  {
+    measureCount++;
+
+    widths.fill(7 * static_cast<int>(key));
+    widths[' '] = 3 * static_cast<int>(key);
+  }
+};
+
+bool SameRange(const HighlightRange& range, const std::size_t pos, const std::size_t length, const int left, const int right)
+{
+  return range.pos == pos && range.length == length && range.left == left && range.right == right;
+}
+
+// Highlighted parts of cells are laid out by the widths of the characters, measured once per font
+void TestHighlightLayouts()
+{
+  QueryPlan plan;
+  plan.Parse("ab desc", [](const std::string&, int&) { return false; });
+
+  HighlightLayouts layouts;
+  FakeMeasurer measurer;
+
+  const std::string text = "Item AB-123 desc, ab";
+  const int firstCell = 0, secondCell = 0;
+
+  auto check = [&](const void* const cell, const int scale)
+  {
+    const auto& ranges = layouts.Ranges(cell, 0, text, plan, true, measurer);
+
+    CHECK(ranges.size() == 3);
+
+    if (ranges.size() == 3)
+    {
+      CHECK(SameRange(ranges[0], 5, 2, 31 * scale, 45 * scale));
+      CHECK(SameRange(ranges[1], 12, 4, 76 * scale, 104 * scale));
+      CHECK(SameRange(ranges[2], 18, 2, 114 * scale, 128 * scale));
+    }
+  };
+
+  check(&firstCell, 1);
+  CHECK(measurer.measureCount == 1);
+
+  // The layout of the cell and the widths of the font are reused
+  check(&firstCell, 1);
+  check(&secondCell, 1);
+  CHECK(measurer.measureCount == 1);
+
+  // Another font is measured once, the widths of the first one are kept
+  measurer.key = 2;
+  check(&firstCell, 2);
+  CHECK(measurer.measureCount == 2);
+
+  measurer.key = 1;
+  check(&firstCell, 1);
+  CHECK(measurer.measureCount == 2);
+
+  // The cell is laid out again when its text changes
+  const auto& changed = layouts.Ranges(&firstCell, 0, "ab", plan, true, measurer);
+  CHECK(changed.size() == 1 && SameRange(changed[0], 0, 2, 0, 14));
+
+  // Nothing is highlighted without matches or in the columns not searched by the words
+  CHECK(layouts.Ranges(&firstCell, 0, "nothing", plan, true, measurer).empty());
+  CHECK(layouts.Ranges(&firstCell, 1, text, plan, false, measurer).empty());
+
+  CHECK(layouts.MemoryUsage() > 0);
+  CHECK(measurer.measureCount == 2);
+}
+
+// Result combined from the parts by column must be the one of Run() as the search columns are added and removed
+void TestRunByColumns()
+{
+  SearchDataset dataset;
+  BuildDataset(dataset, 5, 5000);
+
+  const auto resolver = [&dataset](const std::string& name, int& column) { return dataset.ResolveColumn(name, column); };
+  const std::vector<std::vector<int>> columnSets { { 0 }, { 0, 1 }, { 0, 1, 2 }, { 1 }, { 2, 0 }, {}, { 1, 2 }, { 0 } };
+
+  for (const bool layoutVariants : { false, true })
+  {
+    for (const auto mode : MODES)
+    {
+      for (const auto request : REQUESTS)
+      {
+        QueryPlan plan;
+        plan.Parse(request, resolver);
+
+        if (layoutVariants)
+          plan.AddLayoutVariants();
+
+        ColumnParts parts;
+        std::size_t partCount = 0;
+
+        for (const auto& columns : columnSets)
+        {
+          SearchResult expected, result;
+
+          SearchCore(dataset).Run(plan, columns, expected, mode);
+          SearchCore(dataset).RunByColumns(plan, columns, parts, result, mode);
+
+          CHECK(SameResult(result, expected));
+
+          // Parts of the removed columns are kept for the next changes
+          CHECK(parts.parts.size() >= partCount);
+          partCount = parts.parts.size();
+        }
+      }
+    }
+  }
+
+  // Parts kept while typing: a request that refines the previous one is evaluated
+  // where the previous one is found, the columns and the mode change in between
+
+  struct Step
+  {
+    const char*      request;
+    std::vector<int> columns;
+    EvaluationMode   mode;
+  };
+
+  const Step steps[] = {
+    { "i", { 0 }, EvaluationMode::COUNT },          { "in", { 0 }, EvaluationMode::COUNT },
+    { "in", { 0, 2 }, EvaluationMode::COUNT },      { "inv", { 0, 2 }, EvaluationMode::ROWS },
+    { "invo", { 2 }, EvaluationMode::ROOTS },       { "invoi", { 0, 2 }, EvaluationMode::COUNT },
+    { "invoice 1", { 0, 1, 2 }, EvaluationMode::COUNT }, { "invoice 12", { 0, 1 }, EvaluationMode::ROWS },
+    { "-c1", { 1 }, EvaluationMode::ROWS },         { "-c12", { 1, 2 }, EvaluationMode::ROWS },
+    { "note:or", { 0 }, EvaluationMode::COUNT },    { "note:order", { 0, 2 }, EvaluationMode::COUNT },
+    { "+inv -note:c1", { 0 }, EvaluationMode::ROWS }, { "+invo -note:c12", { 0, 2 }, EvaluationMode::COUNT }
+  };
+
+  ColumnParts parts;
+
+  for (const auto& step : steps)
+  {
+    QueryPlan plan;
+    plan.Parse(step.request, resolver);
+
+    SearchCore core(dataset);
+    core.Optimize(plan, step.columns);
+
+    SearchResult expected, result;
+
+    core.Run(plan, step.columns, expected, step.mode);
+    core.RunByColumns(plan, step.columns, parts, result, step.mode);
+
+    CHECK(SameResult(result, expected));
+  }
+}
+
+// Concurrent publications under one name get different generations, the newest one stays published
+void TestConcurrentPublish()
+{
+  const std::string name = "vstsearcher-tests-" + std::to_string(std::random_device()());
+
+  constexpr unsigned PUBLISHERS = 4;
+
+  std::vector<SearchDataset> datasets(PUBLISHERS);
+  std::vector<std::uint32_t> generations(PUBLISHERS, 0);
+  std::vector<std::thread>   threads;
+
+  for (unsigned i = 0; i < PUBLISHERS; i++)
+    BuildDataset(datasets[i], 10 + i, 2000);
+
+  for (unsigned i = 0; i < PUBLISHERS; i++)
+  {
+    threads.emplace_back([&datasets, &generations, &name, i]
+    {
+      try
+      {
+        generations[i] = datasets[i].Publish(name);
+      }
+      catch (const std::exception&)
+      {
+      }
+    });
+  }
+
+  for (auto& thread : threads)
+    thread.join();
+
+  std::vector<std::uint32_t> sorted = generations;
+  std::sort(sorted.begin(), sorted.end());
+
+  for (unsigned i = 0; i < PUBLISHERS; i++)
+    CHECK(sorted[i] == i + 1);
+
+  CHECK(SearchDataset::PublishedGeneration(name) == PUBLISHERS);
+
+  // Every publisher keeps searching its own image
+  const std::vector<int> columns { 0, 1, 2 };
+
+  for (unsigned i = 0; i < PUBLISHERS; i++)
+  {
+    SearchDataset expected;
+    BuildDataset(expected, 10 + i, 2000);
+
+    CHECK(SameResult(Search(datasets[i], "inv", columns, EvaluationMode::COUNT),
+                     Search(expected, "inv", columns, EvaluationMode::COUNT)));
+  }
+
+  SharedMemory::Remove(name);
+  SharedMemory::Remove(name + "." + std::to_string(PUBLISHERS));
+}
+
+// Clauses parsed from the request, their order chosen by Optimize() and the rows found by the optimized plan,
+// which must be the ones of the parsed plan evaluated row by row
+void TestQueryGrammar()
+{
+  SearchDataset dataset;
+  BuildDataset(dataset, 6, 5000);
+
+  const auto resolver = [&dataset](const std::string& name, int& column) { return dataset.ResolveColumn(name, column); };
+
+  const std::pair<const char*, const char*> parsed[] = {
+    { "Invoice", "invoice" },                        { "+inv -c1 pay", "+inv -c1 pay" },
+    { "inv OR pay -c2", "inv|pay -c2" },             { "+inv OR pay", "+inv|pay" },
+    { "a OR b OR -c", "a|b|c" },                     { "inv or pay", "inv or pay" },
+    { "OR inv", "or inv" },                          { "inv OR", "inv" },
+    { "inv OR inv", "inv" },                         { "inv inv +inv", "inv +inv" },
+    { "inv.pay,c1", "inv pay c1" },                  { "\"Invoice 12\" -\"c1 x\"", "\"invoice 12\" -\"c1 x\"" },
+    { "\"unterminated", "\"unterminated\"" },        { "\"\" x", "x" },
+    { "code:c12 +note:order", "1:c12 +2:order" },    { "Code:C1", "1:c1" },
+    { "code:\"c1 2\"", "1:\"c1 2\"" },               { "foo:bar", "foo:bar" },
+    { "code:", "code:" }
+  };
+
+  for (const auto& request : parsed)
+  {
+    QueryPlan plan;
+    plan.Parse(request.first, resolver);
+
+    CHECK(Describe(plan) == request.second);
+  }
+
+  // Filters go first, the cheapest way to reject a row first; SHOULD clauses and alternatives - the most probable first
+  {
+    QueryPlan plan;
+    plan.Parse("a +bb -ccc +dddd x OR yy");
+
+    const double selectivity[] = { 0.9, 0.1, 0.5, 0.01 };
+
+    plan.Optimize([&selectivity](const QueryTerm& term)
+    {
+      return (term.text == "x") ? 0.1 : (term.text == "yy") ? 0.6 : selectivity[term.text.length() - 1];
+    }, 1);
+
+    CHECK(Describe(plan) == "+dddd +bb -ccc a yy|x");
+  }
+
+  // Clauses and their alternatives regardless of the order
+  auto canonical = [](const QueryPlan& plan)
+  {
+    std::vector<std::string> clauses;
+
+    for (const auto& clause : plan.Clauses())
+    {
+      std::vector<std::string> terms;
+
+      for (const auto& term : clause.terms)
+        terms.push_back(std::to_string(term.column) + ":" + term.text);
+
+      std::sort(terms.begin(), terms.end());
+
+      clauses.push_back(std::to_string(static_cast<int>(clause.occur)));
+
+      for (const auto& term : terms)
+        clauses.back() += " " + term;
+    }
+
+    std::sort(clauses.begin(), clauses.end());
+    return clauses;
+  };
+
+  std::vector<const char*> requests(std::begin(REQUESTS), std::end(REQUESTS));
+
+  requests.insert(requests.end(), { "+inv OR pay -note:c1", "\"order c1\" OR rep", "-c1 OR c2 del", "Invoice.Report",
+                                    "+code:c1 OR code:c2 -inv", "inv or pay", "-inv -pay", "+\"nothing here\"" });
+
+  const std::vector<std::vector<int>> columnSets { { 0, 1, 2 }, { 0 }, { 2, 1 } };
+
+  for (const auto request : requests)
+  {
+    QueryPlan plan;
+    plan.Parse(request, resolver);
+
+    for (const auto& columns : columnSets)
+    {
+      QueryPlan optimized = plan;
+      SearchCore(dataset).Optimize(optimized, columns);
+
+      CHECK(canonical(optimized) == canonical(plan));
+
+      const auto& clauses = optimized.Clauses();
+
+      CHECK(std::is_partitioned(clauses.begin(), clauses.end(), [](const QueryClause& clause)
+      {
+        return clause.occur != TermOccur::SHOULD;
+      }));
+
+      for (const auto mode : MODES)
+        CHECK(SameResult(Search(dataset, request, columns, mode), PlainSearch(dataset, plan, columns, mode)));
+    }
+  }
+}
+
+// Random pattern of literals, classes, groups, alternatives and quantifiers
+std::string RandomPattern(std::mt19937& random, const unsigned depth)
+{
+  const char* const atoms[]      = { "a", "b", "c", ".", "[ab]", "[^a]", "\\d", "\\w", "\\s", "[a-c1]" };
+  const char* const quantifiers[] = { "", "", "", "*", "+", "?", "{2}", "{1,3}", "{2,}" };
+
+  std::string pattern;
+
+  for (unsigned i = 0, count = 1 + random() % 3; i < count; i++)
+  {
+    if (depth < 2 && random() % 5 == 0)
+      pattern += ((random() % 2) ? "(" : "(?:") + RandomPattern(random, depth + 1) + ")";
+    else
+      pattern += atoms[random() % 10];
+
+    pattern += quantifiers[random() % 9];
+  }
+
+  if (depth < 2 && random() % 4 == 0)
+    pattern += "|" + RandomPattern(random, depth + 1);
+
+  return pattern;
+}
+
+// Non-overlapping leftmost-longest non-empty matches found by checking every substring
+std::vector<MatchSpan> PlainFindAll(const std::regex& regex, const std::string& text)
+{
+  std::vector<MatchSpan> spans;
+
+  for (std::size_t pos = 0, start = 0; start < text.length(); start++)
+  {
+    if (start < pos)
+      continue;
+
+    for (std::size_t end = text.length(); end > start; end--)
+    {
+      auto flags = std::regex_constants::match_default;
+
+      if (start > 0)
+        flags |= std::regex_constants::match_not_bol;
+
+      if (end < text.length())
+        flags |= std::regex_constants::match_not_eol;
+
+      if (std::regex_match(text.begin() + start, text.begin() + end, regex, flags))
+      {
+        spans.emplace_back(start, end - start);
+        pos = end;
+        break;
+      }
+    }
+  }
+
+  return spans;
+}
+
+bool SameSpans(const std::vector<MatchSpan>& lhs, const std::vector<MatchSpan>& rhs)
+{
+  return std::equal(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(), [](const MatchSpan& a, const MatchSpan& b)
+  {
+    return a.pos == b.pos && a.length == b.length;
+  });
+}
+
+// Regular expressions: invalid patterns are rejected, matches are the ones of std::regex
+// and a regex request finds the rows plain evaluation finds
+void TestRegex()
+{
+  const char* const invalid[] = { "(", "a)", "[a", "*", "+a", "a{3,1}", "\\", "a^b", "a$b", "[]", "[b-a]", "(?:a", "\\q" };
+
+  for (const auto pattern : invalid)
+  {
+    bool isThrown = false;
+
+    try
+    {
+      QueryPlan plan;
+      plan.ParseRegex(pattern);
+    }
+    catch (const std::invalid_argument&)
+    {
+      isThrown = true;
+    }
+
+    CHECK(isThrown);
+  }
+
+  // A brace that isn't a repetition is a literal, the pattern is case folded
+  CHECK(SameSpans(Regex("a{2").FindAll("xa{2a{2"), { MatchSpan(1, 3), MatchSpan(4, 3) }));
+  CHECK(SameSpans(Regex("INV\\w*").FindAll("invoice, inv."), { MatchSpan(0, 7), MatchSpan(9, 3) }));
+  // Anchors apply to the whole pattern
+  CHECK(SameSpans(Regex("^ab|c$").FindAll("ab"), { MatchSpan(0, 2) }));
+  CHECK(Regex("^ab|c$").FindAll("abc").empty());
+
+  // A long match isn't cut by the shorter alternative
+  const std::string text = std::string(20000, 'a') + "c";
+
+  CHECK(SameSpans(Regex("ab|a.*c").FindAll(text), { MatchSpan(0, text.length()) }));
+  CHECK(Regex("ab|a.*c").FindAll(std::string(20000, 'a')).empty());
+
+  std::mt19937 random(28);
+
+  for (unsigned i = 0; i < 300; i++)
+  {
+    const std::string body  = RandomPattern(random, 0);
+    const bool        start = (random() % 8 == 0),
+                      end   = (random() % 8 == 0);
+
+    const std::string pattern = (start ? "^" : "") + body + (end ? "$" : "");
+
+    const Regex regex(pattern);
+    const std::regex expected((start ? "^(?:" : "(?:") + body + (end ? ")$" : ")"), std::regex::ECMAScript);
+
+    for (unsigned k = 0; k < 4; k++)
+    {
+      std::string sample;
+
+      for (unsigned length = random() % 24; sample.length() < length;)
+        sample += "abcx1 "[random() % 6];
+
+      CHECK(SameSpans(regex.FindAll(sample), PlainFindAll(expected, sample)));
+      CHECK(regex.IsMatch(sample) == std::regex_search(sample, expected));
+    }
+  }
+
+  SearchDataset dataset;
+  BuildDataset(dataset, 7, 5000);
+
+  const std::vector<int> columns { 0, 2 };
+
+  for (const auto pattern : { "inv\\w*e", "^c1\\d$", "(order|report) c4", "pay.*c[0-3]$", "\\d{4}", "y 1|t c1" })
+  {
+    QueryPlan plan;
+    plan.ParseRegex(pattern);
+
+    QueryPlan optimized = plan;
+    SearchCore(dataset).Optimize(optimized, columns);
+
+    const std::regex expected(pattern, std::regex::ECMAScript);
+
+    for (const auto mode : MODES)
+    {
+      SearchResult result;
+      SearchCore(dataset).Run(optimized, columns, result, mode);
+
+      CHECK(SameResult(result, PlainSearch(dataset, plan, columns, mode)));
+
+      if (mode != EvaluationMode::ROWS)
+        continue;
+
+      // Rows with a match in a search column
+      RowBitmap rows;
+
+      for (unsigned row = 0; row < dataset.RowCount(); row++)
+      {
+        if (std::regex_search(std::string(dataset.Text(row, 0)), expected) ||
+            std::regex_search(std::string(dataset.Text(row, 2)), expected))
+        {
+          rows.Add(row);
+        }
+      }
+
+      CHECK(result.rows == rows);
+    }
+  }
+}
+
+// A subtree skipped by its summary has no row that satisfies the request,
+// so the search with the summaries finds the rows plain evaluation finds
+void TestSummaries()
+{
+  SearchDataset dataset, unindexed;
+  BuildDeepDataset(dataset, 31, 5000);
+  BuildDeepDataset(unindexed, 31, 5000);
+
+  unindexed.DropIndexes();
+
+  const auto resolver = [&dataset](const std::string& name, int& column) { return dataset.ResolveColumn(name, column); };
+  const auto& summaries = dataset.Summaries();
+
+  CHECK(summaries.FilterWords() > 0);
+  CHECK(unindexed.Summaries().FilterWords() == 0);
+
+  const char* const requests[] = { "+g17", "g5 OR g90", "g12 inv", "-g3 inv", "\"note g14\"", "note:g12 +ord", "+inv +g2",
+                                   "cxtn", "+cxtn +g2", "in g44", "+rep +code:c4 -g1", "code:g12", "g1234" };
+
+  const std::vector<int> columns { 0, 2 };
+
+  std::size_t skipped = 0;
+
+  for (const bool layoutVariants : { false, true })
+  {
+    for (const auto request : requests)
+    {
+      QueryPlan plan;
+      plan.Parse(request, resolver);
+
+      if (layoutVariants)
+        plan.AddLayoutVariants();
+
+      QueryPlan optimized = plan;
+      SearchCore(dataset).Optimize(optimized, columns);
+
+      const SearchResult expected = PlainSearch(dataset, plan, columns, EvaluationMode::ROWS);
+      const SummaryProbe probe(optimized, summaries);
+
+      bool isSound = true;
+
+      for (unsigned row = 0; row < dataset.RowCount(); row++)
+      {
+        if (probe.Empty() || summaries.MayMatch(row, probe))
+          continue;
+
+        skipped++;
+
+        for (unsigned child = row; child < dataset.SubtreeEnd(row); child++)
+          isSound &= !expected.rows.Contains(child);
+      }
+
+      CHECK(isSound);
+
+      for (const auto mode : MODES)
+      {
+        SearchResult result, unindexedResult;
+
+        SearchCore(dataset).Run(optimized, columns, result, mode);
+        SearchCore(unindexed).Run(optimized, columns, unindexedResult, mode);
+
+        CHECK(SameResult(result, PlainSearch(dataset, plan, columns, mode)));
+        CHECK(SameResult(unindexedResult, result));
+      }
+    }
+  }
+
+  // Regular expressions are checked by the literal every match contains
+  QueryPlan plan;
+  plan.ParseRegex("note g4\\d?$");
+
+  for (const auto mode : MODES)
+  {
+    SearchResult result;
+    SearchCore(dataset).Run(plan, columns, result, mode);
+
+    CHECK(SameResult(result, PlainSearch(dataset, plan, columns, mode)));
+  }
+
+  // The summaries are used
+  CHECK(skipped > 0);
+}
+
+// Matching over the compressed text must find what the search in the decompressed text finds
+void TestCompressedMatching()
+{
+  std::mt19937 random(32);
+
+  // Characters missing in the sample are escaped, including the one equal to the escape code
+  const std::string alphabet = "abcd -1\xf1z\xff";
+
+  std::vector<std::string> texts(200);
+
+  for (std::size_t i = 0; i < texts.size(); i++)
+  {
+    const std::size_t characters = (i < 100) ? alphabet.length() - 2 : alphabet.length();
+
+    for (unsigned length = random() % 40; texts[i].length() < length;)
+      texts[i] += alphabet[random() % characters];
+  }
+
+  const SymbolTable table = SymbolTable::Train(std::vector<std::string_view>(texts.begin(), texts.begin() + 100));
+
+  CHECK(table.SymbolCount() > 0);
+
+  for (unsigned i = 0; i < 300; i++)
+  {
+    std::string pattern;
+
+    for (unsigned length = 1 + random() % 6; pattern.length() < length;)
+      pattern += alphabet[random() % alphabet.length()];
+
+    const CodeMatcher matcher(pattern, table);
+
+    for (unsigned k = 0; k < 8; k++)
+    {
+      const std::string& text = texts[random() % texts.size()];
+
+      std::string codes, decoded;
+      table.Encode(text, codes);
+      table.Decode(codes, decoded);
+
+      CHECK(decoded == text);
+
+      // Non-overlapping occurrences from the left
+      unsigned count = 0;
+
+      for (std::size_t pos = text.find(pattern); pos != std::string::npos; pos = text.find(pattern, pos + pattern.length()))
+        count++;
+
+      CHECK(matcher.Contains(codes) == (count > 0));
+      CHECK(matcher.Count(codes) == count);
+    }
+  }
+
+  SearchDataset compressed, plain;
+  BuildDeepDataset(compressed, 32, 5000);
+  BuildDeepDataset(plain, 32, 5000);
+
+  compressed.Compress();
+
+  CHECK(compressed.Compressed());
+  CHECK(compressed.TextMemoryUsage() < plain.TextMemoryUsage());
+
+  for (unsigned row = 0; row < plain.RowCount(); row += 7)
+    CHECK(std::string(compressed.Text(row, 2)) == plain.Text(row, 2));
+
+  const auto resolver = [&plain](const std::string& name, int& column) { return plain.ResolveColumn(name, column); };
+
+  std::vector<const char*> requests(std::begin(REQUESTS), std::end(REQUESTS));
+  requests.insert(requests.end(), { "cxtn", "\"note g1\"", "+inv -g2", "ntory OR ivery", "code:c4 +note:g3" });
+
+  const std::vector<int> columns { 0, 1, 2 };
+
+  for (const bool layoutVariants : { false, true })
+  {
+    for (const auto request : requests)
+    {
+      QueryPlan plan;
+      plan.Parse(request, resolver);
+
+      if (layoutVariants)
+        plan.AddLayoutVariants();
+
+      QueryPlan optimized = plan;
+      SearchCore(compressed).Optimize(optimized, columns);
+
+      // The terms are matched over the codes
+      for (const auto& clause : optimized.Clauses())
+      {
+        for (const auto& term : clause.terms)
+          CHECK(term.codeMatchers.size() == 1 + term.variants.size());
+      }
+
+      for (const auto mode : MODES)
+      {
+        SearchResult result, byColumns;
+        ColumnParts parts;
+
+        SearchCore(compressed).Run(optimized, columns, result, mode);
+        SearchCore(compressed).RunByColumns(optimized, columns, parts, byColumns, mode);
+
+        const SearchResult expected = PlainSearch(plain, plan, columns, mode);
+
+        CHECK(SameResult(result, expected));
+        CHECK(SameResult(byColumns, expected));
+      }
+    }
+  }
+}
+
+// Columns with few distinct values are evaluated once per value: the results must be the ones
+// of every row evaluated on its own text
+void TestInternedColumns()
+{
+  SearchDataset interned, compressed;
+  BuildDataset(interned, 33, 5000);
+  BuildDataset(compressed, 33, 5000);
+
+  compressed.Compress();
+
+  // Names are almost unique, codes and notes repeat
+  CHECK(interned.ValueId(0, 0) < 0);
+  CHECK(interned.ValueCount(1) > 0 && interned.ValueCount(1) <= 500);
+  CHECK(interned.ValueCount(2) > 0 && interned.ValueCount(2) <= 400);
+
+  // Rows have the same value if and only if they have the same text
+  for (const int column : { 1, 2 })
+  {
+    std::vector<std::string> values(interned.ValueCount(column));
+    bool isConsistent = true;
+
+    for (unsigned row = 0; row < interned.RowCount(); row++)
+    {
+      const int id = interned.ValueId(row, column);
+
+      if (id < 0 || static_cast<std::size_t>(id) >= values.size())
+      {
+        isConsistent = false;
+        continue;
+      }
+
+      const std::string text(interned.Text(row, column));
+
+      if (values[id].empty())
+        values[id] = text;
+
+      isConsistent &= (values[id] == text);
+    }
+
+    std::sort(values.begin(), values.end());
+
+    CHECK(isConsistent);
+    CHECK(std::adjacent_find(values.begin(), values.end()) == values.end());
+  }
+
+  const auto resolver = [&interned](const std::string& name, int& column) { return interned.ResolveColumn(name, column); };
+
+  std::vector<const char*> requests(std::begin(REQUESTS), std::end(REQUESTS));
+  requests.insert(requests.end(), { "c1", "+code:c1 -code:c12", "note:\"ice c3\" OR code:c49", "-note:inv", "+c4 +order",
+                                    "code:c7 note:c7 c7", "ivery c2" });
+
+  const std::vector<std::vector<int>> columnSets { { 0, 1, 2 }, { 1 }, { 2, 0 } };
+
+  for (const bool layoutVariants : { false, true })
+  {
+    for (const auto request : requests)
+    {
+      QueryPlan plan;
+      plan.Parse(request, resolver);
+
+      if (layoutVariants)
+        plan.AddLayoutVariants();
+
+      for (const auto& columns : columnSets)
+      {
+        for (const auto dataset : { &interned, &compressed })
+        {
+          QueryPlan optimized = plan;
+          SearchCore(*dataset).Optimize(optimized, columns);
+
+          for (const auto mode : MODES)
+          {
+            SearchResult result, byColumns;
+            ColumnParts parts;
+
+            SearchCore(*dataset).Run(optimized, columns, result, mode);
+            SearchCore(*dataset).RunByColumns(optimized, columns, parts, byColumns, mode);
+
+            const SearchResult expected = PlainSearch(interned, plan, columns, mode);
+
+            CHECK(SameResult(result, expected));
+            CHECK(SameResult(byColumns, expected));
+          }
+        }
+      }
+    }
+  }
+}
+
+// Typed columns: values and conditions are parsed as documented, and the conditions checked
+// on the stored values find the rows where the text of the cell satisfies them
+void TestTypedValues()
+{
+  using Integer = ValueTraits<ColumnType::INTEGER>;
+  using Decimal = ValueTraits<ColumnType::DECIMAL>;
+  using Date    = ValueTraits<ColumnType::DATE>;
+
+  const std::pair<const char*, Integer::Value> integers[] = { { "1234", 1234 }, { "-5", -5 }, { "+7", 7 }, { " 42 ", 42 },
+                                                              { "1 234 567", 1234567 }, { "1'000", 1000 } };
+  const std::pair<const char*, Decimal::Value> decimals[] = { { "1234.56", 1234.56 }, { "1 234,56", 1234.56 },
+                                                              { "-0.5", -0.5 }, { "5", 5.0 } };
+  const std::pair<const char*, Date::Value>    dates[]    = { { "2026-10-19", 20261019 }, { "19.10.2026", 20261019 },
+                                                              { "1.2.2026", 20260201 }, { "2026-10-19 12:30", 20261019 },
+                                                              { "2026-10-19t12:30", 20261019 } };
+
+  for (const auto& value : integers)
+  {
+    Integer::Value parsed = 0;
+    CHECK(Integer::Parse(value.first, parsed) && parsed == value.second);
+  }
+
+  for (const auto& value : decimals)
+  {
+    Decimal::Value parsed = 0;
+    CHECK(Decimal::Parse(value.first, parsed) && parsed == value.second);
+  }
+
+  for (const auto& value : dates)
+  {
+    Date::Value parsed = 0;
+    CHECK(Date::Parse(value.first, parsed) && parsed == value.second);
+  }
+
+  for (const auto text : { "", "abc", "12.5", "1 -2", "1234567890123456789", "--1" })
+  {
+    Integer::Value parsed = 0;
+    CHECK(!Integer::Parse(text, parsed));
+  }
+
+  for (const auto text : { "1.2.3", ".5", "5.", "1,5,6", "x" })
+  {
+    Decimal::Value parsed = 0;
+    CHECK(!Decimal::Parse(text, parsed));
+  }
+
+  for (const auto text : { "2026-10", "2026", "2026-13-01", "19-10-2026", "2026.10.19", "2026-10-19x", "26-10-19" })
+  {
+    Date::Value parsed = 0;
+    CHECK(!Date::Parse(text, parsed));
+  }
+
+  // Condition, the cells that satisfy it and the ones that don't
+  struct Condition
+  {
+    ColumnType               type;
+    const char*              text;
+    std::vector<const char*> matched;
+    std::vector<const char*> unmatched;
+  };
+
+  const Condition conditions[] = {
+    { ColumnType::INTEGER, ">1000", { "1001", "1 000 000" }, { "1000", "-5", "abc", "" } },
+    { ColumnType::INTEGER, "<=5", { "5", "-100" }, { "6" } },
+    { ColumnType::INTEGER, "10..20", { "10", "15", "20" }, { "9", "21" } },
+    { ColumnType::INTEGER, "=7", { "7", " 7" }, { "70" } },
+    { ColumnType::INTEGER, "7", { "7" }, { "8" } },
+    { ColumnType::DECIMAL, ">1.5", { "1.51", "2" }, { "1.5", "1,5", "-3" } },
+    { ColumnType::DECIMAL, "<0", { "-0.1" }, { "0", "0.1" } },
+    { ColumnType::DATE, "2026-10", { "2026-10-01", "31.10.2026" }, { "2026-09-30", "2026-11-01" } },
+    { ColumnType::DATE, ">2026", { "2027-01-01" }, { "2026-12-31" } },
+    { ColumnType::DATE, "<19.10.2026", { "2026-10-18", "1999-01-01" }, { "2026-10-19", "2026-10-19 00:01" } },
+    { ColumnType::DATE, "2026-10..2026-11", { "2026-10-01", "2026-11-30" }, { "2026-09-30", "2026-12-01" } }
+  };
+
+  for (const auto& condition : conditions)
+  {
+    const auto parsed = ValueCondition::Parse(condition.type, condition.text);
+
+    CHECK(parsed != nullptr);
+
+    if (!parsed)
+      continue;
+
+    CHECK(parsed->Type() == condition.type);
+
+    for (const auto text : condition.matched)
+      CHECK(parsed->Matches(text));
+
+    for (const auto text : condition.unmatched)
+      CHECK(!parsed->Matches(text));
+  }
+
+  for (const auto text : { ">>5", "1..", "..5", "abc", "5x", "" })
+    CHECK(ValueCondition::Parse(ColumnType::INTEGER, text) == nullptr);
+
+  CHECK(ValueCondition::Parse(ColumnType::DATE, "2026-10-19 12:30") == nullptr);
+  CHECK(ValueCondition::Parse(ColumnType::TEXT, "5") == nullptr);
+
+  // Dataset of the typed columns, some cells aren't values
+  SearchDataset dataset;
+  std::mt19937 random(41);
+
+  std::vector<Integer::Value> amounts;
+
+  dataset.SetColumns({ "name", "amount", "price", "date" }, 0);
+
+  for (unsigned row = 0; row < 5000; row++)
+  {
+    const Integer::Value amount = static_cast<Integer::Value>(random() % 2000) - 500;
+    const bool           isValue = (random() % 10 != 0);
+
+    amounts.push_back(isValue ? amount : Integer::NONE);
+
+    const std::vector<std::string> texts {
+      std::string(WORDS[random() % 8]) + " " + std::to_string(random() % 100),
+      isValue ? std::to_string(amount) : "n/a",
+      std::to_string(random() % 100) + "," + std::to_string(random() % 10),
+      std::to_string(2024 + random() % 3) + "-" + std::to_string(1 + random() % 12) + "-" + std::to_string(1 + random() % 28)
+    };
+
+    dataset.AddRow((row % 20 != 0) ? static_cast<int>(row - row % 20) : -1, texts);
+  }
+
+  dataset.Finish();
+  dataset.SetColumnTypes({ ColumnType::TEXT, ColumnType::INTEGER, ColumnType::DECIMAL, ColumnType::DATE });
+
+  CHECK(dataset.Values(0) == nullptr);
+  CHECK(dataset.Values(1) != nullptr && dataset.Values(1)->Size() == dataset.RowCount());
+
+  auto parse = [](const SearchDataset& source, const char* const request)
+  {
+    QueryPlan plan;
+
+    plan.Parse(request, [&source](const std::string& name, int& column) { return source.ResolveColumn(name, column); },
+               [&source](const int column)
+    {
+      const auto& types = source.ColumnTypes();
+      return (static_cast<std::size_t>(column) < types.size()) ? types[column] : ColumnType::TEXT;
+    });
+
+    return plan;
+  };
+
+  // A token that isn't a condition on the type of the column is searched as text
+  CHECK(parse(dataset, "amount:>1000").Clauses()[0].terms[0].condition != nullptr);
+  CHECK(parse(dataset, "amount:n/a").Clauses()[0].terms[0].condition == nullptr);
+  CHECK(parse(dataset, "name:>1000").Clauses()[0].terms[0].condition == nullptr);
+  CHECK(parse(dataset, "amount:\"1000\"").Clauses()[0].terms[0].condition == nullptr);
+
+  // Rows whose amounts are checked by hand
+  {
+    SearchResult result;
+    SearchCore(dataset).Run(parse(dataset, "+amount:>1000"), { 0 }, result, EvaluationMode::ROWS);
+
+    RowBitmap rows;
+
+    for (unsigned row = 0; row < amounts.size(); row++)
+    {
+      if (amounts[row] != Integer::NONE && amounts[row] > 1000)
+        rows.Add(row);
+    }
+
+    CHECK(!rows.Empty());
+    CHECK(result.rows == rows);
+  }
+
+  std::stringstream snapshot;
+  dataset.Save(snapshot);
+
+  SearchDataset loaded, unindexed;
+
+  try
+  {
+    loaded.Load(snapshot);
+  }
+  catch (const std::exception& e)
+  {
+    std::printf("%s\n", e.what());
+    CHECK(false);
+    return;
+  }
+
+  snapshot.seekg(0);
+  unindexed.Load(snapshot);
+  unindexed.DropIndexes();
+
+  CHECK(loaded.ColumnTypes() == dataset.ColumnTypes());
+  CHECK(loaded.Values(3) != nullptr && loaded.Values(3)->Type() == ColumnType::DATE);
+  CHECK(unindexed.Values(3) == nullptr);
+
+  const char* const requests[] = { "amount:>1000", "+amount:100..200 inv", "-price:<10", "date:2026-10 OR date:2025",
+                                   "+date:>=2026-06 -amount:<0", "amount:n/a", "price:>99,5 amount:=0", "inv -date:2024",
+                                   "+amount:-500..-490", "+price:>=5,5 +price:<=5,5", "+amount:100", "+date:2026-10-19" };
+
+  const std::vector<int> columns { 0, 1 };
+
+  for (const auto request : requests)
+  {
+    const QueryPlan plan = parse(dataset, request);
+
+    for (const auto mode : MODES)
+    {
+      const SearchResult expected = PlainSearch(dataset, plan, columns, mode);
+
+      for (const auto source : { &dataset, &loaded, &unindexed })
+      {
+        QueryPlan optimized = parse(*source, request);
+        SearchCore(*source).Optimize(optimized, columns);
+
+        SearchResult result, byColumns;
+        ColumnParts parts;
+
+        SearchCore(*source).Run(optimized, columns, result, mode);
+        SearchCore(*source).RunByColumns(optimized, columns, parts, byColumns, mode);
+
+        CHECK(SameResult(result, expected));
+        CHECK(SameResult(byColumns, expected));
+      }
+    }
+  }
+}
+
+// A plan that refines another one finds only rows of the other one, so the search
+// on the rows of a cached result of the other plan finds what the search on all rows finds
+void TestRefinedRequests()
+{
+  SearchDataset dataset;
+  BuildDataset(dataset, 43, 2000);
+
+  const auto resolver = [&dataset](const std::string& name, int& column) { return dataset.ResolveColumn(name, column); };
+
+  auto parse = [&resolver](const char* const request, const bool layoutVariants = false)
+  {
+    QueryPlan plan;
+    plan.Parse(request, resolver);
+
+    if (layoutVariants)
+      plan.AddLayoutVariants();
+
+    return plan;
+  };
+
+  // Plan, the plan of the previous request, whether the first one refines the second one
+  struct Refinement
+  {
+    const char* request;
+    const char* previous;
+    bool        refines;
+  };
+
+  const Refinement refinements[] = {
+    { "invoice", "inv", true },       { "inv", "invoice", false },     { "+inv +c1", "inv", true },
+    { "inv c1", "inv", false },       { "-inv", "-invoice", true },    { "-invoice", "-inv", false },
+    { "inv", "inv OR pay", true },    { "inv OR pay", "inv", false },  { "+inv -c1", "+inv", true },
+    { "+inv", "+inv -c1", false },    { "code:c12", "code:c1", true }, { "code:c1", "c1", false },
+    { "-inv c1", "-inv", true },      { "inv", "", false },            { "+invoice pay", "inv pay", true }
+  };
+
+  for (const auto& refinement : refinements)
+  {
+    CHECK(parse(refinement.request).Refines(parse(refinement.previous)) == refinement.refines);
+    CHECK(parse(refinement.request, true).Refines(parse(refinement.previous, true)) == refinement.refines);
+  }
+
+  // A variant of the term must contain the text or a variant of the previous term
+  CHECK(!parse("invoice", true).Refines(parse("inv")));
+  CHECK(parse("invoice").Refines(parse("inv", true)));
+
+  // The same regular expression, conditions are never compared
+  QueryPlan regex, sameRegex;
+  regex.ParseRegex("inv\\w+");
+  sameRegex.ParseRegex("inv\\w+");
+
+  CHECK(regex.Refines(sameRegex));
+  CHECK(!regex.Refines(parse("inv")));
+
+  // Soundness: the rows of every pair of random requests where one refines the other
+  const char* const tokens[] = { "inv", "invoice", "invo", "+inv", "+invoice", "-c1", "-c12", "c1", "code:c1", "code:c12",
+                                 "+code:c1", "pay", "OR pay", "\"invoice 1\"", "+note:ord", "-note:order", "+c4", "-inv" };
+
+  std::mt19937 random(43);
+
+  std::vector<std::string>  requests;
+  std::vector<QueryPlan>    plans;
+  std::vector<SearchResult> results;
+
+  const std::vector<int> columns { 0, 1, 2 };
+
+  for (unsigned i = 0; i < 200; i++)
+  {
+    std::string request;
+
+    for (unsigned count = 1 + random() % 3; count > 0; count--)
+      request += std::string(request.empty() ? "" : " ") + tokens[random() % 18];
+
+    requests.push_back(request);
+    plans.push_back(parse(request.c_str()));
+    results.push_back(PlainSearch(dataset, plans.back(), columns, EvaluationMode::ROWS));
+  }
+
+  std::size_t refinedPairs = 0;
+
+  for (std::size_t i = 0; i < plans.size(); i++)
+  {
+    for (std::size_t j = 0; j < plans.size(); j++)
+    {
+      if (!plans[i].Refines(plans[j]))
+        continue;
+
+      refinedPairs++;
+
+      CHECK((results[i].rows - results[j].rows).Empty());
+      CHECK((results[i].roots - results[j].roots).Empty());
+    }
+  }
+
+  CHECK(refinedPairs > plans.size());
+
+  // The requests are typed one after another: the result is found among the rows of a cached one.
+  // The cached results are of all modes
+  ResultCache cache;
+  std::size_t refinedRuns = 0;
+
+  for (std::size_t i = 0; i < requests.size(); i++)
+  {
+    const EvaluationMode mode = MODES[i % 3];
+
+    QueryPlan plan = plans[i];
+    SearchCore(dataset).Optimize(plan, columns);
+
+    const SearchResult* candidates = cache.FindRefined(plan, "columns");
+
+    CHECK(cache.FindRefined(plan, "other columns") == nullptr);
+
+    SearchResult result;
+    SearchCore(dataset).Run(plan, columns, result, mode, candidates);
+
+    CHECK(SameResult(result, PlainSearch(dataset, plans[i], columns, mode)));
+
+    refinedRuns += (candidates != nullptr);
+
+    cache.Add(requests[i], "columns", plan, result);
+  }
+
+  CHECK(refinedRuns > 0);
+}
+
+} // namespace
+
+int main()
+{
+  TestRelevanceOrder();
+  TestPublishAttach();
+  TestConcurrentPublish();
+  TestHighlightLayouts();
+  TestRunByColumns();
+  TestQueryGrammar();
+  TestRegex();
+  TestSummaries();
+  TestCompressedMatching();
+  TestInternedColumns();
+  TestTypedValues();
+  TestRefinedRequests();
+
+  if (failures > 0)
+  {
+    std::printf("%u check(s) failed\n", failures);
+    return 1;
+  }
+
+  std::printf("All tests passed\n");
+  return 0;
+}
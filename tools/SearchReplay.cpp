@@ -0,0 +1,290 @@
+﻿// Headless replay of a search trace recorded by a searcher (see ISearcher::StartTraceRecording).
+// Every recorded request is run by the search core against a dataset snapshot
+// (see VstSearcher::SaveSnapshot), the latency distribution and the differences
+// between recorded and replayed results are reported.
+//
+// Build (from the repository root):
+//   g++ -std=c++17 -O2 -I. tools/SearchReplay.cpp src/SearchCore.cpp src/SearchQuery.cpp
+//       src/SearchRegex.cpp src/SearchTrace.cpp src/SearchMultiPattern.cpp
+//       src/SearchSummary.cpp src/SearchCompression.cpp src/SearchShared.cpp src/SearchValues.cpp
+//       src/SearchBitmap.cpp -o SearchReplay
+//
+// Usage:
+//   SearchReplay <trace> <snapshot> [-r <repeats>] [-v] [-c] [-p <name> | -a <name>] [-w]
+//
+//   -c - search over compressed text (as with SearchOption::COMPRESSED_CACHE)
+//   -p - publish the dataset to shared memory under the name (see SearchDataset::Publish)
+//   -a - search the dataset published by another process instead of the snapshot ("-")
+//   -w - wait for Enter before exit (on Windows the shared dataset lives while some process uses it)
+//
+// Several processes on one machine:
+//   SearchReplay trace.bin data.bin -p vst-data
+//   SearchReplay trace.bin - -a vst-data
+
+#include "src/SearchCore.h"
+#include "src/SearchTrace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <clocale>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+using namespace searcher;
+
+namespace {
+
+struct Replayed
+{
+  TraceEvent    event;
+  std::uint64_t duration { 0 }; // Best replay time (in us)
+
+  unsigned matchedRows  { 0 };
+  unsigned visibleRoots { 0 };
+
+  std::string error;
+};
+
+void PrintDistribution(const char* title, std::vector<std::uint64_t> values)
+{
+  if (values.empty())
+    return;
+
+  std::sort(values.begin(), values.end());
+
+  auto percentile = [&values](const double p)
+  {
+    const std::size_t index = static_cast<std::size_t>(p * (values.size() - 1) + 0.5);
+    return static_cast<unsigned long long>(values[index]);
+  };
+
+  unsigned long long sum = 0;
+
+  for (const auto value : values)
+    sum += value;
+
+  std::printf("%-20s min %8llu  p50 %8llu  p90 %8llu  p99 %8llu  max %8llu  mean %8llu\n", title,
+              static_cast<unsigned long long>(values.front()), percentile(0.5), percentile(0.9),
+              percentile(0.99), static_cast<unsigned long long>(values.back()), sum / values.size());
+}
+
+int Usage()
+{
+  std::fprintf(stderr, "Usage: SearchReplay <trace> <snapshot> [-r <repeats>] [-v] [-c] [-p <name> | -a <name>] [-w]\n");
+  return 2;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+  if (argc < 3)
+    return Usage();
+
+  unsigned repeats  = 1;
+  bool     verbose  = false;
+  bool     compress = false;
+  bool     wait     = false;
+
+  std::string publishName, attachName;
+
+  for (int i = 3; i < argc; i++)
+  {
+    if (std::strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+      repeats = std::max(1, std::atoi(argv[++i]));
+    else if (std::strcmp(argv[i], "-v") == 0)
+      verbose = true;
+    else if (std::strcmp(argv[i], "-c") == 0)
+      compress = true;
+    else if (std::strcmp(argv[i], "-p") == 0 && i + 1 < argc)
+      publishName = argv[++i];
+    else if (std::strcmp(argv[i], "-a") == 0 && i + 1 < argc)
+      attachName = argv[++i];
+    else if (std::strcmp(argv[i], "-w") == 0)
+      wait = true;
+    else
+      return Usage();
+  }
+
+  if (!publishName.empty() && !attachName.empty())
+    return Usage();
+
+  // Lower case conversion depends on the locale, as in the searcher
+  std::setlocale(LC_ALL, "");
+
+  try
+  {
+    SearchDataset dataset;
+
+    if (!attachName.empty())
+    {
+      const auto start      = std::chrono::steady_clock::now();
+      const auto generation = dataset.Attach(attachName);
+      const auto duration   = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+
+      std::printf("Attached to \"%s\" (generation %u, %zu bytes of text) in %lld us\n", attachName.c_str(),
+                  static_cast<unsigned>(generation), dataset.TextMemoryUsage(), static_cast<long long>(duration.count()));
+    }
+    else
+    {
+      std::ifstream snapshot(argv[2], std::ios::binary);
+
+      if (!snapshot)
+        throw std::runtime_error(std::string("Can't open the snapshot: ") + argv[2]);
+
+      dataset.Load(snapshot);
+
+      if (compress)
+      {
+        const std::size_t size = dataset.TextMemoryUsage();
+        dataset.Compress();
+
+        std::printf("Text: %zu -> %zu bytes\n", size, dataset.TextMemoryUsage());
+      }
+
+      if (!publishName.empty())
+      {
+        // The shared image has only the text: the types are set again, as by the searcher
+        const std::vector<ColumnType> types = dataset.ColumnTypes();
+
+        const auto generation = dataset.Publish(publishName);
+        std::printf("Published as \"%s\" (generation %u)\n", publishName.c_str(), static_cast<unsigned>(generation));
+
+        dataset.SetColumnTypes(types);
+      }
+    }
+
+    SearchCore core(dataset);
+    SearchResult result;
+
+    std::vector<Replayed> searches;
+
+    TraceReader reader(argv[1]);
+    TraceEvent  event;
+
+    unsigned events = 0;
+
+    while (reader.Read(event))
+    {
+      events++;
+
+      if (event.kind == TraceEvent::Kind::SEARCH)
+      {
+        Replayed replayed;
+        replayed.event = event;
+
+        searches.push_back(std::move(replayed));
+      }
+    }
+
+    for (unsigned pass = 0; pass < repeats; pass++)
+    {
+      for (auto& search : searches)
+      {
+        const TraceEvent& e = search.event;
+
+        try
+        {
+          const auto start = std::chrono::steady_clock::now();
+
+          QueryPlan plan;
+
+          if (e.options & OptionBit(SearchOption::REGEX_SEARCH))
+          {
+            plan.ParseRegex(e.text);
+          }
+          else
+          {
+            // Terms scoped to typed columns are conditions on the values (types of the snapshot)
+            plan.Parse(e.text, [&dataset](const std::string& name, int& column)
+            {
+              return dataset.ResolveColumn(name, column);
+            },
+            [&dataset](const int column)
+            {
+              const auto& types = dataset.ColumnTypes();
+              return (column >= 0 && column < static_cast<int>(types.size())) ? types[column] : ColumnType::TEXT;
+            });
+
+            if (e.options & OptionBit(SearchOption::LAYOUT_VARIANTS))
+              plan.AddLayoutVariants();
+          }
+
+          core.Optimize(plan, e.columns);
+
+          // With -c literal terms are matched over the codes, as by the searcher
+          plan.SetSymbols(dataset.Symbols());
+
+          // Matches are counted only if the searcher counted them (see EvaluationFor)
+          core.Run(plan, e.columns, result, EvaluationFor(e.options));
+
+          const std::uint64_t duration = std::chrono::duration_cast<std::chrono::microseconds>(
+                                           std::chrono::steady_clock::now() - start).count();
+
+          search.duration     = (pass == 0) ? duration : std::min(search.duration, duration);
+          search.matchedRows  = result.MatchedRows();
+          search.visibleRoots = result.VisibleRoots();
+        }
+        catch (const std::exception& ex)
+        {
+          search.error = ex.what();
+        }
+      }
+    }
+
+    std::vector<std::uint64_t> recordedTimes,
+                               replayedTimes;
+
+    unsigned diffs = 0;
+
+    std::printf("Events: %u, searches: %u, rows: %u\n", events, static_cast<unsigned>(searches.size()),
+                static_cast<unsigned>(dataset.RowCount()));
+
+    for (std::size_t i = 0; i < searches.size(); i++)
+    {
+      const Replayed& search = searches[i];
+      const TraceEvent& e = search.event;
+
+      recordedTimes.push_back(e.duration);
+      replayedTimes.push_back(search.duration);
+
+      const bool isDiff = !search.error.empty() ||
+                          (search.matchedRows != e.matchedRows) ||
+                          (search.visibleRoots != e.visibleRoots) ||
+                          (dataset.RowCount() != e.totalRows);
+
+      if (isDiff)
+        diffs++;
+
+      if (isDiff || verbose)
+      {
+        std::printf("%s #%u \"%s\": matched rows %u -> %u, visible top-level rows %u -> %u, %llu -> %llu us%s%s\n",
+                    isDiff ? "DIFF" : "    ", static_cast<unsigned>(i + 1), e.text.c_str(),
+                    e.matchedRows, search.matchedRows, e.visibleRoots, search.visibleRoots,
+                    static_cast<unsigned long long>(e.duration), static_cast<unsigned long long>(search.duration),
+                    search.error.empty() ? "" : ", error: ", search.error.c_str());
+      }
+    }
+
+    PrintDistribution("Recorded (us):", recordedTimes);
+    PrintDistribution("Replayed (us):", replayedTimes);
+
+    std::printf("Result differences: %u\n", diffs);
+
+    if (wait)
+    {
+      std::printf("Press Enter to exit\n");
+      std::getchar();
+    }
+
+    return diffs ? 1 : 0;
+  }
+  catch (const std::exception& e)
+  {
+    std::fprintf(stderr, "Error: %s\n", e.what());
+    return 2;
+  }
+}